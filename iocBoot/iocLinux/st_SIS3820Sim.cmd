@@ -0,0 +1,52 @@
+# Example Linux startup file for the simulated SIS3820
+# Run with ../../bin/linux-x86_64/SIS38XXTest st_SIS3820Sim.cmd
+# SIS38XXTest is only built on Linux with LINUX_SIS38XX = YES in configure/CONFIG_SITE
+
+< envPaths
+
+errlogInit(20000)
+
+epicsEnvSet("PREFIX",                   "SIS:3820Sim:")
+epicsEnvSet("RNAME",                    "mca")
+epicsEnvSet("MAX_SIGNALS",              "8")
+epicsEnvSet("MAX_CHANS",                "10000")
+epicsEnvSet("EPICS_CA_MAX_ARRAY_BYTES", "100000")
+epicsEnvSet("PORT",                     "SIS3820/1")
+# For MCA records FIELD=READ, for waveform records FIELD=PROC
+epicsEnvSet("FIELD",                    "READ")
+epicsEnvSet("MODEL",                    "SIS3820Sim")
+
+dbLoadDatabase("../../dbd/SIS38XXTest.dbd",0,0)
+SIS38XXTest_registerRecordDeviceDriver(pdbbase)
+
+#drvSIS3820SimConfig("Port name",
+#                     channels,
+#                     signals,
+#                     use DMA
+#                     fifoBufferWords,
+#                     external LNE rate (Hz))
+drvSIS3820SimConfig($(PORT), $(MAX_CHANS), $(MAX_SIGNALS), 2, 0x10000, 1000.)
+
+# This loads the scaler record and supporting records
+dbLoadRecords("$(SCALER)/db/scaler32.db", "P=$(PREFIX), S=scaler1, DTYP=Asyn Scaler, OUT=@asyn($(PORT)), FREQ=50000000")
+
+# This database provides the support for the MCS functions
+dbLoadRecords("$(MCA)/db/SIS38XX.template", "P=$(PREFIX), PORT=$(PORT), SCALER=$(PREFIX)scaler1")
+
+# Load the MCA records
+# The number of records loaded must be the same as MAX_SIGNALS defined above
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)1, DTYP=asynMCA, INP=@asyn($(PORT) 0), PREC=3, CHANS=$(MAX_CHANS)")
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)2, DTYP=asynMCA, INP=@asyn($(PORT) 1), PREC=3, CHANS=$(MAX_CHANS)")
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)3, DTYP=asynMCA, INP=@asyn($(PORT) 2), PREC=3, CHANS=$(MAX_CHANS)")
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)4, DTYP=asynMCA, INP=@asyn($(PORT) 3), PREC=3, CHANS=$(MAX_CHANS)")
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)5, DTYP=asynMCA, INP=@asyn($(PORT) 4), PREC=3, CHANS=$(MAX_CHANS)")
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)6, DTYP=asynMCA, INP=@asyn($(PORT) 5), PREC=3, CHANS=$(MAX_CHANS)")
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)7, DTYP=asynMCA, INP=@asyn($(PORT) 6), PREC=3, CHANS=$(MAX_CHANS)")
+dbLoadRecords("$(MCA)/db/simple_mca.db", "P=$(PREFIX), M=$(RNAME)8, DTYP=asynMCA, INP=@asyn($(PORT) 7), PREC=3, CHANS=$(MAX_CHANS)")
+
+asynSetTraceIOMask($(PORT),0,2)
+#asynSetTraceMask("$(PORT)",0,0xff)
+
+iocInit()
+
+seq(&SIS38XX_SNL, "P=$(PREFIX), R=$(RNAME), NUM_SIGNALS=$(MAX_SIGNALS), FIELD=$(FIELD)")
@@ -69,8 +69,6 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
   int status;
   epicsUInt32 controlStatusReg;
   epicsUInt32 moduleID;
-  epicsUInt32 allEnabled = 0xFFFFFFFF;
-  epicsUInt32 disableMask;
   static const char* functionName="SIS3801";
 
   setIntegerParam(SIS38XXModel_, MODEL_SIS3801);
@@ -118,6 +116,16 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
   // Create the mutex used to lock access to the FIFO
   fifoLockId_ = epicsMutexCreate();
 
+  // Allocate the buffer the FIFO is read into before it is copied to mcsData_
+  fifoBufferWords_ = SIS3801_FIFO_BUFFER_WORDS;
+  fifoBuffer_ = (epicsUInt32 *)calloc(fifoBufferWords_, sizeof(epicsUInt32));
+  if (fifoBuffer_ == NULL) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: malloc failure for fifoBuffer_\n", 
+              driverName, functionName);
+    return;
+  }
+
   /* Reset card */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: resetting port %s\n", 
@@ -135,17 +143,8 @@ drvSIS3801::drvSIS3801(const char *portName, int baseAddress, int interruptVecto
   /* Initialize board in MCS mode */
   setAcquireMode(ACQUIRE_MODE_MCS);
 
-  /* Set number of readout channels to maxSignals
-   * Assumes that the lower channels will be used first, and the only unused
-   * channels will be at the upper end of the channel range.
-   * Create a mask with zeros in the rightmost maxSignals bits,
-   * 1 in all higher order bits. */
-  if (maxSignals_ < SIS38XX_MAX_SIGNALS) disableMask = allEnabled << maxSignals_;
-  else disableMask = 0;
-  registers_->copy_disable_reg = disableMask;
-  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-            "%s:%s: setting copy disable register=0x%08x\n",
-            driverName, functionName, disableMask);
+  /* Set the readout channels to the enabled signals, initially the first maxSignals */
+  setCopyDisable();
 
   /* Set up the interrupt service routine */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
@@ -399,10 +398,13 @@ void drvSIS3801::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
   getIntegerParam(SIS38XXChannel1Source_, (int*)&channel1Source);
   
   /* Enable or disable 25 MHz channel 1 reference pulses. */
-  if ((channel1Source == CHANNEL1_SOURCE_INTERNAL) && (firmwareVersion_ >= 5))
+  if ((channel1Source == CHANNEL1_SOURCE_INTERNAL) && (firmwareVersion_ >= 5)) {
     registers_->enable_ch1_pulser = 1;
-  else
+    referenceClock_ = SIS3801_REFERENCE_CLOCK;
+  } else {
     registers_->disable_ch1_pulser = 1;
+    referenceClock_ = 0.;
+  }
 
   acquireMode_ = acquireMode;
   setIntegerParam(SIS38XXAcquireMode_, acquireMode);
@@ -436,6 +438,17 @@ void drvSIS3801::setInputMode()
   else               registers_->csr_reg = CONTROL_M_CLEAR_INPUT_MODE_BIT_1;
 }
 
+void drvSIS3801::setCopyDisable()
+{
+  static const char* functionName="setCopyDisable";
+
+  /* Only the enabled signals are copied to the FIFO, in both MCS and scaler modes */
+  registers_->copy_disable_reg = ~channelEnable_;
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: setting copy disable register=0x%08x\n",
+            driverName, functionName, ~channelEnable_);
+}
+
 
 void drvSIS3801::setLED()
 {
@@ -550,8 +563,8 @@ void drvSIS3801::readFIFOThread()
   int i;
   bool acquiring;  // We have a separate flag because we need to continue processing one last
                    // time even if acquiring_ goes to false because acquisition was manually stopped
+  int maxWords;
   epicsUInt32 scalerPresets[SIS38XX_MAX_SIGNALS];
-  epicsUInt32 *pOut=NULL;
   epicsTimeStamp t1, t2;
   static const char* functionName="readFIFOThread";
 
@@ -564,6 +577,8 @@ void drvSIS3801::readFIFOThread()
               driverName, functionName, eventType_, registers_->csr_reg & 0xFFF00000);
     lock();
     acquiring = acquiring_;
+    // This thread queues the stream file data, so it also starts the stream
+    if (acquiring && (acquireMode_ == ACQUIRE_MODE_MCS)) startStream();
     unlock();
     while (acquiring) {
       lock();
@@ -589,29 +604,25 @@ void drvSIS3801::readFIFOThread()
        * memory.
        */
       if (acquireMode_== ACQUIRE_MODE_MCS) {
-        // Copy the data from the FIFO to the mcsBuffer
-        pOut = mcsData_ + signal*maxChans_ + chan;
+        // Read the FIFO into fifoBuffer_, up to the end of channel nChans-1.
+        // It is copied to the mcsBuffer before the FIFO lock is released.
+        maxWords = (nChans - chan)*numEnabled_ - signal;
+        // In stream mode the channels wrap to 0, so there is no end
+        if (streamMode_) maxWords = fifoBufferWords_;
+        if (maxWords > fifoBufferWords_) maxWords = fifoBufferWords_;
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                  "%s:%s: pOut=%p, signal=%d, chan=%d\n",
-                  driverName, functionName, pOut, signal, chan);
-        while (((registers_->csr_reg & STATUS_M_FIFO_FLAG_EMPTY)==0) && (chan < nChans) && acquiring_) {
-          *pOut = registers_->fifo_reg;
-          signal++;
-          count++;
-          if (signal >= maxSignals_) {
-            signal = 0;
-            chan++;
-            pOut = mcsData_ + chan;
-          } else {
-            pOut += maxChans_;
-          }
+                  "%s:%s: signal=%d, chan=%d, maxWords=%d\n",
+                  driverName, functionName, signal, chan, maxWords);
+        while (((registers_->csr_reg & STATUS_M_FIFO_FLAG_EMPTY)==0) && (count < maxWords) && acquiring_) {
+          fifoBuffer_[count++] = registers_->fifo_reg;
         }
       } else if (acquireMode_ == ACQUIRE_MODE_SCALER) {
         while ((registers_->csr_reg & STATUS_M_FIFO_FLAG_EMPTY)==0 && acquiring_) {
-          scalerData_[signal] += registers_->fifo_reg;
+          // The FIFO only contains the enabled signals
+          scalerData_[enabledSignals_[signal]] += registers_->fifo_reg;
           signal++;
           count++;
-          if (signal >= maxSignals_) {
+          if (signal >= numEnabled_) {
             for (i=0; i<maxSignals_; i++) {
               if ((scalerPresets[i] != 0) && 
                   (scalerData_[i] >= scalerPresets[i]))
@@ -631,7 +642,11 @@ void drvSIS3801::readFIFOThread()
       asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                 "%s:%s: read FIFO (%d) in %fs, acquiring=%d\n",
                 driverName, functionName, count, epicsTimeDiffInSeconds(&t2, &t1), acquiring_);
-      // Release the FIFO lock, we are done accessing the FIFO
+
+      // Copy the data from the FIFO buffer to the mcsBuffer
+      if (acquireMode_ == ACQUIRE_MODE_MCS) demuxFIFO(fifoBuffer_, count, &signal, &chan);
+
+      // Release the FIFO lock, we are done accessing the FIFO and mcsData_
       epicsMutexUnlock(fifoLockId_);
       
       // Take the lock since we are now changing object data
@@ -640,8 +655,8 @@ void drvSIS3801::readFIFOThread()
       nextSignal_ = signal;
       if (acquireMode_ == ACQUIRE_MODE_MCS) {
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                  "%s:%s: pOut=%p,signal=%d, chan=%d\n",
-                  driverName, functionName, pOut, signal, chan);
+                  "%s:%s: signal=%d, chan=%d\n",
+                  driverName, functionName, signal, chan);
         checkMCSDone();
       } else if (acquireMode_ == ACQUIRE_MODE_SCALER) {
         if (!acquiring) acquiring_ = false;
@@ -668,6 +683,8 @@ void drvSIS3801::readFIFOThread()
                     driverName, functionName, eventType_);
       }
     }  
+    // All the data have been copied, the stream file can be closed
+    endStream();
   }
 }
 
@@ -37,6 +37,9 @@
 
 #define SIS3801_INTERNAL_CLOCK  10000000  /* The internal clock on the SIS3801 */
 #define SIS3801_10MHZ_CLOCK     10000000  /* The internal LNE clock on the SIS38xx */
+#define SIS3801_REFERENCE_CLOCK 25000000  /* The channel 1 reference pulses */
+
+#define SIS3801_FIFO_BUFFER_WORDS 0x10000 /* Words read from the FIFO at a time */
 
 #define SIS3801_ADDRESS_TYPE atVMEA32
 #define SIS3801_BOARD_SIZE   2048
@@ -182,6 +185,7 @@ class drvSIS3801 : public drvSIS38XX
   void clearScalerPresets();
   void setScalerPresets();
   void setInputMode();
+  void setCopyDisable();
   void softwareChannelAdvance();
   void setLED();
   int getLED();
@@ -29,6 +29,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 // Needed for memalign on vxWorks
 #ifdef vxWorks
@@ -40,7 +41,6 @@
 /******************/
 
 #include <cantProceed.h>
-#include <devLib.h>
 #include <epicsString.h>
 #include <epicsThread.h>
 #include <epicsTime.h>
@@ -53,91 +53,63 @@
 /* Custom includes */
 /*******************/
 
-#include "vmeDMA.h"
 #include "drvMca.h"
 #include "devScalerAsyn.h"
 #include "drvSIS3820.h"
 #include "sis3820.h"
+#include "sis3820Bus.h"
 
 static const char *driverName="drvSIS3820";
 static void intFuncC(void *drvPvt);
 static void readFIFOThreadC(void *drvPvt);
 static void dmaCallbackC(void *drvPvt);
 
+/* FIFO buffers must be 8-byte aligned for D64 DMA */
+static epicsUInt32 *allocFIFOBuffer(int words)
+{
+#ifdef vxWorks
+  return (epicsUInt32*) memalign(8, words*sizeof(epicsUInt32));
+#else
+  void *ptr;
+  int status = posix_memalign(&ptr, 8, words*sizeof(epicsUInt32));
+  if(status != 0) {
+    printf("Error: posix_memalign status = %d\n", status);
+    return NULL;
+  }
+  return (epicsUInt32*)ptr;
+#endif
+}
+
 /***************/
 /* Definitions */
 /***************/
 
 /*Constructor */
-drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-                       int maxChans, int maxSignals, bool useDma, int fifoBufferWords)
+drvSIS3820::drvSIS3820(const char *portName, SIS3820Bus *pBus, int interruptVector, int interruptLevel, 
+                       int maxChans, int maxSignals, int useDma, int fifoBufferWords)
   :  drvSIS38XX(portName, maxChans, maxSignals),
-     useDma_(useDma)
+     pBus_(pBus), useDma_(useDma != 0), lostFrames_(0)
 {
   int status;
-  epicsUInt32 controlStatusReg;
   epicsUInt32 moduleID;
   static const char* functionName="SIS3820";
   
   setIntegerParam(SIS38XXModel_, MODEL_SIS3820);
   
-  /* Call devLib to get the system address that corresponds to the VME
-   * base address of the board.
-   */
-  status = devRegisterAddress("drvSIS3820",
-                               SIS3820_ADDRESS_TYPE,
-                               (size_t)baseAddress,
-                               SIS3820_BOARD_SIZE,
-                               (volatile void **)&registers_);
-
-  if (status) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: %s, Can't register VME address 0x%x\n", 
-              driverName, functionName, portName, baseAddress);
-    return;
-  }
-  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-            "%s:%s: Registered VME address: 0x%x to local address: %p size: 0x%X\n", 
-            driverName, functionName, baseAddress, registers_, SIS3820_BOARD_SIZE);
-
-  /* Call devLib to get the system address that corresponds to the VME
-   * FIFO address of the board.
-   */
-  fifoBaseVME_ = (epicsUInt32 *)(baseAddress + SIS3820_FIFO_BASE);
-  status = devRegisterAddress("drvSIS3820",
-                              SIS3820_ADDRESS_TYPE,
-                              (size_t)fifoBaseVME_,
-                              SIS3820_FIFO_BYTE_SIZE,
-                              (volatile void **)&fifoBaseCPU_);
-
-  if (status) {
-    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: %s, Can't register FIFO address 0x%x\n", 
-              driverName, functionName, portName, baseAddress + SIS3820_FIFO_BASE);
-    return;
-  }
-
-  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-            "%s:%s: Registered VME FIFO address: %p to local address: %p size: 0x%X\n", 
-            driverName, functionName, fifoBaseVME_, 
-            fifoBaseCPU_, SIS3820_FIFO_BYTE_SIZE);
-
-  /* Probe VME bus to see if card is there */
-  status = devReadProbe(4, (char *) &(registers_->control_status_reg),
-                       (char *) &controlStatusReg);
-  if (status) {
+  /* Map the board and check that it is there */
+  if (pBus_->connect(pasynUserSelf)) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: devReadProbe failure for address %p = %d\n", 
-              driverName, functionName, &registers_->control_status_reg, status);
+              "%s:%s: %s, Can't connect to board\n", 
+              driverName, functionName, portName);
     return;
   }
 
   /* Get the module info from the card */
-  moduleID = (registers_->moduleID_reg & 0xFFFF0000) >> 16;
+  moduleID = (readReg(SIS3820_REG(moduleID_reg)) & 0xFFFF0000) >> 16;
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: module ID=%x\n", 
             driverName, functionName, moduleID);
-  firmwareVersion_ = registers_->moduleID_reg & 0x0000FFFF;
+  firmwareVersion_ = readReg(SIS3820_REG(moduleID_reg)) & 0x0000FFFF;
   setIntegerParam(SIS38XXFirmware_, firmwareVersion_);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: firmware=%d\n",
@@ -148,40 +120,44 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
   if (fifoBufferWords == 0) fifoBufferWords = SIS3820_FIFO_WORD_SIZE;
   if (fifoBufferWords > SIS3820_FIFO_WORD_SIZE) fifoBufferWords = SIS3820_FIFO_WORD_SIZE;
   fifoBufferWords_ = fifoBufferWords;
-#ifdef vxWorks
-  fifoBuffer_ = (epicsUInt32*) memalign(8, fifoBufferWords_*sizeof(epicsUInt32));
-#else
-  void *ptr;
-  status = posix_memalign(&ptr, 8, fifoBufferWords_*sizeof(epicsUInt32));
-  if(status != 0) {
-    printf("Error: posix_memalign status = %d\n", status);
-  }
-  fifoBuffer_ = (epicsUInt32*)ptr;
-#endif
+  fifoBuffer_ = allocFIFOBuffer(fifoBufferWords_);
   if (fifoBuffer_ == NULL) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-              "%s:%s: posix_memalign failure for fifoBuffer_ = %d\n", 
-              driverName, functionName, status);
+              "%s:%s: memory allocation failure for fifoBuffer_\n", 
+              driverName, functionName);
     return;
   }
+  fifoBuffers_[0] = fifoBuffer_;
+  fifoBuffers_[1] = NULL;
   
   dmaDoneEventId_ = epicsEventCreate(epicsEventEmpty);
   // Create the DMA ID
   if (useDma_) {
-    dmaId_ = sysDmaCreate(dmaCallbackC, (void*)this);
-    if (dmaId_ == 0 || (int)dmaId_ == -1) {
+    if (pBus_->createDma(dmaCallbackC, (void*)this)) {
       asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s: sysDmaCreate failed, errno=%d. Disabling use of DMA.\n",
+                "%s:%s: DMA create failed, errno=%d. Disabling use of DMA.\n",
                 driverName, functionName, errno);
       useDma_ = false;
     }
   }
+  // useDma=2 uses a second buffer so the next DMA overlaps copying the previous one
+  dmaBuffers_ = 1;
+  if (useDma_ && (useDma == 2)) {
+    fifoBuffers_[1] = allocFIFOBuffer(fifoBufferWords_);
+    if (fifoBuffers_[1] == NULL) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: memory allocation failure for second DMA buffer, using one buffer\n", 
+                driverName, functionName);
+    } else {
+      dmaBuffers_ = 2;
+    }
+  }
  
   /* Reset card */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: resetting port %s\n", 
             driverName, functionName, portName);
-  registers_->key_reset_reg = 1;
+  writeReg(SIS3820_REG(key_reset_reg), 1);
 
   /* Clear FIFO */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
@@ -190,15 +166,15 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
   resetFIFO();
   
   // Disable 25MHz test pulses and test mode
-  registers_->control_status_reg = CTRL_COUNTER_TEST_25MHZ_DISABLE;
-  registers_->control_status_reg = CTRL_COUNTER_TEST_MODE_DISABLE;
+  writeReg(SIS3820_REG(control_status_reg), CTRL_COUNTER_TEST_25MHZ_DISABLE);
+  writeReg(SIS3820_REG(control_status_reg), CTRL_COUNTER_TEST_MODE_DISABLE);
 
   /* Set up the interrupt service routine */
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: interruptServiceRoutine pointer %p\n",
             driverName, functionName, intFuncC);
 
-  status = devConnectInterruptVME(interruptVector, intFuncC, this);
+  status = pBus_->connectInterrupt(interruptVector, intFuncC, this);
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Can't connect to vector % d\n", 
@@ -210,18 +186,18 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
             driverName, functionName, interruptVector);
   
   /* Write interrupt level to hardware */
-  registers_->irq_config_reg &= ~SIS3820_IRQ_LEVEL_MASK;
-  registers_->irq_config_reg |= (interruptLevel << 8);
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) & ~SIS3820_IRQ_LEVEL_MASK);
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) | (interruptLevel << 8));
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: irq after setting IntLevel= 0x%x\n", 
-             driverName, functionName, registers_->irq_config_reg);
+             driverName, functionName, readReg(SIS3820_REG(irq_config_reg)));
 
   /* Write interrupt vector to hardware */
-  registers_->irq_config_reg &= ~SIS3820_IRQ_VECTOR_MASK;
-  registers_->irq_config_reg |= interruptVector;
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) & ~SIS3820_IRQ_VECTOR_MASK);
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) | interruptVector);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: irq = 0x%08x\n", 
-            driverName, functionName, registers_->irq_config_reg);
+            driverName, functionName, readReg(SIS3820_REG(irq_config_reg)));
             
   /* Initialize board in MCS mode. This will also set the initial value of the operation mode register. */
   setAcquireMode(ACQUIRE_MODE_MCS);
@@ -246,19 +222,19 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
 
   /* Set IRQ method to Release on Acknowledge (ROAK)*/  
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: irq ROAK = 0x%08x\n", 
-            driverName, functionName, registers_->irq_config_reg);
+            driverName, functionName, readReg(SIS3820_REG(irq_config_reg)));
 
-  registers_->irq_config_reg |= SIS3820_IRQ_ROAK;
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) | SIS3820_IRQ_ROAK);
 
   /* Enable interrupts in hardware */  
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: irq before enabling interrupts= 0x%08x\n", 
-            driverName, functionName, registers_->irq_config_reg);
+            driverName, functionName, readReg(SIS3820_REG(irq_config_reg)));
 
-  registers_->irq_config_reg |= SIS3820_IRQ_ENABLE;
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) | SIS3820_IRQ_ENABLE);
 
   /* Enable interrupt level in EPICS */
-  status = devEnableInterruptLevel(intVME, interruptLevel);
+  status = pBus_->enableInterruptLevel(interruptLevel);
   if (status) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: Can't enable enterrupt level %d\n", 
@@ -276,48 +252,51 @@ drvSIS3820::drvSIS3820(const char *portName, int baseAddress, int interruptVecto
 void drvSIS3820::report(FILE *fp, int details)
 {
 
-  fprintf(fp, "SIS3820: asyn port: %s, connected at VME base address %p, maxChans=%d\n",
-          portName, registers_, maxChans_);
+  fprintf(fp, "SIS3820: asyn port: %s, maxChans=%d\n",
+          portName, maxChans_);
+  pBus_->report(fp, details);
+  fprintf(fp, "  useDma=%d, DMA buffers=%d, FIFO buffer words=%d, lost frames=%u\n",
+          useDma_, dmaBuffers_, fifoBufferWords_, lostFrames_);
   if (details > 0) {
     int i;
     fprintf(fp, "  Registers:\n");
-    fprintf(fp, "    control_status_reg         = 0x%x\n",   registers_->control_status_reg);
-    fprintf(fp, "    moduleID_reg               = 0x%x\n",   registers_->moduleID_reg);
-    fprintf(fp, "    irq_config_reg             = 0x%x\n",   registers_->irq_config_reg);
-    fprintf(fp, "    irq_control_status_reg     = 0x%x\n",   registers_->irq_control_status_reg);
-    fprintf(fp, "    acq_preset_reg             = 0x%x\n",   registers_->acq_preset_reg);
-    fprintf(fp, "    acq_count_reg              = 0x%x\n",   registers_->acq_count_reg);
-    fprintf(fp, "    lne_prescale_factor_reg    = 0x%x\n",   registers_->lne_prescale_factor_reg);
-    fprintf(fp, "    preset_group1_reg          = 0x%x\n",   registers_->preset_group1_reg);
-    fprintf(fp, "    preset_group2_reg          = 0x%x\n",   registers_->preset_group2_reg);
-    fprintf(fp, "    preset_enable_reg          = 0x%x\n",   registers_->preset_enable_reg);
-    fprintf(fp, "    cblt_setup_reg             = 0x%x\n",   registers_->cblt_setup_reg);
-    fprintf(fp, "    sdram_page_reg             = 0x%x\n",   registers_->sdram_page_reg);
-    fprintf(fp, "    fifo_word_count_reg        = 0x%x\n",   registers_->fifo_word_count_reg);
-    fprintf(fp, "    fifo_word_threshold_reg    = 0x%x\n",   registers_->fifo_word_threshold_reg);
-    fprintf(fp, "    hiscal_start_preset_reg    = 0x%x\n",   registers_->hiscal_start_preset_reg);
-    fprintf(fp, "    hiscal_start_counter_reg   = 0x%x\n",   registers_->hiscal_start_counter_reg);
-    fprintf(fp, "    hiscal_last_acq_count_reg  = 0x%x\n",   registers_->hiscal_last_acq_count_reg);
-    fprintf(fp, "    op_mode_reg                = 0x%x\n",   registers_->op_mode_reg);
-    fprintf(fp, "    copy_disable_reg           = 0x%x\n",   registers_->copy_disable_reg);
-    fprintf(fp, "    lne_channel_select_reg     = 0x%x\n",   registers_->lne_channel_select_reg);
+    fprintf(fp, "    control_status_reg         = 0x%x\n",   readReg(SIS3820_REG(control_status_reg)));
+    fprintf(fp, "    moduleID_reg               = 0x%x\n",   readReg(SIS3820_REG(moduleID_reg)));
+    fprintf(fp, "    irq_config_reg             = 0x%x\n",   readReg(SIS3820_REG(irq_config_reg)));
+    fprintf(fp, "    irq_control_status_reg     = 0x%x\n",   readReg(SIS3820_REG(irq_control_status_reg)));
+    fprintf(fp, "    acq_preset_reg             = 0x%x\n",   readReg(SIS3820_REG(acq_preset_reg)));
+    fprintf(fp, "    acq_count_reg              = 0x%x\n",   readReg(SIS3820_REG(acq_count_reg)));
+    fprintf(fp, "    lne_prescale_factor_reg    = 0x%x\n",   readReg(SIS3820_REG(lne_prescale_factor_reg)));
+    fprintf(fp, "    preset_group1_reg          = 0x%x\n",   readReg(SIS3820_REG(preset_group1_reg)));
+    fprintf(fp, "    preset_group2_reg          = 0x%x\n",   readReg(SIS3820_REG(preset_group2_reg)));
+    fprintf(fp, "    preset_enable_reg          = 0x%x\n",   readReg(SIS3820_REG(preset_enable_reg)));
+    fprintf(fp, "    cblt_setup_reg             = 0x%x\n",   readReg(SIS3820_REG(cblt_setup_reg)));
+    fprintf(fp, "    sdram_page_reg             = 0x%x\n",   readReg(SIS3820_REG(sdram_page_reg)));
+    fprintf(fp, "    fifo_word_count_reg        = 0x%x\n",   readReg(SIS3820_REG(fifo_word_count_reg)));
+    fprintf(fp, "    fifo_word_threshold_reg    = 0x%x\n",   readReg(SIS3820_REG(fifo_word_threshold_reg)));
+    fprintf(fp, "    hiscal_start_preset_reg    = 0x%x\n",   readReg(SIS3820_REG(hiscal_start_preset_reg)));
+    fprintf(fp, "    hiscal_start_counter_reg   = 0x%x\n",   readReg(SIS3820_REG(hiscal_start_counter_reg)));
+    fprintf(fp, "    hiscal_last_acq_count_reg  = 0x%x\n",   readReg(SIS3820_REG(hiscal_last_acq_count_reg)));
+    fprintf(fp, "    op_mode_reg                = 0x%x\n",   readReg(SIS3820_REG(op_mode_reg)));
+    fprintf(fp, "    copy_disable_reg           = 0x%x\n",   readReg(SIS3820_REG(copy_disable_reg)));
+    fprintf(fp, "    lne_channel_select_reg     = 0x%x\n",   readReg(SIS3820_REG(lne_channel_select_reg)));
     if (firmwareVersion_ >= 0x111) {
-      fprintf(fp, "    lne_output_delay_reg       = 0x%x\n",   registers_->lne_output_delay_reg);
-      fprintf(fp, "    lne_output_width_reg       = 0x%x\n",   registers_->lne_output_width_reg);
+      fprintf(fp, "    lne_output_delay_reg       = 0x%x\n",   readReg(SIS3820_REG(lne_output_delay_reg)));
+      fprintf(fp, "    lne_output_width_reg       = 0x%x\n",   readReg(SIS3820_REG(lne_output_width_reg)));
     }
-    fprintf(fp, "    preset_channel_select_reg  = 0x%x\n",   registers_->preset_channel_select_reg);
-    fprintf(fp, "    mux_out_channel_select_reg = 0x%x\n",   registers_->mux_out_channel_select_reg);
-    fprintf(fp, "    count_disable_reg          = 0x%x\n",   registers_->count_disable_reg);
-    fprintf(fp, "    count_clear_reg            = 0x%x\n",   registers_->count_clear_reg);
-    fprintf(fp, "    counter_overflow_reg       = 0x%x\n",   registers_->counter_overflow_reg);
-    fprintf(fp, "    ch1_17_high_bits_reg       = 0x%x\n",   registers_->ch1_17_high_bits_reg);
-    fprintf(fp, "    sdram_prom_reg             = 0x%x\n",   registers_->sdram_prom_reg);
-    fprintf(fp, "    xilinx_test_data_reg       = 0x%x\n",   registers_->xilinx_test_data_reg);
-    fprintf(fp, "    xilinx_control             = 0x%x\n",   registers_->xilinx_control);
+    fprintf(fp, "    preset_channel_select_reg  = 0x%x\n",   readReg(SIS3820_REG(preset_channel_select_reg)));
+    fprintf(fp, "    mux_out_channel_select_reg = 0x%x\n",   readReg(SIS3820_REG(mux_out_channel_select_reg)));
+    fprintf(fp, "    count_disable_reg          = 0x%x\n",   readReg(SIS3820_REG(count_disable_reg)));
+    fprintf(fp, "    count_clear_reg            = 0x%x\n",   readReg(SIS3820_REG(count_clear_reg)));
+    fprintf(fp, "    counter_overflow_reg       = 0x%x\n",   readReg(SIS3820_REG(counter_overflow_reg)));
+    fprintf(fp, "    ch1_17_high_bits_reg       = 0x%x\n",   readReg(SIS3820_REG(ch1_17_high_bits_reg)));
+    fprintf(fp, "    sdram_prom_reg             = 0x%x\n",   readReg(SIS3820_REG(sdram_prom_reg)));
+    fprintf(fp, "    xilinx_test_data_reg       = 0x%x\n",   readReg(SIS3820_REG(xilinx_test_data_reg)));
+    fprintf(fp, "    xilinx_control             = 0x%x\n",   readReg(SIS3820_REG(xilinx_control)));
     for (i=0; i<32; i++) fprintf(fp,
-                "    shadow_regs[%d]            = 0x%x\n",   i, registers_->shadow_regs[i]);         
+                "    shadow_regs[%d]            = 0x%x\n",   i, readReg(SIS3820_REG(shadow_regs) + i*sizeof(epicsUInt32)));         
     for (i=0; i<32; i++) fprintf(fp,
-                "    counter_regs[%d]           = 0x%x\n",   i, registers_->counter_regs[i]);         
+                "    counter_regs[%d]           = 0x%x\n",   i, readReg(SIS3820_REG(counter_regs) + i*sizeof(epicsUInt32)));         
   }
   // Call the base class method
   drvSIS38XX::report(fp, details);
@@ -334,7 +313,7 @@ void drvSIS3820::erase()
   
   /* Erase FIFO and counters on board */
   resetFIFO();
-  registers_->key_counter_clear = 1;
+  writeReg(SIS3820_REG(key_counter_clear), 1);
 
   return;
 }
@@ -351,30 +330,30 @@ void drvSIS3820::startMCSAcquire()
   setAcquireMode(ACQUIRE_MODE_MCS);
 
   if (channelAdvanceSource == mcaChannelAdvance_Internal) 
-    registers_->key_op_enable_reg = 1;
+    writeReg(SIS3820_REG(key_op_enable_reg), 1);
   else if (channelAdvanceSource == mcaChannelAdvance_External) {
     if (countOnStart)
-      registers_->key_op_enable_reg = 1;
+      writeReg(SIS3820_REG(key_op_enable_reg), 1);
     else
-      registers_->key_op_arm_reg = 1;
+      writeReg(SIS3820_REG(key_op_arm_reg), 1);
   }
 }
 
 void drvSIS3820::stopMCSAcquire()
 {
   /* Turn off hardware acquisition */
-  registers_->key_op_disable_reg = 1;
+  writeReg(SIS3820_REG(key_op_disable_reg), 1);
 }
 
 void drvSIS3820::startScaler()
 {
   setAcquireMode(ACQUIRE_MODE_SCALER);
-  registers_->key_op_enable_reg = 1;
+  writeReg(SIS3820_REG(key_op_enable_reg), 1);
 }
 
 void drvSIS3820::stopScaler()
 {
-  registers_->key_op_disable_reg = 1;
+  writeReg(SIS3820_REG(key_op_disable_reg), 1);
   resetFIFO();
 }
 
@@ -382,7 +361,7 @@ void drvSIS3820::readScalers()
 {
   int i;
   for (i=0; i<maxSignals_; i++) {
-    scalerData_[i] = registers_->counter_regs[i];
+    scalerData_[i] = readReg(SIS3820_REG(counter_regs) + i*sizeof(epicsUInt32));
   }
 }
 
@@ -390,20 +369,20 @@ void drvSIS3820::resetScaler()
 {
   /* Reset scaler */
   setAcquireMode(ACQUIRE_MODE_SCALER);
-  registers_->key_op_disable_reg = 1;
+  writeReg(SIS3820_REG(key_op_disable_reg), 1);
   resetFIFO();
-  registers_->key_counter_clear = 1;
+  writeReg(SIS3820_REG(key_counter_clear), 1);
 }
 
 
 void drvSIS3820::clearScalerPresets()
 {
-  registers_->preset_channel_select_reg &= ~SIS3820_FOUR_BIT_MASK;
-  registers_->preset_channel_select_reg &= ~(SIS3820_FOUR_BIT_MASK << 16);
-  registers_->preset_enable_reg &= ~SIS3820_PRESET_STATUS_ENABLE_GROUP1;
-  registers_->preset_enable_reg &= ~SIS3820_PRESET_STATUS_ENABLE_GROUP2;
-  registers_->preset_group1_reg = 0;
-  registers_->preset_group2_reg = 0;
+  writeReg(SIS3820_REG(preset_channel_select_reg), readReg(SIS3820_REG(preset_channel_select_reg)) & ~SIS3820_FOUR_BIT_MASK);
+  writeReg(SIS3820_REG(preset_channel_select_reg), readReg(SIS3820_REG(preset_channel_select_reg)) & ~(SIS3820_FOUR_BIT_MASK << 16));
+  writeReg(SIS3820_REG(preset_enable_reg), readReg(SIS3820_REG(preset_enable_reg)) & ~SIS3820_PRESET_STATUS_ENABLE_GROUP1);
+  writeReg(SIS3820_REG(preset_enable_reg), readReg(SIS3820_REG(preset_enable_reg)) & ~SIS3820_PRESET_STATUS_ENABLE_GROUP2);
+  writeReg(SIS3820_REG(preset_group1_reg), 0);
+  writeReg(SIS3820_REG(preset_group2_reg), 0);
 }
 
 void drvSIS3820::setScalerPresets()
@@ -424,23 +403,23 @@ void drvSIS3820::setScalerPresets()
       getIntegerParam(i, scalerPresets_, &preset);
       if (preset != 0) {
         if (i < 16) {
-          registers_->preset_group1_reg = preset;
+          writeReg(SIS3820_REG(preset_group1_reg), preset);
           /* Enable this bank of counters for preset checking */
-          registers_->preset_enable_reg |= SIS3820_PRESET_STATUS_ENABLE_GROUP1;
+          writeReg(SIS3820_REG(preset_enable_reg), readReg(SIS3820_REG(preset_enable_reg)) | SIS3820_PRESET_STATUS_ENABLE_GROUP1);
           /* Set the correct channel for checking against the preset value */
-          presetChannelSelectRegister = registers_->preset_channel_select_reg;
+          presetChannelSelectRegister = readReg(SIS3820_REG(preset_channel_select_reg));
           presetChannelSelectRegister &= ~SIS3820_FOUR_BIT_MASK;
           presetChannelSelectRegister |= i;
-          registers_->preset_channel_select_reg = presetChannelSelectRegister;
+          writeReg(SIS3820_REG(preset_channel_select_reg), presetChannelSelectRegister);
         } else {
-          registers_->preset_group2_reg = preset;
+          writeReg(SIS3820_REG(preset_group2_reg), preset);
           /* Enable this bank of counters for preset checking */
-          registers_->preset_enable_reg |= SIS3820_PRESET_STATUS_ENABLE_GROUP2;
+          writeReg(SIS3820_REG(preset_enable_reg), readReg(SIS3820_REG(preset_enable_reg)) | SIS3820_PRESET_STATUS_ENABLE_GROUP2);
           /* Set the correct channel for checking against the preset value */
-          presetChannelSelectRegister = registers_->preset_channel_select_reg;
+          presetChannelSelectRegister = readReg(SIS3820_REG(preset_channel_select_reg));
           presetChannelSelectRegister &= ~(SIS3820_FOUR_BIT_MASK << 16);
           presetChannelSelectRegister |= (i << 16);
-          registers_->preset_channel_select_reg = presetChannelSelectRegister;
+          writeReg(SIS3820_REG(preset_channel_select_reg), presetChannelSelectRegister);
         }
       }
     }
@@ -454,8 +433,6 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
   int prescale;
   int channelAdvanceSource;
   double dwellTime;
-  epicsUInt32 allEnabled = 0xFFFFFFFF;
-  epicsUInt32 disableMask;
   static const char* functionName="setAcquireMode";
 
   acquireMode_ = acquireMode;
@@ -463,10 +440,13 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
 
   getIntegerParam(SIS38XXChannel1Source_, (int*)&channel1Source);
   /* Enable or disable 50 MHz channel 1 reference pulses. */
-  if (channel1Source == CHANNEL1_SOURCE_INTERNAL)
-    registers_->control_status_reg |= CTRL_REFERENCE_CH1_ENABLE;
-  else
-    registers_->control_status_reg |= CTRL_REFERENCE_CH1_DISABLE;
+  if (channel1Source == CHANNEL1_SOURCE_INTERNAL) {
+    writeReg(SIS3820_REG(control_status_reg), readReg(SIS3820_REG(control_status_reg)) | CTRL_REFERENCE_CH1_ENABLE);
+    referenceClock_ = SIS3820_INTERNAL_CLOCK;
+  } else {
+    writeReg(SIS3820_REG(control_status_reg), readReg(SIS3820_REG(control_status_reg)) | CTRL_REFERENCE_CH1_DISABLE);
+    referenceClock_ = 0.;
+  }
 
   /* Set the interrupt control register */
   setIrqControlStatusReg();
@@ -474,9 +454,6 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
   /* Set the operation mode register */
   setOpModeReg();
 
-  if (maxSignals_ < SIS38XX_MAX_SIGNALS) disableMask = allEnabled << maxSignals_;
-  else disableMask = 0;
-
   switch (acquireMode_) {
     case ACQUIRE_MODE_MCS:
       getIntegerParam(mcaNumChannels_, &nChans);
@@ -487,32 +464,35 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
       /* Clear all presets from scaler mode */
       clearScalerPresets();
       
-      /* Disable channel in MCS mode. We enable the first maxSignals_ inputs */
-      registers_->copy_disable_reg = disableMask;
+      /* Disable channel in MCS mode. We enable the signals in SIS38XX_CHANNEL_ENABLE */
+      setCopyDisable();
       
       /* Set the number of channels to acquire.  
-       * We could be resuming acquisition so subtract nextChan_ */
-      registers_->acq_preset_reg = nChans - nextChan_;
+       * We could be resuming acquisition so subtract nextChan_.
+       * In stream mode there is no preset, acquisition continues until it is stopped. */
+      if (streamMode_)
+        writeReg(SIS3820_REG(acq_preset_reg), 0);
+      else
+        writeReg(SIS3820_REG(acq_preset_reg), nChans - nextChan_);
 
       /* Set the LNE channel NOTE: This should allow other sources in the future */
-      registers_->lne_channel_select_reg = 0;
+      writeReg(SIS3820_REG(lne_channel_select_reg), 0);
 
       if (channelAdvanceSource == mcaChannelAdvance_Internal) {
         /* The SIS3820 requires the value in the LNE prescale register to be one
          * less than the actual number of incoming signals. We do this adjustment
          * here, so the user sees the actual number at the record level.
          */
-        registers_->op_mode_reg = (registers_->op_mode_reg & ~0xF0) | SIS3820_LNE_SOURCE_INTERNAL_10MHZ;
-        registers_->lne_prescale_factor_reg = 
-          (epicsUInt32) (SIS3820_10MHZ_CLOCK * dwellTime) - 1;
+        writeReg(SIS3820_REG(op_mode_reg), (readReg(SIS3820_REG(op_mode_reg)) & ~0xF0) | SIS3820_LNE_SOURCE_INTERNAL_10MHZ);
+        writeReg(SIS3820_REG(lne_prescale_factor_reg), (epicsUInt32) (SIS3820_10MHZ_CLOCK * dwellTime) - 1);
       }
       else if (channelAdvanceSource == mcaChannelAdvance_External) {
         /* The SIS3820 requires the value in the LNE prescale register to be one
          * less than the actual number of incoming signals. We do this adjustment
          * here, so the user sees the actual number at the record level.
          */
-        registers_->op_mode_reg = (registers_->op_mode_reg & ~0xF0) | SIS3820_LNE_SOURCE_CONTROL_SIGNAL;
-        registers_->lne_prescale_factor_reg = prescale - 1;
+        writeReg(SIS3820_REG(op_mode_reg), (readReg(SIS3820_REG(op_mode_reg)) & ~0xF0) | SIS3820_LNE_SOURCE_CONTROL_SIGNAL);
+        writeReg(SIS3820_REG(lne_prescale_factor_reg), prescale - 1);
       } 
       else {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
@@ -523,13 +503,13 @@ void drvSIS3820::setAcquireMode(SIS38XXAcquireMode_t acquireMode)
       
     case ACQUIRE_MODE_SCALER:
       /* Clear the preset register from MCS mode */
-      registers_->acq_preset_reg = 0;
+      writeReg(SIS3820_REG(acq_preset_reg), 0);
       
       /* Set the LNE channel */
-      registers_->lne_channel_select_reg = 0;
+      writeReg(SIS3820_REG(lne_channel_select_reg), 0);
 
-      /* Disable channel in scaler mode. */
-      registers_->count_disable_reg = disableMask;
+      /* Only the enabled signals count in scaler mode, as on the SIS3801 */
+      writeReg(SIS3820_REG(count_disable_reg), ~channelEnable_);
 
       break;
   }
@@ -590,7 +570,7 @@ void drvSIS3820::setOpModeReg()
     operationRegister |= SIS3820_HISCAL_START_SOURCE_VME;
     operationRegister |= SIS3820_OP_MODE_SCALER;
   }
-  registers_->op_mode_reg = operationRegister;
+  writeReg(SIS3820_REG(op_mode_reg), operationRegister);
 }
 
 
@@ -601,10 +581,10 @@ void drvSIS3820::softwareChannelAdvance()
 
   // It appears to be necessary to set the LNE source to VME for this to work
   // Save the current value, clear the bits to set it to VME, restore
-  regValue = registers_->op_mode_reg;
-  registers_->op_mode_reg = regValue & ~0xF0;
-  registers_->key_lne_pulse_reg = 1;
-  registers_->op_mode_reg = regValue;
+  regValue = readReg(SIS3820_REG(op_mode_reg));
+  writeReg(SIS3820_REG(op_mode_reg), regValue & ~0xF0);
+  writeReg(SIS3820_REG(key_lne_pulse_reg), 1);
+  writeReg(SIS3820_REG(op_mode_reg), regValue);
 }
 
 void drvSIS3820::setInputMode()
@@ -617,6 +597,17 @@ void drvSIS3820::setOutputMode()
   setOpModeReg();
 }
 
+void drvSIS3820::setCopyDisable()
+{
+  static const char* functionName="setCopyDisable";
+
+  /* Only the enabled signals are copied to the FIFO in MCS mode */
+  writeReg(SIS3820_REG(copy_disable_reg), ~channelEnable_);
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: setting copy disable register=0x%08x\n",
+            driverName, functionName, ~channelEnable_);
+}
+
 
 void drvSIS3820::setLED()
 {
@@ -624,16 +615,16 @@ void drvSIS3820::setLED()
   
   getIntegerParam(SIS38XXLED_, &value);
   if (value == 0)
-    registers_->control_status_reg = CTRL_USER_LED_OFF;
+    writeReg(SIS3820_REG(control_status_reg), CTRL_USER_LED_OFF);
   else
-    registers_->control_status_reg = CTRL_USER_LED_ON;
+    writeReg(SIS3820_REG(control_status_reg), CTRL_USER_LED_ON);
 }
 
 int drvSIS3820::getLED()
 {
   int value;
   
-  value = registers_->control_status_reg & CTRL_USER_LED_OFF;
+  value = readReg(SIS3820_REG(control_status_reg)) & CTRL_USER_LED_OFF;
   return (value == 0) ? 0:1;
 }
 
@@ -663,7 +654,7 @@ void drvSIS3820::setMuxOut()
               driverName, functionName, firmwareVersion_);
     return;
   }
-  registers_->mux_out_channel_select_reg = value - 1;
+  writeReg(SIS3820_REG(mux_out_channel_select_reg), value - 1);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: scalerMuxOutCommand %d\n", 
             driverName, functionName, value);
@@ -671,7 +662,7 @@ void drvSIS3820::setMuxOut()
 
 int drvSIS3820::getMuxOut()
 {
-  return registers_->mux_out_channel_select_reg + 1;
+  return readReg(SIS3820_REG(mux_out_channel_select_reg)) + 1;
 }
 
 void drvSIS3820::setLNEOutputStretcherEnable()
@@ -692,7 +683,7 @@ void drvSIS3820::setLNEOutputWidth()
   if (firmwareVersion_ < 0x0111) return;
   getDoubleParam(SIS38XXLNEOutputWidth_, &value);
   ivalue = epicsUInt32(value * SIS3820_INTERNAL_CLOCK + 0.5) - 1;
-  registers_->lne_output_width_reg = ivalue;
+  writeReg(SIS3820_REG(lne_output_width_reg), ivalue);
 }
 
 void drvSIS3820::setLNEOutputDelay()
@@ -703,7 +694,7 @@ void drvSIS3820::setLNEOutputDelay()
   if (firmwareVersion_ < 0x0111) return;
   getDoubleParam(SIS38XXLNEOutputDelay_, &value);
   ivalue = epicsUInt32(value * SIS3820_INTERNAL_CLOCK + 0.5);
-  registers_->lne_output_delay_reg = ivalue;
+  writeReg(SIS3820_REG(lne_output_delay_reg), ivalue);
 }
 
 void drvSIS3820::setIrqControlStatusReg()
@@ -739,7 +730,7 @@ void drvSIS3820::setIrqControlStatusReg()
   interruptRegister |= SIS3820_IRQ_SOURCE6_CLEAR;
   interruptRegister |= SIS3820_IRQ_SOURCE7_CLEAR;
 
-  registers_->irq_control_status_reg = interruptRegister;
+  writeReg(SIS3820_REG(irq_control_status_reg), interruptRegister);
 }
 
 
@@ -765,12 +756,12 @@ void drvSIS3820::dmaCallback()
 
 void drvSIS3820::enableInterrupts()
 {
-  registers_->irq_config_reg |= SIS3820_IRQ_ENABLE;
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) | SIS3820_IRQ_ENABLE);
 }
 
 void drvSIS3820::disableInterrupts()
 {
-  registers_->irq_config_reg &= ~SIS3820_IRQ_ENABLE;
+  writeReg(SIS3820_REG(irq_config_reg), readReg(SIS3820_REG(irq_config_reg)) & ~SIS3820_IRQ_ENABLE);
 }
 
 
@@ -787,7 +778,7 @@ void drvSIS3820::intFunc()
   disableInterrupts();
 
   /* Test which interrupt source has triggered this interrupt. */
-  irqStatusReg_ = registers_->irq_control_status_reg;
+  irqStatusReg_ = readReg(SIS3820_REG(irq_control_status_reg));
 
   /* Check for the FIFO threshold interrupt */
   if (irqStatusReg_ & SIS3820_IRQ_SOURCE1_FLAG)
@@ -795,7 +786,7 @@ void drvSIS3820::intFunc()
     /* Note that this is a level-sensitive interrupt, not edge sensitive, so it can't be cleared */
     /* Disable this interrupt, since it is caused by FIFO threshold, and that
      * condition is only cleared in the readFIFO routine */
-    registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE1_DISABLE;
+    writeReg(SIS3820_REG(irq_control_status_reg), SIS3820_IRQ_SOURCE1_DISABLE);
     eventType_ = EventISR1;
   }
 
@@ -803,7 +794,7 @@ void drvSIS3820::intFunc()
   else if (irqStatusReg_ & SIS3820_IRQ_SOURCE2_FLAG)
   {
     /* Reset the interrupt source */
-    registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE2_CLEAR;
+    writeReg(SIS3820_REG(irq_control_status_reg), SIS3820_IRQ_SOURCE2_CLEAR);
     // We only set acquiring_ false in scaler mode, in MCS mode we let checkMCSDone() handle this
     // otherwise we can stop reading the FIFO too soon
     if (acquireMode_ == ACQUIRE_MODE_SCALER) acquiring_ = false;
@@ -819,7 +810,7 @@ void drvSIS3820::intFunc()
      * Note that this is a level-sensitive interrupt, not edge sensitive, so it can't be cleared.
      * Instead we disable the interrupt, and re-enable it at the end of readFIFO.
      */
-    registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE4_DISABLE;
+    writeReg(SIS3820_REG(irq_control_status_reg), SIS3820_IRQ_SOURCE4_DISABLE);
     eventType_ = EventISR4;
   }
 
@@ -827,10 +818,20 @@ void drvSIS3820::intFunc()
   epicsEventSignal(readFIFOEventId_);
 }
 
+epicsUInt32 drvSIS3820::readReg(size_t offset)
+{
+  return pBus_->readReg(offset);
+}
+
+void drvSIS3820::writeReg(size_t offset, epicsUInt32 value)
+{
+  pBus_->writeReg(offset, value);
+}
+
 void drvSIS3820::resetFIFO()
 {
   epicsMutexLock(fifoLockId_);
-  registers_->key_fifo_reset_reg= 1;
+  writeReg(SIS3820_REG(key_fifo_reset_reg), 1);
   epicsMutexUnlock(fifoLockId_);
 }  
 
@@ -850,9 +851,12 @@ void drvSIS3820::readFIFOThread()
   int count;
   int signal;
   int chan;
-  int i;
+  int buffer;
+  int pending;
+  int pendingEraseCount = 0;
   bool acquiring;
-  epicsUInt32 *pIn, *pOut;
+  epicsUInt32 *pIn;
+  epicsUInt32 lostFrames;
   epicsTimeStamp t1, t2, t3;
   static const char* functionName="readFIFOThread";
 
@@ -883,33 +887,49 @@ void drvSIS3820::readFIFOThread()
       continue;
     }
     acquiring = acquiring_;
+    // This thread queues the stream file data, so it also starts the stream
+    if (acquiring && (acquireMode_ == ACQUIRE_MODE_MCS)) startStream();
     unlock();
     // MCS mode
-    while (acquiring && (acquireMode_ == ACQUIRE_MODE_MCS)) {
+    // With 2 DMA buffers the words from one DMA are kept in pending and copied to mcsData_
+    // while the next DMA runs, so the VME bus and the CPU work at the same time
+    pending = 0;
+    buffer = 0;
+    while ((acquiring || pending) && (acquireMode_ == ACQUIRE_MODE_MCS)) {
       lock();
       signal = nextSignal_;
       chan = nextChan_;
+      // Pending words from before an erase are stale
+      if (eraseCount_ != pendingEraseCount) pending = 0;
+      pendingEraseCount = eraseCount_;
       // This block of code can be slow and does not require the asynPortDriver lock because we are not
       // accessing object data that could change.  
       // It does require the FIFO lock so no one resets the FIFO while it executes
       epicsMutexLock(fifoLockId_);
       unlock();
-      count = registers_->fifo_word_count_reg;
+      // Once acquisition has stopped we only copy the pending words
+      count = acquiring ? readReg(SIS3820_REG(fifo_word_count_reg)) : 0;
       if (count > fifoBufferWords_) count = fifoBufferWords_;
+      pIn = fifoBuffers_[buffer];
       epicsTimeGetCurrent(&t1);
       if (useDma_ && (count >= MIN_DMA_TRANSFERS)) {
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-                  "%s:%s: doing DMA transfer, fifoBuffer=%p, fifoBaseVME_=%p, count=%d\n",
-                  driverName, functionName, fifoBuffer_, fifoBaseVME_, count);
-        status = sysDmaFromVme(dmaId_, fifoBuffer_, (int)fifoBaseVME_, VME_AM_EXT_SUP_D64BLT, (count)*sizeof(int), 8);
+                  "%s:%s: doing DMA transfer, fifoBuffer=%p, count=%d\n",
+                  driverName, functionName, pIn, count);
+        status = pBus_->startDma(pIn, count);
         if (status) {
           asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
-                    "%s:%s: doing DMA transfer, error calling sysDmaFromVme, status=%d, error=%d, buff=%p, fifoBaseVME_=%p, count=%d\n",
-                    driverName, functionName, status, errno, fifoBuffer_, fifoBaseVME_, count);
+                    "%s:%s: doing DMA transfer, error starting DMA, status=%d, error=%d, buff=%p, count=%d\n",
+                    driverName, functionName, status, errno, pIn, count);
         } 
         else {
+          // Copy the words from the previous DMA while this one runs
+          if (pending) {
+            demuxFIFO(fifoBuffers_[1-buffer], pending, &signal, &chan);
+            pending = 0;
+          }
           (void)epicsEventWait(dmaDoneEventId_);
-          status = sysDmaStatus(dmaId_);
+          status = pBus_->dmaStatus();
           if (status)
              asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
                        "%s:%s: DMA error, errno=%d, message=%s\n",
@@ -919,50 +939,52 @@ void drvSIS3820::readFIFOThread()
         asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                   "%s:%s: programmed transfer, count=%d\n",
                   driverName, functionName, count);
-        // Note: we were previously using memcpy here.  But that is not guaranteed to do a word transfer, which the
-        // SIS3820 requires for reading the FIFO.  In fact if the word count was 1 then a memcpy of 4 bytes was clearly
-        // not doing a word transfer on vxWorks, and was generating bus errors.
-        for (i=0; i<count; i++)
-          fifoBuffer_[i] = fifoBaseCPU_[i];
+        pBus_->readFIFO(pIn, count);
       }
       epicsTimeGetCurrent(&t2);
 
       asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-                "%s:%s: read FIFO (%d) in %fs, fifo word count after=%d, fifoBuffer_=%p, fifoBaseCPU_=%p\n",
-                driverName, functionName, count, epicsTimeDiffInSeconds(&t2, &t1), registers_->fifo_word_count_reg, fifoBuffer_, fifoBaseCPU_);
-      // Release the FIFO lock, we are done accessing the FIFO
-      epicsMutexUnlock(fifoLockId_);
-      
-      // Copy the data from the FIFO buffer to the mcsBuffer
-      pOut = mcsData_ + signal*maxChans_ + chan;
-      pIn = fifoBuffer_;
-      for (i=0; i<count; i++) {
-        *pOut = *pIn++;
-        signal++;
-        if (signal == maxSignals_) {
-          signal = 0;
-          chan++;
-          pOut = mcsData_ + chan;
-        } else {
-          pOut += maxChans_;
-        }
+                "%s:%s: read FIFO (%d) in %fs, fifo word count after=%d, fifoBuffer=%p\n",
+                driverName, functionName, count, epicsTimeDiffInSeconds(&t2, &t1), readReg(SIS3820_REG(fifo_word_count_reg)), pIn);
+      // Frames lost because the FIFO was full leave a gap in the channels
+      lostFrames = pBus_->lostFrames();
+      if (lostFrames != lostFrames_) {
+        if (lostFrames > lostFrames_)
+          asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: FIFO overrun, %u frames lost\n",
+                    driverName, functionName, lostFrames - lostFrames_);
+        lostFrames_ = lostFrames;
+      }
+      // Copy the data from the FIFO buffer to the mcsBuffer, the pending words first
+      if (pending) {
+        demuxFIFO(fifoBuffers_[1-buffer], pending, &signal, &chan);
+        pending = 0;
       }
+      if ((dmaBuffers_ > 1) && acquiring && (count >= MIN_DMA_TRANSFERS)) {
+        // Keep these words until the next DMA has been started
+        pending = count;
+        buffer = 1 - buffer;
+      } else {
+        demuxFIFO(pIn, count, &signal, &chan);
+      }
+      // Release the FIFO lock, we are done accessing the FIFO and mcsData_
+      epicsMutexUnlock(fifoLockId_);
       
-      epicsTimeGetCurrent(&t2);
+      epicsTimeGetCurrent(&t3);
       // Take the lock since we are now changing object data
       lock();
       nextChan_ = chan;
       nextSignal_ = signal;
       asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-                "%s:%s: copied data to mcsBuffer in %fs, nextChan=%d, nextSignal=%d\n",
-                driverName, functionName, epicsTimeDiffInSeconds(&t3, &t3), nextChan_, nextSignal_);
+                "%s:%s: copied data to mcsBuffer in %fs, nextChan=%d, nextSignal=%d, pending=%d\n",
+                driverName, functionName, epicsTimeDiffInSeconds(&t3, &t2), nextChan_, nextSignal_, pending);
 
       checkMCSDone();
       acquiring = acquiring_;
       /* Re-enable FIFO threshold and FIFO almost full interrupts */
       /* NOTE: WE ARE NOT USING FIFO THRESHOLD INTERRUPTS FOR NOW */
-      /* registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE1_ENABLE; */
-      registers_->irq_control_status_reg = SIS3820_IRQ_SOURCE4_ENABLE;
+      /* writeReg(SIS3820_REG(irq_control_status_reg), SIS3820_IRQ_SOURCE1_ENABLE); */
+      writeReg(SIS3820_REG(irq_control_status_reg), SIS3820_IRQ_SOURCE4_ENABLE);
 
       // Release the lock 
       unlock();
@@ -976,6 +998,8 @@ void drvSIS3820::readFIFOThread()
                     driverName, functionName, eventType_);
       }
     }
+    // All the data have been copied, the stream file can be closed
+    endStream();
   }
 }
 
@@ -983,7 +1007,16 @@ extern "C" {
 int drvSIS3820Config(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
                      int maxChans, int maxSignals, int useDma, int fifoBufferWords)
 {
-  drvSIS3820 *pSIS3820 = new drvSIS3820(portName, baseAddress, interruptVector, interruptLevel,
+  drvSIS3820 *pSIS3820 = new drvSIS3820(portName, new SIS3820VmeBus(baseAddress), interruptVector, interruptLevel,
+                                        maxChans, maxSignals, useDma, fifoBufferWords);
+  pSIS3820 = NULL;
+  return 0;
+}
+
+int drvSIS3820SimConfig(const char *portName, int maxChans, int maxSignals, int useDma,
+                        int fifoBufferWords, double lneRate)
+{
+  drvSIS3820 *pSIS3820 = new drvSIS3820(portName, new SIS3820SimBus(lneRate), 0, 0,
                                         maxChans, maxSignals, useDma, fifoBufferWords);
   pSIS3820 = NULL;
   return 0;
@@ -996,7 +1029,7 @@ static const iocshArg drvSIS3820ConfigArg2 = { "Interrupt vector", iocshArgInt};
 static const iocshArg drvSIS3820ConfigArg3 = { "Interrupt level",  iocshArgInt};
 static const iocshArg drvSIS3820ConfigArg4 = { "MaxChannels",      iocshArgInt};
 static const iocshArg drvSIS3820ConfigArg5 = { "MaxSignals",       iocshArgInt};
-static const iocshArg drvSIS3820ConfigArg6 = { "Use DMA",          iocshArgInt};
+static const iocshArg drvSIS3820ConfigArg6 = { "Use DMA (0, 1, 2=double buffered)", iocshArgInt};
 static const iocshArg drvSIS3820ConfigArg7 = { "FIFO buffer words", iocshArgInt};
 
 static const iocshArg * const drvSIS3820ConfigArgs[] = 
@@ -1019,9 +1052,35 @@ static void drvSIS3820ConfigCallFunc(const iocshArgBuf *args)
                    args[4].ival, args[5].ival, args[6].ival, args[7].ival);
 }
 
+static const iocshArg drvSIS3820SimConfigArg0 = { "Asyn port name",   iocshArgString};
+static const iocshArg drvSIS3820SimConfigArg1 = { "MaxChannels",      iocshArgInt};
+static const iocshArg drvSIS3820SimConfigArg2 = { "MaxSignals",       iocshArgInt};
+static const iocshArg drvSIS3820SimConfigArg3 = { "Use DMA (0, 1, 2=double buffered)", iocshArgInt};
+static const iocshArg drvSIS3820SimConfigArg4 = { "FIFO buffer words", iocshArgInt};
+static const iocshArg drvSIS3820SimConfigArg5 = { "External LNE rate (Hz)", iocshArgDouble};
+
+static const iocshArg * const drvSIS3820SimConfigArgs[] = 
+{ &drvSIS3820SimConfigArg0,
+  &drvSIS3820SimConfigArg1,
+  &drvSIS3820SimConfigArg2,
+  &drvSIS3820SimConfigArg3,
+  &drvSIS3820SimConfigArg4,
+  &drvSIS3820SimConfigArg5
+};
+
+static const iocshFuncDef drvSIS3820SimConfigFuncDef = 
+  {"drvSIS3820SimConfig",6,drvSIS3820SimConfigArgs};
+
+static void drvSIS3820SimConfigCallFunc(const iocshArgBuf *args)
+{
+  drvSIS3820SimConfig(args[0].sval, args[1].ival, args[2].ival, args[3].ival,
+                      args[4].ival, args[5].dval);
+}
+
 void drvSIS3820Register(void)
 {
   iocshRegister(&drvSIS3820ConfigFuncDef,drvSIS3820ConfigCallFunc);
+  iocshRegister(&drvSIS3820SimConfigFuncDef,drvSIS3820SimConfigCallFunc);
 }
 
 epicsExportRegistrar(drvSIS3820Register);
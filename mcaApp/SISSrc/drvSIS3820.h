@@ -18,6 +18,9 @@
 /* Includes */
 /************/
 
+/* System includes */
+#include <stddef.h>
+
 /* EPICS includes */
 #include "drvSIS38XX.h"
 
@@ -157,11 +160,16 @@ typedef volatile struct {
   */
 } SIS3820_REGS;
 
+/* Byte offset of a register, for SIS3820Bus::readReg and writeReg */
+#define SIS3820_REG(name) offsetof(SIS3820_REGS, name)
+
+class SIS3820Bus;
+
 class drvSIS3820 : public drvSIS38XX
 {
   public:
-  drvSIS3820(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
-             int maxChans, int maxSignals, bool useDma, int fifoBufferWords);
+  drvSIS3820(const char *portName, SIS3820Bus *pBus, int interruptVector, int interruptLevel, 
+             int maxChans, int maxSignals, int useDma, int fifoBufferWords);
 
   // Public methods we override from drvSIS38XX
   void report(FILE *fp, int details);
@@ -189,6 +197,7 @@ class drvSIS3820 : public drvSIS38XX
   void setScalerPresets();
   void setOutputMode();
   void setInputMode();
+  void setCopyDisable();
   void softwareChannelAdvance();
   void setLED();
   int getLED();
@@ -203,10 +212,14 @@ class drvSIS3820 : public drvSIS38XX
   void resetFIFO();
   void setOpModeReg();
   void setIrqControlStatusReg();
-  SIS3820_REGS *registers_;
+  epicsUInt32 readReg(size_t offset);
+  void writeReg(size_t offset, epicsUInt32 value);
+  SIS3820Bus *pBus_;
   bool useDma_;
-  DMA_ID dmaId_;
+  int dmaBuffers_;
+  epicsUInt32 *fifoBuffers_[2];   /* fifoBuffers_[1] is only allocated with useDma=2 */
   epicsEventId dmaDoneEventId_;
+  epicsUInt32 lostFrames_;        /* pBus_->lostFrames() when the FIFO was last read */
 };
 
 /***********************/
@@ -218,6 +231,8 @@ class drvSIS3820 : public drvSIS38XX
 extern "C" {
 int drvSIS3820Config(const char *portName, int baseAddress, int interruptVector, int interruptLevel, 
                      int maxChans, int maxSignals, int useDma, int fifoBufferWords);
+int drvSIS3820SimConfig(const char *portName, int maxChans, int maxSignals, int useDma,
+                        int fifoBufferWords, double lneRate);
 }
 #endif
 
@@ -9,6 +9,25 @@
  * Acknowledgements:
  * This driver module is based on previous versions by Wayne Lewis and Ulrik Pedersen.
  *
+ * MCA_TIMESTAMPS is filled as the channels are read from the FIFO.  If the
+ * channel 1 reference pulses are enabled the time of each channel is the sum
+ * of the reference counts in signal 0, so it is exact even with external
+ * channel advance.  Otherwise the time since the previous FIFO read is shared
+ * equally among the channels of the read.
+ *
+ * In stream mode (SIS38XX_STREAM_MODE=1) acquisition does not stop after
+ * nChans channels.  mcsData_ and timestamps_ are then circular buffers of
+ * nChans channels, read back oldest first, and MCA_DATA_APPEND callbacks
+ * publish each new chunk of channels.  If SIS38XX_STREAM_FILE is set when
+ * acquisition starts, the FIFO data are also queued in a ring of
+ * SIS38XX_STREAM_CHUNKS chunks, and a writer thread appends them to that file.
+ * The file holds one frame per channel, the enabled signals as epicsUInt32 in
+ * native byte order, so the length of a run is limited by the disk, not by
+ * maxChans.  The writer thread is the only one that touches the file, the FIFO
+ * thread queues the open, the data and the close.  If the writer falls more than
+ * the ring behind the file is closed, since a gap would misalign the frames, and
+ * the rest of the data of the acquisition are counted as lost.
+ *
  */
 
 /*******************/
@@ -26,6 +45,7 @@
 
 #include <cantProceed.h>
 #include <devLib.h>
+#include <epicsAtomic.h>
 #include <epicsString.h>
 #include <epicsThread.h>
 #include <epicsTime.h>
@@ -41,8 +61,29 @@
 #include "drvMca.h"
 #include "devScalerAsyn.h"
 #include "drvSIS38XX.h"
+#include "sis38xxDemux.h"
 
 static const char *driverName="drvSIS38XX";
+
+static void streamWriterThreadC(void *drvPvt);
+
+/* Copies n channels of a ring of ringSize channels to dest, starting at channel
+ * first counted since the last erase */
+template <typename T>
+static void copyRing(T *dest, const T *src, size_t ringSize, size_t first, size_t n)
+{
+  size_t index = first % ringSize;
+  size_t m;
+
+  while (n > 0) {
+    m = ringSize - index;
+    if (m > n) m = n;
+    memcpy(dest, src + index, m*sizeof(T));
+    dest += m;
+    n -= m;
+    index = 0;
+  }
+}
 /***************/
 /* Definitions */
 /***************/
@@ -50,8 +91,8 @@ static const char *driverName="drvSIS38XX";
 /*Constructor */
 drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   :  asynPortDriver(portName, maxSignals, NUM_SIS38XX_PARAMS, 
-                    asynInt32Mask | asynFloat64Mask | asynInt32ArrayMask | asynDrvUserMask,
-                    asynInt32Mask | asynFloat64Mask,
+                    asynInt32Mask | asynFloat64Mask | asynInt32ArrayMask | asynFloat64ArrayMask | asynOctetMask | asynDrvUserMask,
+                    asynInt32Mask | asynFloat64Mask | asynInt32ArrayMask | asynFloat64ArrayMask,
                     ASYN_MULTIDEVICE, 1, 0, 0),
      exists_(false), maxSignals_(maxSignals), maxChans_(maxChans),
      acquiring_(false)
@@ -83,6 +124,10 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   createParam(mcaElapsedLiveTimeString,           asynParamFloat64, &mcaElapsedLiveTime_);        /* float64, read */
   createParam(mcaElapsedRealTimeString,           asynParamFloat64, &mcaElapsedRealTime_);        /* float64, read */
   createParam(mcaElapsedCountsString,             asynParamFloat64, &mcaElapsedCounts_);          /* float64, read */
+  createParam(mcaDataAllString,                     asynParamInt32, &mcaDataAll_);                /* int32Array/int32, read */
+  createParam(mcaDataAppendString,                  asynParamInt32, &mcaDataAppend_);             /* int32Array/int32, read */
+  createParam(mcaTimestampsString,           asynParamFloat64Array, &mcaTimestamps_);             /* float64Array, read */
+  createParam(mcaTimestampsAppendString,            asynParamInt32, &mcaTimestampsAppend_);       /* float64Array/int32, read */
   createParam(SCALER_RESET_COMMAND_STRING,          asynParamInt32, &scalerReset_);               /* int32, write */
   createParam(SCALER_CHANNELS_COMMAND_STRING,       asynParamInt32, &scalerChannels_);            /* int32, read */
   createParam(SCALER_READ_COMMAND_STRING,      asynParamInt32Array, &scalerRead_);                /* int32Array, read */
@@ -103,15 +148,23 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   createParam(SIS38XXCountOnStartString,            asynParamInt32, &SIS38XXCountOnStart_);       /* int32, write */
   createParam(SIS38XXModelString,                   asynParamInt32, &SIS38XXModel_);              /* int32, read */
   createParam(SIS38XXFirmwareString,                asynParamInt32, &SIS38XXFirmware_);           /* int32, read */
+  createParam(SIS38XXChannelEnableString,           asynParamInt32, &SIS38XXChannelEnable_);      /* int32, write */
+  createParam(SIS38XXStreamModeString,              asynParamInt32, &SIS38XXStreamMode_);         /* int32, write */
+  createParam(SIS38XXStreamFileString,              asynParamOctet, &SIS38XXStreamFile_);         /* octet, write */
+  createParam(SIS38XXTotalChannelsString,         asynParamFloat64, &SIS38XXTotalChannels_);      /* float64, read */
   createParam(SIS38XXLNEOutputStretcherString,      asynParamInt32, &SIS38XXLNEOutputStretcher_); /* int32, write */
   createParam(SIS38XXLNEOutputPolarityString,       asynParamInt32, &SIS38XXLNEOutputPolarity_);  /* int32, write */
   createParam(SIS38XXLNEOutputWidthString,        asynParamFloat64, &SIS38XXLNEOutputWidth_);     /* float64, write */
   createParam(SIS38XXLNEOutputDelayString,        asynParamFloat64, &SIS38XXLNEOutputDelay_);     /* float64, write */
 
+  /* All of the signals are enabled until SIS38XX_CHANNEL_ENABLE is written */
+  if (maxSignals < SIS38XX_MAX_SIGNALS) mapChannelEnable((1u << maxSignals) - 1);
+  else mapChannelEnable(0xFFFFFFFF);
+
   /* Allocate sufficient memory space to hold all of the data collected from the
    * SIS38XX.
    */
-  mcsData_ = (epicsUInt32 *)calloc(maxSignals*maxChans, sizeof(epicsUInt32));
+  mcsData_ = (epicsUInt32 *)calloc(numEnabled_*maxChans, sizeof(epicsUInt32));
   if (mcsData_ == NULL) {
     asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
               "%s:%s: malloc failure for mcsData_\n", 
@@ -127,9 +180,27 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
     return;
   }
 
+  timestamps_ = (double *)calloc(maxChans, sizeof(double));
+  if (timestamps_ == NULL) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: malloc failure for timestamps_\n", 
+              driverName, functionName);
+    return;
+  }
+  timestampChan_ = 0;
+  referenceClock_ = 0.;
+  epicsTimeGetCurrent(&lastReadTime_);
+
   /* Initialise the pointers to the start of the buffer area */
   nextChan_ = 0;
   nextSignal_ = 0;
+  eraseCount_ = 0;
+  streamMode_ = 0;
+  ringChans_ = maxChans;
+  demuxedChans_ = 0;
+  acquiredChans_ = 0;
+  appendCallbackCursor_.next = 0;
+  appendCallbackCursor_.eraseCount = 0;
   
   /* Create the EPICS event used to wake up the readFIFOThread */
   readFIFOEventId_ = epicsEventCreate(epicsEventEmpty);
@@ -137,6 +208,24 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   // Create the mutex used to lock access to the FIFO
   fifoLockId_ = epicsMutexCreate();
 
+  /* The stream file is opened when acquisition starts, and written by its own thread */
+  streaming_ = 0;
+  streamOverflow_ = false;
+  streamLostWords_ = 0;
+  streamChunks_ = NULL;
+  streamHead_ = 0;
+  streamTail_ = 0;
+  streamEventId_ = epicsEventCreate(epicsEventEmpty);
+  if (epicsThreadCreate("SIS38XXStreamThread",
+                        epicsThreadPriorityLow,
+                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                        (EPICSTHREADFUNC)streamWriterThreadC,
+                        this) == NULL) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: epicsThreadCreate failure for stream writer\n", 
+              driverName, functionName);
+  }
+
   // Default values of some parameters
   setIntegerParam(scalerDone_, 1);
   setIntegerParam(scalerChannels_, maxSignals);
@@ -146,6 +235,10 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
   setIntegerParam(SIS38XXInputMode_, 3);
   setIntegerParam(SIS38XXOutputMode_, 0);
   setIntegerParam(SIS38XXMaxChannels_, maxChans_);
+  setIntegerParam(SIS38XXChannelEnable_, (int)channelEnable_);
+  setIntegerParam(SIS38XXStreamMode_, 0);
+  setStringParam(SIS38XXStreamFile_, "");
+  setDoubleParam(SIS38XXTotalChannels_, 0.);
   elapsedPrevious_ = 0.;
   for (i=0; i<maxSignals; i++) {
     setIntegerParam(i, mcaChannelAdvanceSource_, mcaChannelAdvance_Internal);
@@ -154,6 +247,7 @@ drvSIS38XX::drvSIS38XX(const char *portName, int maxChans, int maxSignals)
     setDoubleParam(i, mcaElapsedCounts_, 0.0);
     setDoubleParam(i, mcaElapsedRealTime_, 0.0);
     setDoubleParam(i, mcaElapsedLiveTime_, 0.0);
+    setIntegerParam(i, mcaDataAll_, maxSignals);
     setIntegerParam(i, scalerPresets_, 0);
     callParamCallbacks(i);
   }
@@ -169,6 +263,7 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
   int signal;
   int i;
   int nChans;
+  int ringChans;
   asynStatus status=asynError;
   static const char* functionName = "writeInt32";
 
@@ -191,6 +286,15 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
       if (acquireMode_ == ACQUIRE_MODE_MCS) status = asynSuccess;
       goto done;
     }
+    // In stream mode mcsData_ is a ring of nChans channels.  If its size changes the data are erased.
+    ringChans = (streamMode_ && (nChans > 0)) ? nChans : maxChans_;
+    if (ringChans != ringChans_) {
+      if (acquiredChans_ > 0) {
+        erased_ = 0;
+        erase();
+      }
+      ringChans_ = ringChans;
+    }
     // If we have already completed acquisition due to nextChan_, don't start, signal error
     if (nextChan_ >= nChans) {
         // Must toggle mcaAcquiring to 1 and back to 0 to signal SNL program to clear Acquiring
@@ -204,6 +308,7 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
     erased_ = 0;
     // Set the acquisition start time
     epicsTimeGetCurrent(&startTime_);
+    lastReadTime_ = startTime_;
     // Start the hardware
     startMCSAcquire();
     // Wake up the FIFO reading thread
@@ -322,6 +427,21 @@ asynStatus drvSIS38XX::writeInt32(asynUser *pasynUser, epicsInt32 value)
   else if (command == SIS38XXLNEOutputPolarity_) {
     setLNEOutputPolarity();
   }
+
+  else if (command == SIS38XXStreamMode_) {
+    // The mode applies when acquisition starts, so it can't change while acquiring
+    if (acquiring_) {
+      setIntegerParam(SIS38XXStreamMode_, streamMode_);
+      goto done;
+    }
+    streamMode_ = value ? 1 : 0;
+  }
+
+  else if (command == SIS38XXChannelEnable_) {
+    status = setChannelEnable((epicsUInt32)value);
+    setIntegerParam(SIS38XXChannelEnable_, (int)channelEnable_);
+    goto done;
+  }
     
   status = asynSuccess;
   done:
@@ -388,6 +508,13 @@ asynStatus drvSIS38XX::readInt32(asynUser *pasynUser, epicsInt32 *value)
   else if (command == SIS38XXMuxOut_) {
     *value = getMuxOut();
   }
+  else if ((command == mcaDataAppend_) || (command == mcaTimestampsAppend_)) {
+    /* The channel the next append read starts at */
+    mcaAppendCursor *pCursor = appendCursor(pasynUser);
+    if (!pCursor) return asynError;
+    updateAppendCursor(pCursor);
+    *value = (epicsInt32)pCursor->next;
+  }
   else {
     status = asynPortDriver::readInt32(pasynUser, value);
   }
@@ -419,20 +546,66 @@ asynStatus drvSIS38XX::readInt32Array(asynUser *pasynUser, epicsInt32 *data,
      */
     int nChans;
     int numCopy;
+    size_t first = firstChan(acquiredChans_);
     getIntegerParam(mcaNumChannels_, &nChans);
     numCopy = numRead;
     if (numCopy > nChans) numCopy = nChans;
     // We copy all the channels but we only report nchans
     // This ensures the entire array is correct even if it was not set to zero at the start
-    memcpy(data, mcsData_ + signal*maxChans_, numCopy*sizeof(epicsInt32));
+    // A disabled signal is not in mcsData_ and reads as zeros
+    // In stream mode the channels are copied oldest first
+    if (signalIndex_[signal] < 0)
+      memset(data, 0, numCopy*sizeof(epicsInt32));
+    else
+      copyRing(data, (epicsInt32 *)mcsData_ + signalIndex_[signal]*maxChans_, ringChans_, first, numCopy);
     *numActual = numRead;
-    if ((int)*numActual > nextChan_) *numActual = nextChan_;
+    if (*numActual > acquiredChans_ - first) *numActual = acquiredChans_ - first;
     // Make it set NORD non-zero?
     if (*numActual == 0) *numActual = 1;
     asynPrint(pasynUser, ASYN_TRACE_FLOW, 
               "%s:%s: [signal=%d]: read %d chans (numRead=%d, numCopy=%d, nextChan=%d, nChans=%d)\n",  
               driverName, functionName, signal, *numActual, numRead, numCopy, nextChan_, nChans);
     }
+  else if (command == mcaDataAll_) {
+    /* All of the signals in one call.  Signal i is copied to data[i*stride] */
+    int nChans;
+    size_t stride = numRead/maxSignals_;
+    size_t numCopy;
+    size_t first = firstChan(acquiredChans_);
+    getIntegerParam(mcaNumChannels_, &nChans);
+    numCopy = stride;
+    if (numCopy > (size_t)nChans) numCopy = nChans;
+    for (i=0; i<(size_t)maxSignals_; i++) {
+      if (signalIndex_[i] < 0)
+        memset(data + i*stride, 0, numCopy*sizeof(epicsInt32));
+      else
+        copyRing(data + i*stride, (epicsInt32 *)mcsData_ + signalIndex_[i]*maxChans_, ringChans_, first, numCopy);
+    }
+    *numActual = numCopy;
+    if (*numActual > acquiredChans_ - first) *numActual = acquiredChans_ - first;
+    if (*numActual == 0) *numActual = 1;
+    asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+              "%s:%s: all signals: read %d chans (stride=%d, nextChan=%d, nChans=%d)\n",  
+              driverName, functionName, (int)*numActual, (int)stride, nextChan_, nChans);
+  }
+  else if (command == mcaDataAppend_) {
+    /* Only the channels acquired since this asynUser's previous read */
+    mcaAppendCursor *pCursor = appendCursor(pasynUser);
+    size_t numCopy;
+    if (!pCursor) return asynError;
+    updateAppendCursor(pCursor);
+    numCopy = acquiredChans_ - pCursor->next;
+    if (numCopy > numRead) numCopy = numRead;
+    if (signalIndex_[signal] < 0)
+      memset(data, 0, numCopy*sizeof(epicsInt32));
+    else
+      copyRing(data, (epicsInt32 *)mcsData_ + signalIndex_[signal]*maxChans_, ringChans_, pCursor->next, numCopy);
+    *numActual = numCopy;
+    asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+              "%s:%s: [signal=%d]: read %d new chans from chan %d (acquired=%d)\n",  
+              driverName, functionName, signal, (int)numCopy, (int)pCursor->next, (int)acquiredChans_);
+    pCursor->next += numCopy;
+  }
   else if (command == scalerRead_) {
     readScalers();
     for (i=0; (i<numRead && i<(size_t)maxSignals_); i++) {
@@ -455,6 +628,397 @@ asynStatus drvSIS38XX::readInt32Array(asynUser *pasynUser, epicsInt32 *data,
   return status;
 }
 
+asynStatus drvSIS38XX::readFloat64Array(asynUser *pasynUser, epicsFloat64 *data,
+                                        size_t numRead, size_t *numActual)
+{
+  int command = pasynUser->reason;
+  size_t numCopy;
+  static const char* functionName="readFloat64Array";
+
+  if (!exists_) return asynError;
+
+  if (command == mcaTimestamps_) {
+    size_t first = firstChan(timestampChan_);
+    numCopy = timestampChan_ - first;
+    if (numCopy > numRead) numCopy = numRead;
+    copyRing(data, timestamps_, ringChans_, first, numCopy);
+    *numActual = numCopy;
+  }
+  else if (command == mcaTimestampsAppend_) {
+    /* Only the channels acquired since this asynUser's previous read */
+    mcaAppendCursor *pCursor = appendCursor(pasynUser);
+    if (!pCursor) return asynError;
+    updateAppendCursor(pCursor);
+    numCopy = timestampChan_ - pCursor->next;
+    if (numCopy > numRead) numCopy = numRead;
+    copyRing(data, timestamps_, ringChans_, pCursor->next, numCopy);
+    pCursor->next += numCopy;
+    *numActual = numCopy;
+  }
+  else {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: got illegal command %d\n",
+              driverName, functionName, command);
+    return asynError;
+  }
+  asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+            "%s:%s: read %d timestamps (timestampChan=%d)\n",  
+            driverName, functionName, (int)*numActual, (int)timestampChan_);
+  return asynSuccess;
+}
+
+/* Each asynUser connected to MCA_DATA_APPEND or MCA_TIMESTAMPS_APPEND gets its own cursor.
+ * The cursors are kept in appendCursors_, not in pasynUser->drvUser, because
+ * duplicateAsynUser copies drvUser.  A cursor is only made here and removed by drvUserDestroy,
+ * so the APPEND reads of an asynUser that was not connected with drvUserCreate, such as a
+ * duplicate, return asynError. */
+asynStatus drvSIS38XX::drvUserCreate(asynUser *pasynUser, const char *drvInfo,
+                                     const char **pptypeName, size_t *psize)
+{
+  asynStatus status;
+
+  status = asynPortDriver::drvUserCreate(pasynUser, drvInfo, pptypeName, psize);
+  if ((status == asynSuccess) &&
+      ((pasynUser->reason == mcaDataAppend_) || (pasynUser->reason == mcaTimestampsAppend_))) {
+    appendCursors_[pasynUser] = mcaAppendCursor();
+  }
+  return status;
+}
+
+asynStatus drvSIS38XX::drvUserDestroy(asynUser *pasynUser)
+{
+  appendCursors_.erase(pasynUser);
+  return asynPortDriver::drvUserDestroy(pasynUser);
+}
+
+/* Returns the append cursor of an asynUser, NULL if drvUserCreate did not make one */
+mcaAppendCursor *drvSIS38XX::appendCursor(asynUser *pasynUser)
+{
+  std::map<asynUser *, mcaAppendCursor>::iterator it = appendCursors_.find(pasynUser);
+
+  if (it == appendCursors_.end()) return NULL;
+  return &it->second;
+}
+
+/* Starts an append cursor again from channel 0 if the buffer was erased since it was set */
+void drvSIS38XX::updateAppendCursor(mcaAppendCursor *pCursor)
+{
+  size_t first;
+
+  if ((pCursor->eraseCount != eraseCount_) || (pCursor->next > acquiredChans_)) {
+    pCursor->next = 0;
+    pCursor->eraseCount = eraseCount_;
+  }
+  /* In stream mode channels that were overwritten before they were read are skipped */
+  first = firstChan(acquiredChans_);
+  if (pCursor->next < first) pCursor->next = first;
+}
+
+/* The oldest of nChans channels acquired since the last erase that is still in the ring */
+size_t drvSIS38XX::firstChan(size_t nChans)
+{
+  return (nChans > (size_t)ringChans_) ? nChans - ringChans_ : 0;
+}
+
+/* Does the MCA_DATA_APPEND callbacks with each signal's channels since the previous ones.
+ * In stream mode the new channels can wrap around the end of the ring, and they are then
+ * sent as two chunks. */
+void drvSIS38XX::doAppendCallbacks()
+{
+  int i;
+  size_t n, m, index;
+
+  updateAppendCursor(&appendCallbackCursor_);
+  n = acquiredChans_ - appendCallbackCursor_.next;
+  while (n > 0) {
+    index = appendCallbackCursor_.next % ringChans_;
+    m = ringChans_ - index;
+    if (m > n) m = n;
+    for (i=0; i<numEnabled_; i++) {
+      doCallbacksInt32Array((epicsInt32 *)mcsData_ + i*maxChans_ + index,
+                            m, mcaDataAppend_, enabledSignals_[i]);
+    }
+    doCallbacksFloat64Array(timestamps_ + index, m, mcaTimestampsAppend_, 0);
+    appendCallbackCursor_.next += m;
+    n -= m;
+  }
+}
+
+/* Copies count words read from the FIFO to mcsData_, starting at signal, chan.
+ * Returns the signal and channel for the next word in signal and chan.
+ * The FIFO only contains the enabled signals, so signal is an index into enabledSignals_.
+ * This must be called with the FIFO lock held, because setChannelEnable can move mcsData_. */
+void drvSIS38XX::demuxFIFO(const epicsUInt32 *pIn, int count, int *signal, int *chan)
+{
+  int n, firstChan;
+
+  queueStream(pIn, count);
+  while (count > 0) {
+    // The words up to the end of the ring
+    n = (ringChans_ - *chan)*numEnabled_ - *signal;
+    if (n > count) n = count;
+    firstChan = *chan;
+    sis38xxDemux(pIn, n, numEnabled_, maxChans_, mcsData_, signal, chan);
+    demuxedChans_ += *chan - firstChan;
+    pIn += n;
+    count -= n;
+    if (*chan < ringChans_) break;
+    // Without stream mode the words past the end are dropped
+    if (!streamMode_) break;
+    *chan = 0;
+  }
+}
+
+/* Sets channelEnable_ and the tables that map signals to the blocks of mcsData_ */
+void drvSIS38XX::mapChannelEnable(epicsUInt32 channelEnable)
+{
+  int signal;
+
+  channelEnable_ = channelEnable;
+  numEnabled_ = 0;
+  for (signal=0; signal<SIS38XX_MAX_SIGNALS; signal++) {
+    signalIndex_[signal] = -1;
+    if ((signal < maxSignals_) && (channelEnable & (1u << signal))) {
+      signalIndex_[signal] = numEnabled_;
+      enabledSignals_[numEnabled_++] = signal;
+    }
+  }
+}
+
+/* Changes the enabled signals.  The hardware only copies the enabled signals to the FIFO,
+ * and mcsData_ is resized to hold only those signals, so the data are erased. */
+asynStatus drvSIS38XX::setChannelEnable(epicsUInt32 channelEnable)
+{
+  int nEnabled = 0;
+  int signal;
+  epicsUInt32 *pData;
+  static const char* functionName="setChannelEnable";
+
+  if (maxSignals_ < SIS38XX_MAX_SIGNALS) channelEnable &= (1u << maxSignals_) - 1;
+  if (channelEnable == channelEnable_) return asynSuccess;
+  if (acquiring_) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: cannot change the enabled signals while acquiring\n",
+              driverName, functionName);
+    return asynError;
+  }
+  for (signal=0; signal<maxSignals_; signal++) {
+    if (channelEnable & (1u << signal)) nEnabled++;
+  }
+  if (nEnabled == 0) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: at least one signal must be enabled\n",
+              driverName, functionName);
+    return asynError;
+  }
+
+  // The FIFO thread copies to mcsData_ while holding the FIFO lock
+  epicsMutexLock(fifoLockId_);
+  pData = (epicsUInt32 *)realloc(mcsData_, nEnabled*maxChans_*sizeof(epicsUInt32));
+  if (pData == NULL) {
+    epicsMutexUnlock(fifoLockId_);
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: malloc failure for mcsData_, %d signals\n",
+              driverName, functionName, nEnabled);
+    return asynError;
+  }
+  mcsData_ = pData;
+  mapChannelEnable(channelEnable);
+  memset(mcsData_, 0, numEnabled_*maxChans_*sizeof(epicsUInt32));
+  epicsMutexUnlock(fifoLockId_);
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: channel enable=0x%08x, %d signals\n",
+            driverName, functionName, channelEnable_, numEnabled_);
+
+  setCopyDisable();
+  erased_ = 0;
+  erase();
+  return asynSuccess;
+}
+
+/* Fills in the timestamps of the channels read since the last call */
+void drvSIS38XX::updateTimestamps()
+{
+  size_t chan;
+  size_t first = firstChan(acquiredChans_);
+  double last, step;
+  epicsTimeStamp now;
+
+  if (acquiredChans_ <= timestampChan_) return;
+  epicsTimeGetCurrent(&now);
+  last = (timestampChan_ > 0) ? timestamps_[(timestampChan_-1) % ringChans_] : 0.;
+  step = epicsTimeDiffInSeconds(&now, &lastReadTime_) / (acquiredChans_ - timestampChan_);
+  /* In stream mode the channels that have already been overwritten only advance the time */
+  if (first > timestampChan_) {
+    last += (first - timestampChan_) * step;
+    timestampChan_ = first;
+  }
+  if ((referenceClock_ > 0) && (signalIndex_[0] == 0)) {
+    /* Signal 0 counts the reference pulses, i.e. the length of each channel */
+    for (chan=timestampChan_; chan<acquiredChans_; chan++) {
+      last += mcsData_[chan % ringChans_] / referenceClock_;
+      timestamps_[chan % ringChans_] = last;
+    }
+  } else {
+    for (chan=timestampChan_; chan<acquiredChans_; chan++) {
+      last += step;
+      timestamps_[chan % ringChans_] = last;
+    }
+  }
+  lastReadTime_ = now;
+  timestampChan_ = acquiredChans_;
+}
+
+/* The stream file is only touched by the stream writer thread.  The FIFO thread queues
+ * an open when an acquisition starts, the FIFO data as it reads them, and a close when
+ * the acquisition is done, so it is the only writer of streamHead_, streaming_ and
+ * streamOverflow_.  One chunk is always kept free while streaming so that the stream can
+ * be ended.  If the writer falls behind the stream is ended, and the rest of the FIFO
+ * data of the acquisition are counted as lost. */
+
+/* Queues an open of SIS38XX_STREAM_FILE if stream mode is on and the file is set.
+ * Called by the FIFO thread, with the lock held, when an MCS acquisition starts. */
+void drvSIS38XX::startStream()
+{
+  char *fileName;
+  static const char* functionName="startStream";
+
+  streamOverflow_ = false;
+  epicsAtomicSetSizeT(&streamLostWords_, 0);
+  if (streaming_ || !streamMode_) return;
+  if (!streamChunks_) {
+    streamChunks_ = (epicsUInt32 *)calloc(SIS38XX_STREAM_CHUNKS*SIS38XX_STREAM_CHUNK_WORDS, sizeof(epicsUInt32));
+    if (!streamChunks_) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: malloc failure for streamChunks_\n",
+                driverName, functionName);
+      return;
+    }
+  }
+  if (streamHead_ - epicsAtomicGetSizeT(&streamTail_) >= SIS38XX_STREAM_CHUNKS-1) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: stream file writer is busy, not streaming\n",
+              driverName, functionName);
+    return;
+  }
+  /* The file name goes to the writer thread in the chunk */
+  fileName = (char *)(streamChunks_ + (streamHead_ % SIS38XX_STREAM_CHUNKS)*SIS38XX_STREAM_CHUNK_WORDS);
+  getStringParam(SIS38XXStreamFile_, 256, fileName);
+  if (strlen(fileName) == 0) return;
+  queueStreamChunk(STREAM_OPEN, 0);
+  epicsAtomicSetIntT(&streaming_, 1);
+}
+
+/* Queues count FIFO words for the stream file writer.  This is called by the FIFO thread.
+ * If the ring is full the stream is ended and the rest of the data are lost. */
+void drvSIS38XX::queueStream(const epicsUInt32 *pIn, int count)
+{
+  size_t n;
+
+  if (!streaming_) {
+    if (streamOverflow_)
+      epicsAtomicSetSizeT(&streamLostWords_, streamLostWords_ + count);
+    return;
+  }
+  while (count > 0) {
+    if (streamHead_ - epicsAtomicGetSizeT(&streamTail_) >= SIS38XX_STREAM_CHUNKS-1) {
+      endStream(true);
+      epicsAtomicSetSizeT(&streamLostWords_, streamLostWords_ + count);
+      return;
+    }
+    n = (count < SIS38XX_STREAM_CHUNK_WORDS) ? count : SIS38XX_STREAM_CHUNK_WORDS;
+    memcpy(streamChunks_ + (streamHead_ % SIS38XX_STREAM_CHUNKS)*SIS38XX_STREAM_CHUNK_WORDS,
+           pIn, n*sizeof(epicsUInt32));
+    queueStreamChunk(STREAM_DATA, n);
+    pIn += n;
+    count -= n;
+  }
+}
+
+/* Hands the chunk at streamHead_ to the writer thread */
+void drvSIS38XX::queueStreamChunk(SIS38XXStreamOp_t op, size_t words)
+{
+  size_t index = streamHead_ % SIS38XX_STREAM_CHUNKS;
+
+  streamOps_[index] = op;
+  streamChunkWords_[index] = words;
+  /* The chunk must be written before it is published */
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&streamHead_, streamHead_+1);
+  epicsEventSignal(streamEventId_);
+}
+
+/* Called by the FIFO thread when it has copied all the data of an acquisition, or with
+ * overflow true when the writer has fallen behind.  The writer thread closes the stream
+ * file when it has written the queued data. */
+void drvSIS38XX::endStream(bool overflow)
+{
+  if (!streaming_) return;
+  epicsAtomicSetIntT(&streaming_, 0);
+  if (overflow) streamOverflow_ = true;
+  queueStreamChunk(overflow ? STREAM_OVERFLOW : STREAM_CLOSE, 0);
+}
+
+static void streamWriterThreadC(void *drvPvt)
+{
+  drvSIS38XX *pSIS38XX = (drvSIS38XX*)drvPvt;
+  pSIS38XX->streamWriterThread();
+}
+
+/** This thread opens the stream file, writes the chunks queued by queueStream to it and
+  * closes it, so the FIFO thread never waits for the disk.  It is the only user of the file. */
+void drvSIS38XX::streamWriterThread()
+{
+  FILE *streamFile = NULL;
+  size_t tail, index;
+  size_t n;
+  epicsUInt32 *pChunk;
+  static const char* functionName="streamWriterThread";
+
+  while(true)
+  {
+    (void)epicsEventWait(streamEventId_);
+    tail = streamTail_;
+    while (tail != epicsAtomicGetSizeT(&streamHead_)) {
+      epicsAtomicReadMemoryBarrier();
+      index = tail % SIS38XX_STREAM_CHUNKS;
+      pChunk = streamChunks_ + index*SIS38XX_STREAM_CHUNK_WORDS;
+      n = streamChunkWords_[index];
+      if (streamOps_[index] == STREAM_OPEN) {
+        if (streamFile) fclose(streamFile);
+        streamFile = fopen((char *)pChunk, "ab");
+        if (streamFile) {
+          /* Larger writes, the chunks are written as they arrive */
+          setvbuf(streamFile, NULL, _IOFBF, 1024*1024);
+        } else {
+          asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: cannot open %s\n",
+                    driverName, functionName, (char *)pChunk);
+        }
+      }
+      else if (streamFile && (n > 0) &&
+               (fwrite(pChunk, sizeof(epicsUInt32), n, streamFile) != n)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: error writing stream file, closing file\n",
+                  driverName, functionName);
+        fclose(streamFile);
+        streamFile = NULL;
+      }
+      if (streamOps_[index] == STREAM_OVERFLOW)
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: stream file writer fell behind, data lost, closing file\n",
+                  driverName, functionName);
+      if (streamFile && (streamOps_[index] >= STREAM_CLOSE)) {
+        fclose(streamFile);
+        streamFile = NULL;
+      }
+      tail++;
+      epicsAtomicWriteMemoryBarrier();
+      epicsAtomicSetSizeT(&streamTail_, tail);
+    }
+  }
+}
+
 /* Report  parameters */
 void drvSIS38XX::report(FILE *fp, int details)
 {
@@ -462,6 +1026,13 @@ void drvSIS38XX::report(FILE *fp, int details)
   if (details > 0) {
     fprintf(fp, "  acquire mode     = %d\n",   acquireMode_);
     fprintf(fp, "  max signals      = %d\n",   maxSignals_);
+    fprintf(fp, "  channel enable   = 0x%08x (%d signals)\n", channelEnable_, numEnabled_);
+    fprintf(fp, "  stream mode      = %d, ring channels=%d, acquired channels=%.0f\n",
+                streamMode_, ringChans_, (double)acquiredChans_);
+    fprintf(fp, "  stream file      = %s, queued chunks=%d, lost words=%.0f\n",
+                epicsAtomicGetIntT(&streaming_) ? "streaming" : "idle",
+                (int)(epicsAtomicGetSizeT(&streamHead_) - epicsAtomicGetSizeT(&streamTail_)),
+                (double)epicsAtomicGetSizeT(&streamLostWords_));
     fprintf(fp, "  max channels     = %d\n",   maxChans_);
     fprintf(fp, "  next channel     = %d\n",   nextChan_);
     fprintf(fp, "  next signal      = %d\n",   nextSignal_);
@@ -496,17 +1067,26 @@ void drvSIS38XX::erase()
   erased_ = 1;
 
   getIntegerParam(mcaNumChannels_, &nChans);
+  if ((nChans < 0) || (nChans > maxChans_)) nChans = maxChans_;
   epicsTimeGetCurrent(&begin);
-  /* Erase buffer in driver */
-  memset(mcsData_, 0, maxSignals_ * nChans * sizeof(epicsUInt32));
+  /* Erase buffer in driver.  Each enabled signal has a block of maxChans_ words,
+   * only the first nChans of them can hold data. */
+  for (i=0; i<numEnabled_; i++)
+    memset(mcsData_ + i*maxChans_, 0, nChans * sizeof(epicsUInt32));
   epicsTimeGetCurrent(&end);
   asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s:%s: cleared local buffer (%d) in %fs\n",
-            driverName, functionName, maxSignals_*nChans, epicsTimeDiffInSeconds(&end, &begin));
+            driverName, functionName, numEnabled_*nChans, epicsTimeDiffInSeconds(&end, &begin));
 
   /* Reset pointers to start of buffer */
   nextChan_ = 0;
   nextSignal_ = 0;
+  demuxedChans_ = 0;
+  acquiredChans_ = 0;
+  setDoubleParam(SIS38XXTotalChannels_, 0.);
+  /* Append cursors start again from channel 0 */
+  eraseCount_++;
+  timestampChan_ = 0;
 
   /* Reset the elapsed time and counts */
   elapsedPrevious_ = 0.;
@@ -522,6 +1102,7 @@ void drvSIS38XX::erase()
    * acquiring, and AcqOn will not be called. Normally this is set in AcqOn.
    */
   epicsTimeGetCurrent(&startTime_);
+  lastReadTime_ = startTime_;
 
   return;
 }
@@ -556,8 +1137,9 @@ void drvSIS38XX::checkMCSDone()
 
   /* Check that acquisition is complete by nextChan and nextSignal.  This ensures
    * that it will be detected even if interrupts are disabled.
+   * In stream mode acquisition continues past nChans.
    */
-  if (acquiring_) {
+  if (acquiring_ && !streamMode_) {
     if (nextChan_ >= nChans) {
       acquiring_ = false;
       asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
@@ -582,6 +1164,8 @@ void drvSIS38XX::checkMCSDone()
   
   // Set current channel
   setIntegerParam(SIS38XXCurrentChannel_, nextChan_);
+  acquiredChans_ = demuxedChans_;
+  setDoubleParam(SIS38XXTotalChannels_, (double)acquiredChans_);
 
   if (!acquiring_) {
     // Do callbacks on mcaAcquiring
@@ -593,6 +1177,10 @@ void drvSIS38XX::checkMCSDone()
     }
   }
 
+  // Do callbacks with the channels read since the last time
+  updateTimestamps();
+  doAppendCallbacks();
+
   // Do callbacks on all channels
   for (signal=0; signal<maxSignals_; signal++) {
     callParamCallbacks(signal);
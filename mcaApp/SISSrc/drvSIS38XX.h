@@ -18,11 +18,16 @@
 /* Includes */
 /************/
 
+#include <stdio.h>
+#include <map>
+
 /* EPICS includes */
 #include <asynPortDriver.h>
 #include <epicsEvent.h>
 #include <epicsTypes.h>
 
+#include "drvMca.h"
+
 
 
 /***************/
@@ -43,6 +48,10 @@
 #define SIS38XXCountOnStartString           "SIS38XX_COUNT_ON_START"
 #define SIS38XXModelString                  "SIS38XX_MODEL"
 #define SIS38XXFirmwareString               "SIS38XX_FIRMWARE"
+#define SIS38XXChannelEnableString          "SIS38XX_CHANNEL_ENABLE"
+#define SIS38XXStreamModeString             "SIS38XX_STREAM_MODE"
+#define SIS38XXStreamFileString             "SIS38XX_STREAM_FILE"
+#define SIS38XXTotalChannelsString          "SIS38XX_TOTAL_CHANNELS"
 #define SIS38XXLNEOutputStretcherString     "SIS38XX_LNE_OUTPUT_STRETCHER"
 #define SIS38XXLNEOutputPolarityString      "SIS38XX_LNE_OUTPUT_POLARITY"
 #define SIS38XXLNEOutputWidthString         "SIS38XX_LNE_OUTPUT_WIDTH"
@@ -50,11 +59,23 @@
 
 #define SIS38XX_MAX_SIGNALS 32
 
+/* The ring of FIFO data waiting to be written to the stream file */
+#define SIS38XX_STREAM_CHUNKS      16
+#define SIS38XX_STREAM_CHUNK_WORDS 0x10000
+
 typedef enum {
     ACQUIRE_MODE_MCS,
     ACQUIRE_MODE_SCALER
 } SIS38XXAcquireMode_t;
 
+/* What the stream file writer does with a chunk */
+typedef enum {
+    STREAM_OPEN,        /* Open the file named in the chunk */
+    STREAM_DATA,        /* Write the words in the chunk */
+    STREAM_CLOSE,       /* Write the words, then close the file */
+    STREAM_OVERFLOW     /* The same, after data were lost */
+} SIS38XXStreamOp_t;
+
 typedef enum {
     CHANNEL1_SOURCE_INTERNAL,
     CHANNEL1_SOURCE_EXTERNAL
@@ -96,11 +117,29 @@ class drvSIS38XX : public asynPortDriver
   asynStatus readInt32(asynUser *pasynUser, epicsInt32 *value);
   asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *data, 
                                     size_t maxChans, size_t *nactual);
+  asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *data,
+                              size_t maxChans, size_t *nactual);
+  asynStatus drvUserCreate(asynUser *pasynUser, const char *drvInfo,
+                           const char **pptypeName, size_t *psize);
+  asynStatus drvUserDestroy(asynUser *pasynUser);
   virtual void report(FILE *fp, int details);
+  void streamWriterThread(); // Should be private, but called from C thread function
   
   protected:
   virtual void checkMCSDone();
   virtual void erase();
+  mcaAppendCursor *appendCursor(asynUser *pasynUser);
+  void updateAppendCursor(mcaAppendCursor *pCursor);
+  void doAppendCallbacks();
+  void updateTimestamps();
+  void demuxFIFO(const epicsUInt32 *pIn, int count, int *signal, int *chan);
+  asynStatus setChannelEnable(epicsUInt32 channelEnable);
+  void mapChannelEnable(epicsUInt32 channelEnable);
+  size_t firstChan(size_t nChans);
+  void startStream();
+  void queueStream(const epicsUInt32 *pIn, int count);
+  void queueStreamChunk(SIS38XXStreamOp_t op, size_t words);
+  void endStream(bool overflow=false);
   // Pure virtual functions have = 0, derived class must implement these
   // Base class implements a dummy routine for methods that not all derived classes support
   virtual void stopMCSAcquire() = 0;
@@ -116,6 +155,7 @@ class drvSIS38XX : public asynPortDriver
   virtual void setScalerPresets() = 0;
   virtual void setOutputMode() {};
   virtual void setInputMode() = 0;
+  virtual void setCopyDisable() = 0;
   virtual void softwareChannelAdvance() = 0;
   virtual void setLED() = 0;
   virtual int getLED() = 0;
@@ -148,6 +188,10 @@ class drvSIS38XX : public asynPortDriver
   int mcaElapsedLiveTime_;
   int mcaElapsedRealTime_;
   int mcaElapsedCounts_;
+  int mcaDataAll_;
+  int mcaDataAppend_;
+  int mcaTimestamps_;
+  int mcaTimestampsAppend_;
   int scalerReset_;
   int scalerChannels_;
   int scalerRead_;
@@ -168,6 +212,10 @@ class drvSIS38XX : public asynPortDriver
   int SIS38XXCountOnStart_;
   int SIS38XXModel_;
   int SIS38XXFirmware_;
+  int SIS38XXChannelEnable_;
+  int SIS38XXStreamMode_;
+  int SIS38XXStreamFile_;
+  int SIS38XXTotalChannels_;
   int SIS38XXLNEOutputStretcher_;
   int SIS38XXLNEOutputPolarity_;
   int SIS38XXLNEOutputWidth_;
@@ -186,10 +234,34 @@ class drvSIS38XX : public asynPortDriver
   epicsTimeStamp startTime_;
   double elapsedPrevious_;
   bool erased_;
-  epicsUInt32 *mcsData_;     /* maxSignals * maxChans */
+  epicsUInt32 *mcsData_;     /* numEnabled * maxChans, only the enabled signals */
+  epicsUInt32 channelEnable_;                  /* Bit i set if signal i is enabled */
+  int numEnabled_;                             /* Number of bits set in channelEnable_ */
+  int enabledSignals_[SIS38XX_MAX_SIGNALS];    /* The enabled signals in FIFO order */
+  int signalIndex_[SIS38XX_MAX_SIGNALS];       /* Block of each signal in mcsData_, -1 if disabled */
   epicsUInt32 *scalerData_;  /* maxSignals */
-  int nextChan_;
+  int nextChan_;             /* Next channel of mcsData_ to write, it wraps in stream mode */
   int nextSignal_;
+  int eraseCount_;
+  int streamMode_;
+  int ringChans_;            /* Channels in mcsData_ before it wraps, nChans in stream mode */
+  size_t acquiredChans_;     /* Channels acquired since the last erase */
+  size_t demuxedChans_;      /* The same, counted by the FIFO thread in demuxFIFO */
+  int streaming_;             /* FIFO data are being queued, only set by the FIFO thread */
+  bool streamOverflow_;      /* The writer fell behind and the stream was ended, FIFO thread only */
+  size_t streamLostWords_;   /* FIFO words not written to the stream file since it overflowed */
+  epicsUInt32 *streamChunks_;                        /* SIS38XX_STREAM_CHUNKS * SIS38XX_STREAM_CHUNK_WORDS */
+  SIS38XXStreamOp_t streamOps_[SIS38XX_STREAM_CHUNKS];
+  size_t streamChunkWords_[SIS38XX_STREAM_CHUNKS];
+  size_t streamHead_;        /* Written by the FIFO thread */
+  size_t streamTail_;        /* Written by the stream writer thread */
+  epicsEventId streamEventId_;
+  double *timestamps_;       /* maxChans, a ring of ringChans_ like mcsData_ */
+  size_t timestampChan_;     /* Channels acquired since the last erase with timestamps */
+  double referenceClock_;    /* Frequency of the channel 1 reference pulses, 0 if disabled */
+  epicsTimeStamp lastReadTime_;
+  mcaAppendCursor appendCallbackCursor_;  /* Channels already sent in append callbacks */
+  std::map<asynUser *, mcaAppendCursor> appendCursors_;  /* Each APPEND reader's cursor */
   epicsUInt32 *fifoBuffer_;
   int fifoBufferWords_;
   epicsUInt32 *fifoBuffPtr_;
@@ -0,0 +1,125 @@
+/* sis3820Bus.h --
+ * Access to the registers, FIFO, DMA and interrupts of an SIS3820.
+ * drvSIS3820 does all its hardware access through an SIS3820Bus.  SIS3820VmeBus
+ * is a board on the VME bus, using devLib and the DMA routines in vmeDMA.h.
+ * SIS3820SimBus is a software model of the board that needs no hardware, so the
+ * driver, databases and clients can be run and tested on a Linux host.
+ */
+
+#ifndef sis3820BusH
+#define sis3820BusH
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <asynDriver.h>
+
+#include "drvSIS3820.h"
+
+typedef void (*SIS3820BusFunc)(void *pvt);
+
+class SIS3820Bus
+{
+  public:
+  virtual ~SIS3820Bus() {}
+  /** Maps the board and checks that it is present.  Returns 0 on success. */
+  virtual int connect(asynUser *pasynUser) = 0;
+  /** Register access, offset is the byte offset in SIS3820_REGS, see SIS3820_REG() */
+  virtual epicsUInt32 readReg(size_t offset) = 0;
+  virtual void writeReg(size_t offset, epicsUInt32 value) = 0;
+  /** Reads count words from the FIFO with programmed I/O */
+  virtual void readFIFO(epicsUInt32 *pOut, int count) = 0;
+  /** Returns non-zero if DMA cannot be used.  callback is called when each transfer is done. */
+  virtual int createDma(SIS3820BusFunc callback, void *pvt) = 0;
+  /** Starts a DMA of count words from the FIFO to pOut */
+  virtual int startDma(epicsUInt32 *pOut, int count) = 0;
+  virtual int dmaStatus() = 0;
+  virtual int connectInterrupt(int vector, SIS3820BusFunc isr, void *pvt) = 0;
+  virtual int enableInterruptLevel(int level) = 0;
+  /** Returns the number of frames lost because the FIFO was full, since the FIFO was last reset.
+    * The board does not count them, so SIS3820VmeBus returns 0. */
+  virtual epicsUInt32 lostFrames() = 0;
+  virtual void report(FILE *fp, int details) = 0;
+};
+
+class SIS3820VmeBus : public SIS3820Bus
+{
+  public:
+  SIS3820VmeBus(int baseAddress);
+  int connect(asynUser *pasynUser);
+  epicsUInt32 readReg(size_t offset);
+  void writeReg(size_t offset, epicsUInt32 value);
+  void readFIFO(epicsUInt32 *pOut, int count);
+  int createDma(SIS3820BusFunc callback, void *pvt);
+  int startDma(epicsUInt32 *pOut, int count);
+  int dmaStatus();
+  int connectInterrupt(int vector, SIS3820BusFunc isr, void *pvt);
+  int enableInterruptLevel(int level);
+  epicsUInt32 lostFrames();
+  void report(FILE *fp, int details);
+
+  private:
+  int baseAddress_;
+  SIS3820_REGS *registers_;
+  epicsUInt32 fifoBaseVME_;
+  epicsUInt32 *fifoBaseCPU_;
+  void *dmaId_;   /* DMA_ID from vmeDMA.h */
+};
+
+/* The simulated board generates frames from the sim thread every SIS3820_SIM_PERIOD seconds */
+#define SIS3820_SIM_PERIOD    0.01
+/* Count rate of simulated input N (1-32) is N * SIS3820_SIM_COUNT_RATE Hz.
+ * Input 1 counts at SIS3820_INTERNAL_CLOCK when the reference pulser is enabled. */
+#define SIS3820_SIM_COUNT_RATE 1000.
+#define SIS3820_SIM_FIRMWARE  0x0111
+
+class SIS3820SimBus : public SIS3820Bus
+{
+  public:
+  SIS3820SimBus(double lneRate);
+  int connect(asynUser *pasynUser);
+  epicsUInt32 readReg(size_t offset);
+  void writeReg(size_t offset, epicsUInt32 value);
+  void readFIFO(epicsUInt32 *pOut, int count);
+  int createDma(SIS3820BusFunc callback, void *pvt);
+  int startDma(epicsUInt32 *pOut, int count);
+  int dmaStatus();
+  int connectInterrupt(int vector, SIS3820BusFunc isr, void *pvt);
+  int enableInterruptLevel(int level);
+  epicsUInt32 lostFrames();
+  void report(FILE *fp, int details);
+  void simThread(); // Should be private, but called from C callback function
+
+  private:
+  void reset();
+  void startAcquire();
+  double countRate(int signal);
+  double lneRate();
+  void writeFrames(epicsUInt32 nFrames);
+  void update();
+  bool interruptPending();
+  SIS3820_REGS *registers_;
+  epicsMutexId lock_;
+  double extLneRate_;
+  bool running_;
+  epicsTimeStamp lastTime_;
+  double liveTime_;
+  double lneTime_;         /* Time since acquisition started */
+  double frameTime_;       /* Time of the last LNE since acquisition started */
+  epicsUInt32 lneCount_;
+  epicsUInt32 irqEnable_;  /* Bit n is set if interrupt source n is enabled */
+  epicsUInt32 irqFlags_;   /* Bit n is set if interrupt source n has been raised */
+  epicsUInt32 *fifo_;
+  size_t fifoHead_;        /* Index of the oldest word in fifo_ */
+  size_t fifoCount_;
+  epicsUInt32 lostFrames_; /* Frames that did not fit in the FIFO since it was reset */
+  SIS3820BusFunc isr_;
+  void *isrPvt_;
+  SIS3820BusFunc dmaCallback_;
+  void *dmaPvt_;
+};
+
+#endif /* sis3820BusH */
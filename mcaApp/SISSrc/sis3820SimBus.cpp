@@ -0,0 +1,383 @@
+/* sis3820SimBus.cpp -- Software model of an SIS3820.
+ * The registers are held in memory.  Writes to the key registers start and
+ * stop acquisition, reset the FIFO and clear the counters, as on the board.
+ * A thread advances the model every SIS3820_SIM_PERIOD seconds.  In MCS mode
+ * it writes one frame to the FIFO for each LNE, either from the internal 10 MHz
+ * clock divided by the prescale factor, or from simulated external LNE pulses at
+ * the rate given in drvSIS3820SimConfig, also divided by the prescale factor.
+ * Each frame has one word for each input that is not copy disabled, with the
+ * counts of that input since the previous LNE.  It raises the acquisition
+ * complete and FIFO almost full interrupts and calls the interrupt routine from
+ * the thread.  Frames that do not fit in the FIFO are lost, as on the
+ * board, and counted, see lostFrames().  DMA is done by copying the FIFO and calling the DMA callback.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+#include <asynDriver.h>
+
+#include "sis3820.h"
+#include "sis3820Bus.h"
+
+static const char *driverName="SIS3820SimBus";
+
+/* The FIFO almost full interrupt is raised when the FIFO is 15/16 full */
+#define SIM_FIFO_ALMOST_FULL (SIS3820_FIFO_WORD_SIZE/16*15)
+
+static void simThreadC(void *pvt)
+{
+  SIS3820SimBus *pSimBus = (SIS3820SimBus*)pvt;
+  pSimBus->simThread();
+}
+
+/* The 32-bit counter value for a number of counts */
+static epicsUInt32 counterValue(double counts)
+{
+  return (epicsUInt32)fmod(floor(counts), 4294967296.);
+}
+
+SIS3820SimBus::SIS3820SimBus(double lneRate)
+  : registers_(NULL), extLneRate_(lneRate), running_(false), liveTime_(0.), lneTime_(0.),
+    frameTime_(0.), lneCount_(0), irqEnable_(0), irqFlags_(0), fifo_(NULL), fifoHead_(0), fifoCount_(0), lostFrames_(0),
+    isr_(NULL), isrPvt_(NULL), dmaCallback_(NULL), dmaPvt_(NULL)
+{
+  lock_ = epicsMutexMustCreate();
+  epicsTimeGetCurrent(&lastTime_);
+}
+
+int SIS3820SimBus::connect(asynUser *pasynUser)
+{
+  static const char* functionName="connect";
+
+  registers_ = (SIS3820_REGS *)calloc(1, sizeof(SIS3820_REGS));
+  fifo_ = (epicsUInt32 *)calloc(SIS3820_FIFO_WORD_SIZE, sizeof(epicsUInt32));
+  if ((registers_ == NULL) || (fifo_ == NULL)) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: memory allocation failure for registers or FIFO\n",
+              driverName, functionName);
+    return -1;
+  }
+  reset();
+
+  if (epicsThreadCreate("SIS3820SimThread",
+                         epicsThreadPriorityMedium,
+                         epicsThreadGetStackSize(epicsThreadStackMedium),
+                         (EPICSTHREADFUNC)simThreadC,
+                         this) == NULL) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: epicsThreadCreate failure\n",
+              driverName, functionName);
+    return -1;
+  }
+  asynPrint(pasynUser, ASYN_TRACE_FLOW,
+            "%s:%s: simulated board, external LNE rate=%f Hz\n",
+            driverName, functionName, extLneRate_);
+  return 0;
+}
+
+/* Clears the registers and the FIFO, as key_reset_reg does on the board */
+void SIS3820SimBus::reset()
+{
+  memset((void *)registers_, 0, sizeof(SIS3820_REGS));
+  registers_->moduleID_reg = (0x3820 << 16) | SIS3820_SIM_FIRMWARE;
+  running_ = false;
+  liveTime_ = 0.;
+  irqEnable_ = 0;
+  irqFlags_ = 0;
+  fifoHead_ = 0;
+  fifoCount_ = 0;
+  lostFrames_ = 0;
+}
+
+void SIS3820SimBus::startAcquire()
+{
+  update();
+  running_ = true;
+  lneTime_ = 0.;
+  frameTime_ = 0.;
+  lneCount_ = 0;
+  registers_->acq_count_reg = 0;
+  registers_->preset_enable_reg &= ~(SIS3820_PRESET_REACHED_GROUP1 | SIS3820_PRESET_REACHED_GROUP2);
+}
+
+/* Counts per second of input signal (0-31) */
+double SIS3820SimBus::countRate(int signal)
+{
+  if ((signal == 0) && (registers_->control_status_reg & CTRL_REFERENCE_CH1_ENABLE))
+    return SIS3820_INTERNAL_CLOCK;
+  if (registers_->count_disable_reg & (1u << signal)) return 0.;
+  return (signal + 1) * SIS3820_SIM_COUNT_RATE;
+}
+
+/* LNEs per second, 0 if the LNE source is VME, i.e. only key_lne_pulse_reg */
+double SIS3820SimBus::lneRate()
+{
+  double prescale = registers_->lne_prescale_factor_reg + 1.;
+
+  switch (registers_->op_mode_reg & SIS3820_OP_MODE_REG_LNE_MASK) {
+    case SIS3820_LNE_SOURCE_INTERNAL_10MHZ:
+      return SIS3820_10MHZ_CLOCK / prescale;
+    case SIS3820_LNE_SOURCE_CONTROL_SIGNAL:
+      return extLneRate_ / prescale;
+    default:
+      return 0.;
+  }
+}
+
+/* Writes nFrames LNEs to the FIFO.  A frame that does not fit in the FIFO is lost, and
+ * counted in lostFrames_ so the driver can report the overrun. */
+void SIS3820SimBus::writeFrames(epicsUInt32 nFrames)
+{
+  double rate = lneRate();
+  double prevTime, frameTime;
+  double countRates[SIS38XX_MAX_SIGNALS];
+  epicsUInt32 copyDisable = registers_->copy_disable_reg;
+  epicsUInt32 preset = registers_->acq_preset_reg;
+  epicsUInt32 count = registers_->acq_count_reg;
+  int nWords = 0;
+  int signal;
+  epicsUInt32 i;
+  size_t in;
+
+  if (preset && (count >= preset)) nFrames = 0;
+  else if (preset && (count + nFrames > preset)) nFrames = preset - count;
+  for (signal=0; signal<SIS38XX_MAX_SIGNALS; signal++) {
+    countRates[signal] = countRate(signal);
+    if (!(copyDisable & (1u << signal))) nWords++;
+  }
+
+  for (i=0; i<nFrames; i++) {
+    /* Frames from the LNE clock are evenly spaced, a software LNE is at the current time */
+    prevTime = frameTime_;
+    frameTime = (rate > 0.) ? (lneCount_ + 1) / rate : lneTime_;
+    frameTime_ = frameTime;
+    lneCount_++;
+    if (fifoCount_ + nWords > SIS3820_FIFO_WORD_SIZE) {
+      lostFrames_++;
+      continue;
+    }
+    for (signal=0; signal<SIS38XX_MAX_SIGNALS; signal++) {
+      if (copyDisable & (1u << signal)) continue;
+      in = (fifoHead_ + fifoCount_) % SIS3820_FIFO_WORD_SIZE;
+      fifo_[in] = (epicsUInt32)(floor(countRates[signal] * frameTime) - floor(countRates[signal] * prevTime));
+      fifoCount_++;
+    }
+  }
+  registers_->acq_count_reg = count + nFrames;
+  if (preset && (count + nFrames >= preset)) {
+    running_ = false;
+    irqFlags_ |= SIS3820_IRQ_SOURCE2_ENABLE;
+  }
+}
+
+/* Advances the model to the current time */
+void SIS3820SimBus::update()
+{
+  epicsTimeStamp now;
+  double dt, rate, due, presetTime;
+  epicsUInt32 presetEnable, presetSelect;
+  int signal;
+
+  epicsTimeGetCurrent(&now);
+  dt = epicsTimeDiffInSeconds(&now, &lastTime_);
+  lastTime_ = now;
+  if (running_) {
+    liveTime_ += dt;
+    if ((registers_->op_mode_reg & SIS3820_OP_MODE_REG_MODE_MASK) == SIS3820_OP_MODE_MULTI_CHANNEL_SCALER) {
+      lneTime_ += dt;
+      rate = lneRate();
+      due = floor(lneTime_ * rate) - lneCount_;
+      if (due > 0.) writeFrames(due < SIS3820_FIFO_WORD_SIZE ? (epicsUInt32)due : SIS3820_FIFO_WORD_SIZE);
+    } else {
+      /* Scaler mode stops when the preset counter in either group reaches its preset */
+      presetEnable = registers_->preset_enable_reg;
+      presetSelect = registers_->preset_channel_select_reg;
+      if (presetEnable & SIS3820_PRESET_STATUS_ENABLE_GROUP1) {
+        signal = presetSelect & SIS3820_FOUR_BIT_MASK;
+        presetTime = registers_->preset_group1_reg / countRate(signal);
+        if (liveTime_ >= presetTime) {
+          liveTime_ = presetTime;
+          running_ = false;
+          registers_->preset_enable_reg |= SIS3820_PRESET_REACHED_GROUP1;
+        }
+      }
+      if (running_ && (presetEnable & SIS3820_PRESET_STATUS_ENABLE_GROUP2)) {
+        signal = 16 + ((presetSelect >> 16) & SIS3820_FOUR_BIT_MASK);
+        presetTime = registers_->preset_group2_reg / countRate(signal);
+        if (liveTime_ >= presetTime) {
+          liveTime_ = presetTime;
+          running_ = false;
+          registers_->preset_enable_reg |= SIS3820_PRESET_REACHED_GROUP2;
+        }
+      }
+      if (!running_) irqFlags_ |= SIS3820_IRQ_SOURCE2_ENABLE;
+    }
+  }
+  for (signal=0; signal<SIS38XX_MAX_SIGNALS; signal++)
+    registers_->counter_regs[signal] = counterValue(countRate(signal) * liveTime_);
+  if (fifoCount_ >= SIM_FIFO_ALMOST_FULL) irqFlags_ |= SIS3820_IRQ_SOURCE4_ENABLE;
+  else irqFlags_ &= ~SIS3820_IRQ_SOURCE4_ENABLE;
+}
+
+bool SIS3820SimBus::interruptPending()
+{
+  return (isr_ != NULL) && (registers_->irq_config_reg & SIS3820_IRQ_ENABLE) &&
+         (irqFlags_ & irqEnable_);
+}
+
+epicsUInt32 SIS3820SimBus::readReg(size_t offset)
+{
+  epicsUInt32 value;
+
+  epicsMutexLock(lock_);
+  switch (offset) {
+    case SIS3820_REG(fifo_word_count_reg):
+      value = (epicsUInt32)fifoCount_;
+      break;
+    case SIS3820_REG(irq_control_status_reg):
+      value = irqEnable_ | (irqFlags_ << 24);
+      break;
+    default:
+      value = *(volatile epicsUInt32 *)((volatile char *)registers_ + offset);
+      break;
+  }
+  epicsMutexUnlock(lock_);
+  return value;
+}
+
+void SIS3820SimBus::writeReg(size_t offset, epicsUInt32 value)
+{
+  epicsMutexLock(lock_);
+  switch (offset) {
+    case SIS3820_REG(control_status_reg):
+      /* J/K register, the upper 16 bits clear the lower 16 bits */
+      registers_->control_status_reg = (registers_->control_status_reg | (value & 0xFFFF)) & ~(value >> 16);
+      break;
+    case SIS3820_REG(irq_control_status_reg):
+      irqEnable_ = (irqEnable_ | (value & 0xFF)) & ~((value >> 8) & 0xFF);
+      irqFlags_ &= ~((value >> 16) & 0xFF);
+      break;
+    case SIS3820_REG(key_reset_reg):
+      reset();
+      break;
+    case SIS3820_REG(key_fifo_reset_reg):
+      fifoHead_ = 0;
+      fifoCount_ = 0;
+      lostFrames_ = 0;
+      break;
+    case SIS3820_REG(key_counter_clear):
+      update();
+      liveTime_ = 0.;
+      update();
+      break;
+    case SIS3820_REG(key_lne_pulse_reg):
+      update();
+      if (running_ && ((registers_->op_mode_reg & SIS3820_OP_MODE_REG_MODE_MASK) ==
+                       SIS3820_OP_MODE_MULTI_CHANNEL_SCALER))
+        writeFrames(1);
+      break;
+    case SIS3820_REG(key_op_arm_reg):
+    case SIS3820_REG(key_op_enable_reg):
+      /* There is no external start signal, so arming starts acquisition */
+      startAcquire();
+      break;
+    case SIS3820_REG(key_op_disable_reg):
+      update();
+      running_ = false;
+      break;
+    default:
+      *(volatile epicsUInt32 *)((volatile char *)registers_ + offset) = value;
+      break;
+  }
+  epicsMutexUnlock(lock_);
+}
+
+void SIS3820SimBus::readFIFO(epicsUInt32 *pOut, int count)
+{
+  size_t n, first;
+
+  epicsMutexLock(lock_);
+  n = (size_t)count < fifoCount_ ? (size_t)count : fifoCount_;
+  first = SIS3820_FIFO_WORD_SIZE - fifoHead_;
+  if (first > n) first = n;
+  memcpy(pOut, &fifo_[fifoHead_], first*sizeof(epicsUInt32));
+  memcpy(pOut + first, fifo_, (n - first)*sizeof(epicsUInt32));
+  fifoHead_ = (fifoHead_ + n) % SIS3820_FIFO_WORD_SIZE;
+  fifoCount_ -= n;
+  epicsMutexUnlock(lock_);
+  /* Reading an empty FIFO returns 0 */
+  if ((size_t)count > n) memset(pOut + n, 0, (count - n)*sizeof(epicsUInt32));
+}
+
+int SIS3820SimBus::createDma(SIS3820BusFunc callback, void *pvt)
+{
+  dmaCallback_ = callback;
+  dmaPvt_ = pvt;
+  return 0;
+}
+
+int SIS3820SimBus::startDma(epicsUInt32 *pOut, int count)
+{
+  readFIFO(pOut, count);
+  if (dmaCallback_) dmaCallback_(dmaPvt_);
+  return 0;
+}
+
+int SIS3820SimBus::dmaStatus()
+{
+  return 0;
+}
+
+int SIS3820SimBus::connectInterrupt(int vector, SIS3820BusFunc isr, void *pvt)
+{
+  epicsMutexLock(lock_);
+  isr_ = isr;
+  isrPvt_ = pvt;
+  epicsMutexUnlock(lock_);
+  return 0;
+}
+
+int SIS3820SimBus::enableInterruptLevel(int level)
+{
+  return 0;
+}
+
+epicsUInt32 SIS3820SimBus::lostFrames()
+{
+  epicsUInt32 value;
+
+  epicsMutexLock(lock_);
+  value = lostFrames_;
+  epicsMutexUnlock(lock_);
+  return value;
+}
+
+/** This thread advances the model and calls the interrupt routine, without holding the lock
+  * because the interrupt routine accesses the registers. */
+void SIS3820SimBus::simThread()
+{
+  bool pending;
+
+  while (true) {
+    epicsThreadSleep(SIS3820_SIM_PERIOD);
+    epicsMutexLock(lock_);
+    update();
+    pending = interruptPending();
+    epicsMutexUnlock(lock_);
+    if (pending) isr_(isrPvt_);
+  }
+}
+
+void SIS3820SimBus::report(FILE *fp, int details)
+{
+  epicsMutexLock(lock_);
+  fprintf(fp, "  Simulated board, external LNE rate=%f Hz, running=%d, FIFO words=%d, lost frames=%u\n",
+          extLneRate_, running_, (int)fifoCount_, lostFrames_);
+  epicsMutexUnlock(lock_);
+}
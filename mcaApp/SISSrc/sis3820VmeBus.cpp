@@ -0,0 +1,144 @@
+/* sis3820VmeBus.cpp -- SIS3820 on the VME bus.
+ * The registers and the FIFO are mapped with devLib, the FIFO is read with
+ * programmed I/O or with the DMA routines in vmeDMA.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <devLib.h>
+#include <epicsTypes.h>
+#include <asynDriver.h>
+
+#include "vmeDMA.h"
+#include "sis3820.h"
+#include "sis3820Bus.h"
+
+static const char *driverName="SIS3820VmeBus";
+
+SIS3820VmeBus::SIS3820VmeBus(int baseAddress)
+  : baseAddress_(baseAddress), registers_(NULL), fifoBaseVME_(baseAddress + SIS3820_FIFO_BASE),
+    fifoBaseCPU_(NULL), dmaId_(NULL)
+{
+}
+
+int SIS3820VmeBus::connect(asynUser *pasynUser)
+{
+  int status;
+  epicsUInt32 controlStatusReg;
+  static const char* functionName="connect";
+
+  /* Call devLib to get the system address that corresponds to the VME
+   * base address of the board.
+   */
+  status = devRegisterAddress("drvSIS3820",
+                               SIS3820_ADDRESS_TYPE,
+                               (size_t)baseAddress_,
+                               SIS3820_BOARD_SIZE,
+                               (volatile void **)&registers_);
+
+  if (status) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: Can't register VME address 0x%x\n",
+              driverName, functionName, baseAddress_);
+    return -1;
+  }
+  asynPrint(pasynUser, ASYN_TRACE_FLOW,
+            "%s:%s: Registered VME address: 0x%x to local address: %p size: 0x%X\n",
+            driverName, functionName, baseAddress_, registers_, SIS3820_BOARD_SIZE);
+
+  /* Call devLib to get the system address that corresponds to the VME
+   * FIFO address of the board.
+   */
+  status = devRegisterAddress("drvSIS3820",
+                              SIS3820_ADDRESS_TYPE,
+                              (size_t)fifoBaseVME_,
+                              SIS3820_FIFO_BYTE_SIZE,
+                              (volatile void **)&fifoBaseCPU_);
+
+  if (status) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: Can't register FIFO address 0x%x\n",
+              driverName, functionName, fifoBaseVME_);
+    return -1;
+  }
+
+  asynPrint(pasynUser, ASYN_TRACE_FLOW,
+            "%s:%s: Registered VME FIFO address: 0x%x to local address: %p size: 0x%X\n",
+            driverName, functionName, fifoBaseVME_,
+            fifoBaseCPU_, SIS3820_FIFO_BYTE_SIZE);
+
+  /* Probe VME bus to see if card is there */
+  status = devReadProbe(4, (char *) &(registers_->control_status_reg),
+                       (char *) &controlStatusReg);
+  if (status) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: devReadProbe failure for address %p = %d\n",
+              driverName, functionName, &registers_->control_status_reg, status);
+    return -1;
+  }
+  return 0;
+}
+
+epicsUInt32 SIS3820VmeBus::readReg(size_t offset)
+{
+  return *(volatile epicsUInt32 *)((volatile char *)registers_ + offset);
+}
+
+void SIS3820VmeBus::writeReg(size_t offset, epicsUInt32 value)
+{
+  *(volatile epicsUInt32 *)((volatile char *)registers_ + offset) = value;
+}
+
+void SIS3820VmeBus::readFIFO(epicsUInt32 *pOut, int count)
+{
+  int i;
+
+  // Note: we were previously using memcpy here.  But that is not guaranteed to do a word transfer, which the
+  // SIS3820 requires for reading the FIFO.  In fact if the word count was 1 then a memcpy of 4 bytes was clearly
+  // not doing a word transfer on vxWorks, and was generating bus errors.
+  for (i=0; i<count; i++)
+    pOut[i] = fifoBaseCPU_[i];
+}
+
+int SIS3820VmeBus::createDma(SIS3820BusFunc callback, void *pvt)
+{
+  DMA_ID dmaId = sysDmaCreate(callback, pvt);
+
+  if (dmaId == 0 || (size_t)dmaId == (size_t)-1) return -1;
+  dmaId_ = (void *)dmaId;
+  return 0;
+}
+
+int SIS3820VmeBus::startDma(epicsUInt32 *pOut, int count)
+{
+  return sysDmaFromVme((DMA_ID)dmaId_, pOut, fifoBaseVME_, VME_AM_EXT_SUP_D64BLT, count*sizeof(epicsUInt32), 8);
+}
+
+int SIS3820VmeBus::dmaStatus()
+{
+  return sysDmaStatus((DMA_ID)dmaId_);
+}
+
+int SIS3820VmeBus::connectInterrupt(int vector, SIS3820BusFunc isr, void *pvt)
+{
+  return devConnectInterruptVME(vector, isr, pvt);
+}
+
+int SIS3820VmeBus::enableInterruptLevel(int level)
+{
+  return devEnableInterruptLevel(intVME, level);
+}
+
+epicsUInt32 SIS3820VmeBus::lostFrames()
+{
+  return 0;
+}
+
+void SIS3820VmeBus::report(FILE *fp, int details)
+{
+  fprintf(fp, "  VME base address 0x%x, registers at %p, FIFO at %p\n",
+          baseAddress_, registers_, fifoBaseCPU_);
+}
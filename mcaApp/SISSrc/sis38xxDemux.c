@@ -0,0 +1,65 @@
+/* sis38xxDemux.c -- De-interleaves SIS38XX MCS FIFO data.
+ *
+ * Copying one word at a time writes each word of a frame to a different
+ * signal block, maxChans words apart, so every write touches a different
+ * cache line.  Here the whole frames are copied as a transpose of tiles of
+ * DEMUX_TILE channels: the input tile is DEMUX_TILE*numSignals contiguous
+ * words, 8 kB for 32 signals, and each signal's part of the output is
+ * DEMUX_TILE contiguous words.  The inner loop is a strided load and a
+ * contiguous store, which the compiler can vectorize where the CPU supports it.
+ */
+
+#include <epicsTypes.h>
+
+#include "sis38xxDemux.h"
+
+#define DEMUX_TILE 64
+
+void sis38xxDemux(const epicsUInt32 *pIn, int count, int numSignals, int maxChans,
+                  epicsUInt32 *data, int *signal, int *chan)
+{
+    int sig = *signal;
+    int ch = *chan;
+    int s, c, n, nframes;
+    const epicsUInt32 *pFrame;
+    epicsUInt32 *pOut;
+
+    /* The rest of a partial first frame */
+    while ((count > 0) && (sig != 0) && (ch < maxChans)) {
+        data[sig*maxChans + ch] = *pIn++;
+        count--;
+        if (++sig == numSignals) {
+            sig = 0;
+            ch++;
+        }
+    }
+
+    /* Whole frames, a tile of channels at a time */
+    nframes = count / numSignals;
+    if (nframes > maxChans - ch) nframes = maxChans - ch;
+    while (nframes > 0) {
+        n = (nframes < DEMUX_TILE) ? nframes : DEMUX_TILE;
+        for (s=0; s<numSignals; s++) {
+            pOut = &data[s*maxChans + ch];
+            pFrame = &pIn[s];
+            for (c=0; c<n; c++)
+                pOut[c] = pFrame[c*numSignals];
+        }
+        pIn += n*numSignals;
+        count -= n*numSignals;
+        ch += n;
+        nframes -= n;
+    }
+
+    /* A partial last frame */
+    while ((count > 0) && (ch < maxChans)) {
+        data[sig*maxChans + ch] = *pIn++;
+        count--;
+        if (++sig == numSignals) {
+            sig = 0;
+            ch++;
+        }
+    }
+    *signal = sig;
+    *chan = ch;
+}
@@ -0,0 +1,30 @@
+/* sis38xxDemux.h --
+ * De-interleaving of SIS38XX MCS FIFO data.
+ * The FIFO holds one frame per channel: the counts of all the enabled signals
+ * for that channel, in signal order.  The driver stores the data signal-major,
+ * numSignals blocks of maxChans words, so that each signal's spectrum is
+ * contiguous.  This routine does not depend on the driver, so it can also be
+ * used by the sis38xxDemuxBenchmark program.
+ */
+
+#ifndef sis38xxDemuxH
+#define sis38xxDemuxH
+
+#include <epicsTypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Copies count FIFO words from pIn to data, which holds numSignals blocks of
+ * maxChans words.  The first word is for signal *signal of channel *chan, so
+ * the first and last frames may be partial.  On return *signal and *chan are
+ * the position of the next word.  Words past channel maxChans-1 are dropped. */
+void sis38xxDemux(const epicsUInt32 *pIn, int count, int numSignals, int maxChans,
+                  epicsUInt32 *data, int *signal, int *chan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* sis38xxDemuxH */
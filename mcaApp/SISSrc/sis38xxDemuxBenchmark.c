@@ -0,0 +1,120 @@
+/* sis38xxDemuxBenchmark.c -- Compares the tiled FIFO de-interleave in
+ * sis38xxDemux.c with the word at a time loop previously used by the SIS38XX
+ * drivers.
+ *
+ * Usage: sis38xxDemuxBenchmark [numSignals [numChans [numLoops]]]
+ *
+ * With no arguments it runs 8 and 32 signals with 8192 and 65536 channels.
+ * The FIFO data are copied in reads of an odd number of words, so most reads
+ * start and end with a partial frame.  Both methods are checked to agree
+ * before the throughput is reported.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "sis38xxDemux.h"
+
+#define DEFAULT_LOOPS 20
+/* Words in each simulated FIFO read */
+#define READ_WORDS    4093
+
+/* The old loop */
+static void legacyDemux(const epicsUInt32 *pIn, int count, int numSignals, int maxChans,
+                        epicsUInt32 *data, int *signal, int *chan)
+{
+    int i;
+    epicsUInt32 *pOut = data + *signal*maxChans + *chan;
+
+    for (i=0; i<count; i++) {
+        *pOut = *pIn++;
+        (*signal)++;
+        if (*signal == numSignals) {
+            *signal = 0;
+            (*chan)++;
+            pOut = data + *chan;
+        } else {
+            pOut += maxChans;
+        }
+    }
+}
+
+typedef void (*demuxFunc)(const epicsUInt32 *pIn, int count, int numSignals, int maxChans,
+                          epicsUInt32 *data, int *signal, int *chan);
+
+/* Copies the whole FIFO stream in reads of READ_WORDS words */
+static void demuxAll(demuxFunc func, const epicsUInt32 *fifo, int nwords,
+                     int numSignals, int maxChans, epicsUInt32 *data)
+{
+    int i, n, signal=0, chan=0;
+
+    for (i=0; i<nwords; i+=READ_WORDS) {
+        n = (nwords - i < READ_WORDS) ? nwords - i : READ_WORDS;
+        func(&fifo[i], n, numSignals, maxChans, data, &signal, &chan);
+    }
+}
+
+static double elapsed(epicsTimeStamp *start)
+{
+    epicsTimeStamp now;
+
+    epicsTimeGetCurrent(&now);
+    return(epicsTimeDiffInSeconds(&now, start));
+}
+
+static int runBenchmark(int numSignals, int numChans, int nloops)
+{
+    int i, errors=0;
+    int nwords = numSignals*numChans;
+    epicsUInt32 *fifo = (epicsUInt32 *)calloc(nwords, sizeof(epicsUInt32));
+    epicsUInt32 *data1 = (epicsUInt32 *)calloc(nwords, sizeof(epicsUInt32));
+    epicsUInt32 *data2 = (epicsUInt32 *)calloc(nwords, sizeof(epicsUInt32));
+    epicsTimeStamp start;
+    double tLegacy, tTiled, mbytes;
+
+    for (i=0; i<nwords; i++) fifo[i] = i;
+    demuxAll(legacyDemux, fifo, nwords, numSignals, numChans, data1);
+    demuxAll(sis38xxDemux, fifo, nwords, numSignals, numChans, data2);
+    if (memcmp(data1, data2, nwords*sizeof(epicsUInt32)) != 0) errors++;
+
+    epicsTimeGetCurrent(&start);
+    for (i=0; i<nloops; i++)
+        demuxAll(legacyDemux, fifo, nwords, numSignals, numChans, data1);
+    tLegacy = elapsed(&start);
+    epicsTimeGetCurrent(&start);
+    for (i=0; i<nloops; i++)
+        demuxAll(sis38xxDemux, fifo, nwords, numSignals, numChans, data2);
+    tTiled = elapsed(&start);
+
+    mbytes = (double)nloops * nwords * sizeof(epicsUInt32) / 1.e6;
+    printf("%2d signals %6d channels: legacy %8.1f MB/s, tiled %8.1f MB/s, speedup %5.1f, %s\n",
+           numSignals, numChans,
+           tLegacy > 0. ? mbytes/tLegacy : 0., tTiled > 0. ? mbytes/tTiled : 0.,
+           tTiled > 0. ? tLegacy/tTiled : 0., errors ? "MISMATCH" : "OK");
+
+    free(fifo); free(data1); free(data2);
+    return(errors);
+}
+
+int main(int argc, char *argv[])
+{
+    int nloops = DEFAULT_LOOPS;
+    int errors = 0;
+
+    if (argc > 3) nloops = atoi(argv[3]);
+    if (argc > 2) {
+        errors += runBenchmark(atoi(argv[1]), atoi(argv[2]), nloops);
+    } else if (argc > 1) {
+        errors += runBenchmark(atoi(argv[1]), 65536, nloops);
+    } else {
+        errors += runBenchmark(8, 8192, nloops);
+        errors += runBenchmark(8, 65536, nloops);
+        errors += runBenchmark(32, 8192, nloops);
+        errors += runBenchmark(32, 65536, nloops);
+    }
+    return(errors ? 1 : 0);
+}
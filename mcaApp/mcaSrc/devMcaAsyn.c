@@ -7,6 +7,34 @@
   
     Modifications:
       16-May-2004  MLR  Created from previous devMcaMpf.cc
+      17-Oct-2026       Added I/O Intr scanning.  When SCAN="I/O Intr" the
+                        record processes when the driver does callbacks on
+                        MCA_DATA, MCA_ACQUIRING, MCA_ELAPSED_* or MCA_DWELL_TIME,
+                        and status and data pushed by the driver are used
+                        without queuing a request to the driver.
+      17-Oct-2026       For FTVL=LONG or ULONG the data buffer is the back
+                        buffer of a double buffer.  read_array swaps it with
+                        the record's bptr rather than copying it.
+      17-Oct-2026       Commands from one pass of the record are sent to the
+                        driver in one queued request, using asynUsers and
+                        messages from a per-record pool.
+      17-Oct-2026       Group reads.  When a record reads data, the other
+                        records on the same port with SCAN="I/O Intr" are
+                        read in the same request and then processed.  If the
+                        driver supports MCA_DATA_ALL all of the spectra are
+                        read in one call.
+      18-Oct-2026       The driver calls back once for each parameter which
+                        changed, so an I/O Intr record is now scanned once
+                        for all of the callbacks which arrive before it
+                        processes, rather than once per callback.
+      18-Oct-2026       Group reads include all of the records on the port.
+                        A status read also reads the status of the other
+                        records.  The status and data read for a record which
+                        did not ask for them are kept, and used by that
+                        record instead of queuing its own request if it
+                        processes within devMcaAsynCacheAge seconds, for
+                        example when the ReadAll and StatusAll dfanouts in
+                        13element.db and 16element.db process the records.
 */
 
 
@@ -22,6 +50,12 @@
 #include <errlog.h>
 #include <dbCommon.h>
 #include <dbScan.h>
+#include <menuScan.h>
+#include <epicsMutex.h>
+#include <ellLib.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsString.h>
 #include <cantProceed.h>
 #include <recSup.h>
 #include <devSup.h>
@@ -37,6 +71,7 @@
 
 #include "mcaRecord.h"
 #include "mca.h"
+#include "mcaTiming.h"
 #include "drvMca.h"
 
 typedef enum {int32Type, float64Type, int32ArrayType} interfaceType;
@@ -48,7 +83,51 @@ typedef struct {
     double dvalue;
 } mcaAsynMessage;
 
+/* A queued request.  The messages are executed in order in one callback, so
+ * the port is locked once for all of the commands sent by the record in one
+ * process() pass.  A read command (mcaData or mcaReadStatus) is always the
+ * last message.  Batches are kept in a per-record pool and reused. */
+#define MAX_BATCH_MESSAGES 32
 typedef struct {
+    ELLNODE node;
+    asynUser *pasynUser;
+    int nmsg;
+    mcaAsynMessage msg[MAX_BATCH_MESSAGES];
+} mcaAsynBatch;
+
+/* The driver callbacks used for I/O Intr scanning */
+#define NUM_INTERRUPTS 6
+static const struct {
+    mcaCommand command;
+    interfaceType interface;
+} mcaInterrupts[NUM_INTERRUPTS] = {
+    {mcaData,            int32ArrayType},
+    {mcaAcquiring,       int32Type},
+    {mcaElapsedLiveTime, float64Type},
+    {mcaElapsedRealTime, float64Type},
+    {mcaElapsedCounts,   float64Type},
+    {mcaDwellTime,       float64Type}
+};
+
+/* The records on one asyn port */
+typedef struct {
+    ELLNODE node;
+    char *portName;
+    ELLLIST members;
+    /* Set when the driver has been asked about MCA_DATA_ALL */
+    int probed;
+    /* The MCA_DATA_ALL reason, or -1 if the driver does not support it */
+    int dataAllReason;
+    int numSignals;
+    int stride;
+    epicsInt32 *buffer;
+} mcaAsynGroup;
+
+typedef struct {
+    ELLNODE groupNode;  /* Must be first */
+    mcaAsynGroup *pgroup;
+    int addr;
+    int ioIntr;
     mcaRecord *pmca;
     asynUser *pasynUser;
     asynInt32 *pasynInt32;
@@ -60,7 +139,10 @@ typedef struct {
     asynDrvUser *pasynDrvUser;
     void *asynDrvUserPvt;
     size_t nread;
+    /* The buffer the driver reads into.  If swapBuffers is set it is swapped
+     * with pmca->bptr in read_array, otherwise it is copied */
     int *data;
+    int swapBuffers;
     double elapsedLive;
     double elapsedReal;
     double dwellTime;
@@ -68,13 +150,53 @@ typedef struct {
     int acquiring;
     /* These are the pasynUser->reason values returned by the driver for each drvInfo string */
     int driverReasons[MAX_MCA_COMMANDS];
+    /* I/O Intr support.  lock protects data, nread and the status values,
+     * which are written by driver callbacks */
+    epicsMutexId lock;
+    IOSCANPVT ioScanPvt;
+    asynUser *interruptUser[NUM_INTERRUPTS];
+    void *interruptPvt[NUM_INTERRUPTS];
+    int haveStatus;
+    int newData;
+    /* Set when a scan has been requested and the record has not yet read the
+     * status, so the callbacks from one callParamCallbacks scan it once */
+    int scanPending;
+    /* Set when a group read for another record has read the status for this
+     * one, at statusTime.  newData is set when it has read the data, at
+     * dataTime */
+    int cacheStatus;
+    epicsTimeStamp statusTime;
+    epicsTimeStamp dataTime;
+    /* Messages waiting to be queued, and the pool of free batches, which is
+     * also protected by lock */
+    mcaAsynBatch *pending;
+    ELLLIST freeBatches;
 } mcaAsynPvt;
 
 static long init_record(mcaRecord *pmca);
+static long getIoIntInfo(int cmd, dbCommon *precord, IOSCANPVT *iopvt);
 static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg);
 static long read_array(mcaRecord *pmca);
+static long flush_msg(mcaRecord *pmca);
+static mcaAsynBatch *getBatch(mcaAsynPvt *pPvt);
+static void freeBatch(mcaAsynPvt *pPvt, mcaAsynBatch *pbatch);
 static void asynCallback(asynUser *pasynUser);
+static mcaAsynGroup *findGroup(const char *portName);
+static void groupOnce(void *arg);
+static void probeGroup(mcaAsynPvt *pPvt, asynUser *pasynUser);
+static void readStatus(mcaAsynPvt *pPvt, asynUser *pasynUser);
+static int cacheFresh(int cached, const epicsTimeStamp *ptime);
+static void readGroupStatus(mcaAsynPvt *pPvt, asynUser *pasynUser);
+static void cacheGroupStatus(mcaAsynPvt *pPvt);
+static int readGroupData(mcaAsynPvt *pPvt, asynUser *pasynUser);
+static void scanGroup(mcaAsynPvt *pPvt);
+static void requestScan(mcaAsynPvt *pPvt);
+static void scanComplete(void *usr, IOSCANPVT ioScanPvt, int prio);
 static long findDrvInfo(mcaRecord *pmca, asynUser *pasynUser, char *drvInfoString, int command);
+static void int32Callback(void *userPvt, asynUser *pasynUser, epicsInt32 value);
+static void float64Callback(void *userPvt, asynUser *pasynUser, epicsFloat64 value);
+static void int32ArrayCallback(void *userPvt, asynUser *pasynUser,
+                                        epicsInt32 *value, size_t nelements);
 
 typedef struct {
     long            number;
@@ -84,19 +206,30 @@ typedef struct {
     DEVSUPFUN       get_ioint_info;
     long            (*send_msg)(mcaRecord *pmca, mcaCommand command, void *parg);
     long            (*read_array)(mcaRecord *pmca);
+    long            (*flush_msg)(mcaRecord *pmca);
 } mcaAsynDset;
 
 mcaAsynDset devMcaAsyn = {
-    6,
+    7,
     NULL,
     NULL,
     init_record,
-    NULL,
+    getIoIntInfo,
     send_msg,
-    read_array
+    read_array,
+    flush_msg
 };
 epicsExportAddress(dset, devMcaAsyn);
 
+static ELLLIST groupList;
+static epicsMutexId groupListLock;
+static epicsThreadOnceId groupOnceId = EPICS_THREAD_ONCE_INIT;
+
+/* How long the status and data read for a record by a group read can be used
+ * by that record instead of reading them itself, in seconds */
+double devMcaAsynCacheAge = 0.1;
+epicsExportAddress(double, devMcaAsynCacheAge);
+
 
 static long init_record(mcaRecord *pmca)
 {
@@ -111,11 +244,18 @@ static long init_record(mcaRecord *pmca)
     pPvt = callocMustSucceed(1, sizeof(mcaAsynPvt), "devMcaAsyn init_record()");
     pPvt->data = callocMustSucceed(pmca->nmax, sizeof(epicsInt32), 
                                    "devMcaAsyn init_record()");
+    /* The record allocates bptr with nmax elements of FTVL, so it can be
+     * exchanged with data if FTVL is a 32-bit integer */
+    pPvt->swapBuffers = ((pmca->ftvl == DBF_LONG) || (pmca->ftvl == DBF_ULONG));
     /* Create asynUser */
     pasynUser = pasynManager->createAsynUser(asynCallback, 0);
     pasynUser->userPvt = pPvt;
     pPvt->pasynUser = pasynUser;
     pPvt->pmca = pmca;
+    pPvt->lock = epicsMutexMustCreate();
+    scanIoInit(&pPvt->ioScanPvt);
+    scanIoSetComplete(pPvt->ioScanPvt, scanComplete, pPvt);
+    ellInit(&pPvt->freeBatches);
     pmca->dpvt = pPvt;
 
     status = pasynEpicsUtils->parseLink(pasynUser, &pmca->inp,
@@ -203,6 +343,11 @@ static long init_record(mcaRecord *pmca)
     if (findDrvInfo(pmca, pasynUser, mcaElapsedRealTimeString,         mcaElapsedRealTime)) goto bad;
     if (findDrvInfo(pmca, pasynUser, mcaElapsedCountsString,           mcaElapsedCounts)) goto bad;
 
+    /* Join the group for this port */
+    pPvt->addr = signal;
+    pPvt->pgroup = findGroup(port);
+    ellAdd(&pPvt->pgroup->members, &pPvt->groupNode);
+
 
     return(0);
 bad:
@@ -225,6 +370,149 @@ static long findDrvInfo(mcaRecord *pmca, asynUser *pasynUser, char *drvInfoStrin
     return(0);
 }
 
+static long getIoIntInfo(int cmd, dbCommon *precord, IOSCANPVT *iopvt)
+{
+    mcaRecord *pmca = (mcaRecord *)precord;
+    mcaAsynPvt *pPvt = (mcaAsynPvt *)pmca->dpvt;
+    asynUser *pasynUser;
+    asynStatus status=asynSuccess;
+    int i;
+
+    if (!pPvt || !pPvt->pasynDrvUser) return(-1);
+
+    /* cmd=0 is when the record is put in an I/O Intr scan list, cmd=1 is when
+     * it is taken out */
+    pPvt->ioIntr = (cmd == 0);
+    for (i=0; i<NUM_INTERRUPTS; i++) {
+        if (cmd == 0) {
+            pasynUser = pasynManager->duplicateAsynUser(pPvt->pasynUser, NULL, NULL);
+            pasynUser->reason = pPvt->driverReasons[mcaInterrupts[i].command];
+            pPvt->interruptUser[i] = pasynUser;
+            switch (mcaInterrupts[i].interface) {
+            case int32Type:
+                status = pPvt->pasynInt32->registerInterruptUser(
+                    pPvt->asynInt32Pvt, pasynUser, int32Callback, pPvt,
+                    &pPvt->interruptPvt[i]);
+                break;
+            case float64Type:
+                status = pPvt->pasynFloat64->registerInterruptUser(
+                    pPvt->asynFloat64Pvt, pasynUser, float64Callback, pPvt,
+                    &pPvt->interruptPvt[i]);
+                break;
+            case int32ArrayType:
+                status = pPvt->pasynInt32Array->registerInterruptUser(
+                    pPvt->asynInt32ArrayPvt, pasynUser, int32ArrayCallback, pPvt,
+                    &pPvt->interruptPvt[i]);
+                break;
+            }
+        } else {
+            pasynUser = pPvt->interruptUser[i];
+            if (!pasynUser) continue;
+            switch (mcaInterrupts[i].interface) {
+            case int32Type:
+                status = pPvt->pasynInt32->cancelInterruptUser(
+                    pPvt->asynInt32Pvt, pasynUser, pPvt->interruptPvt[i]);
+                break;
+            case float64Type:
+                status = pPvt->pasynFloat64->cancelInterruptUser(
+                    pPvt->asynFloat64Pvt, pasynUser, pPvt->interruptPvt[i]);
+                break;
+            case int32ArrayType:
+                status = pPvt->pasynInt32Array->cancelInterruptUser(
+                    pPvt->asynInt32ArrayPvt, pasynUser, pPvt->interruptPvt[i]);
+                break;
+            }
+            pasynManager->freeAsynUser(pasynUser);
+            pPvt->interruptUser[i] = NULL;
+        }
+        if (status != asynSuccess) {
+            asynPrint(pPvt->pasynUser, ASYN_TRACE_ERROR,
+                      "devMcaAsyn::getIoIntInfo, %s %s interrupt user failed for command %d, %s\n",
+                      pmca->name, cmd ? "cancel" : "register", mcaInterrupts[i].command,
+                      pasynUser->errorMessage);
+        }
+    }
+    *iopvt = pPvt->ioScanPvt;
+    return(0);
+}
+
+static void int32Callback(void *userPvt, asynUser *pasynUser, epicsInt32 value)
+{
+    mcaAsynPvt *pPvt = (mcaAsynPvt *)userPvt;
+
+    asynPrint(pPvt->pasynUser, ASYN_TRACEIO_DEVICE,
+              "devMcaAsyn::int32Callback, %s reason=%d, value=%d\n",
+              pPvt->pmca->name, pasynUser->reason, value);
+    epicsMutexLock(pPvt->lock);
+    if (pasynUser->reason == pPvt->driverReasons[mcaAcquiring]) {
+        pPvt->acquiring = value;
+        pPvt->haveStatus = 1;
+    }
+    requestScan(pPvt);
+    epicsMutexUnlock(pPvt->lock);
+}
+
+static void float64Callback(void *userPvt, asynUser *pasynUser, epicsFloat64 value)
+{
+    mcaAsynPvt *pPvt = (mcaAsynPvt *)userPvt;
+    int reason = pasynUser->reason;
+
+    asynPrint(pPvt->pasynUser, ASYN_TRACEIO_DEVICE,
+              "devMcaAsyn::float64Callback, %s reason=%d, value=%f\n",
+              pPvt->pmca->name, reason, value);
+    epicsMutexLock(pPvt->lock);
+    if      (reason == pPvt->driverReasons[mcaElapsedLiveTime]) pPvt->elapsedLive = value;
+    else if (reason == pPvt->driverReasons[mcaElapsedRealTime]) pPvt->elapsedReal = value;
+    else if (reason == pPvt->driverReasons[mcaElapsedCounts])   pPvt->totalCounts = value;
+    else if (reason == pPvt->driverReasons[mcaDwellTime])       pPvt->dwellTime   = value;
+    requestScan(pPvt);
+    epicsMutexUnlock(pPvt->lock);
+}
+
+static void int32ArrayCallback(void *userPvt, asynUser *pasynUser,
+                                        epicsInt32 *value, size_t nelements)
+{
+    mcaAsynPvt *pPvt = (mcaAsynPvt *)userPvt;
+    mcaRecord *pmca = pPvt->pmca;
+
+    asynPrint(pPvt->pasynUser, ASYN_TRACEIO_DEVICE,
+              "devMcaAsyn::int32ArrayCallback, %s nelements=%d\n",
+              pmca->name, (int)nelements);
+    if (pasynUser->reason != pPvt->driverReasons[mcaData]) return;
+    /* The record is not locked here, so NUSE could be changing.  Keep up to
+     * NMAX, the size of the buffer, and read_array trims it to NUSE */
+    if (nelements > (size_t)pmca->nmax) nelements = pmca->nmax;
+    epicsMutexLock(pPvt->lock);
+    memcpy(pPvt->data, value, nelements*sizeof(epicsInt32));
+    pPvt->nread = nelements;
+    pPvt->newData = 1;
+    requestScan(pPvt);
+    epicsMutexUnlock(pPvt->lock);
+}
+
+/* Asks for the record to be scanned, unless a scan is already pending.  Called
+ * with pPvt->lock held */
+static void requestScan(mcaAsynPvt *pPvt)
+{
+    if (pPvt->scanPending) return;
+    pPvt->scanPending = 1;
+    /* Nothing is queued if the record is not in the scan list, and then
+     * scanComplete will not be called */
+    if (!scanIoRequest(pPvt->ioScanPvt)) pPvt->scanPending = 0;
+}
+
+/* Called after the I/O Intr scan has processed the record.  send_msg has
+ * normally cleared scanPending already, this covers a record which did not
+ * read the status, for example because it is disabled */
+static void scanComplete(void *usr, IOSCANPVT ioScanPvt, int prio)
+{
+    mcaAsynPvt *pPvt = (mcaAsynPvt *)usr;
+
+    epicsMutexLock(pPvt->lock);
+    pPvt->scanPending = 0;
+    epicsMutexUnlock(pPvt->lock);
+}
+
 
 static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg)
 {
@@ -232,12 +520,19 @@ static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg)
     asynUser *pasynUser = pPvt->pasynUser;
     mcaAsynMessage *pmsg;
     mcaStatus *pstatus = pmca->pstatus;
-    int status;
 
     asynPrint(pasynUser, ASYN_TRACE_FLOW, 
               "devMcaAsyn::send_msg: %s command=%d, pact=%d, rdns=%d, rdng=%d\n", 
               pmca->name, command, pmca->pact, pmca->rdns, pmca->rdng);
 
+    /* The record is reading the status, so callbacks from now on need another
+     * scan to be seen */
+    if (command == mcaReadStatus) {
+        epicsMutexLock(pPvt->lock);
+        pPvt->scanPending = 0;
+        epicsMutexUnlock(pPvt->lock);
+    }
+
     /* If we are already in COMM_ALARM then this server is not reachable, 
      * return */
     if ((pmca->nsta == COMM_ALARM) || (pmca->stat == COMM_ALARM)) return(-1);
@@ -246,12 +541,15 @@ static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg)
      * call from the record to complete */
     if (pmca->rdns && (command == mcaReadStatus)) {
         /* This is a second call from record after I/O is complete. 
-         * Copy information from private to record */
+         * Copy information from private to record.  A group read for another
+         * record can write these, so take the lock */
+        epicsMutexLock(pPvt->lock);
         pstatus->elapsedReal = pPvt->elapsedReal;
         pstatus->elapsedLive = pPvt->elapsedLive;
         pstatus->dwellTime   = pPvt->dwellTime;
         pstatus->totalCounts = pPvt->totalCounts;
         pstatus->acquiring   = pPvt->acquiring;
+        epicsMutexUnlock(pPvt->lock);
         asynPrint(pasynUser, ASYN_TRACE_FLOW, 
                   "devMcaAsyn::send_msg, record=%s, elapsed real=%f,"
                   " elapsed live=%f, dwell time=%f, acqg=%d\n", 
@@ -259,12 +557,64 @@ static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg)
         return(0);
     }
 
-    /* Make a copy of asynUser.  This is needed because we can have multiple
-     * requests queued.  It will be freed in the callback */
-    pasynUser = pasynManager->duplicateAsynUser(pasynUser, asynCallback, 0);
-    pmsg = pasynManager->memMalloc(sizeof *pmsg);
+    /* With I/O Intr scanning the driver has already pushed the status and
+     * perhaps the data, so there is no need to queue a request to read them.
+     * Until the first status is available fall through to the normal read. */
+    if (pmca->scan == menuScanI_O_Intr) {
+        if ((command == mcaReadStatus) && pPvt->haveStatus) {
+            if (flush_msg(pmca)) return(-1);
+            epicsMutexLock(pPvt->lock);
+            pstatus->elapsedReal = pPvt->elapsedReal;
+            pstatus->elapsedLive = pPvt->elapsedLive;
+            pstatus->dwellTime   = pPvt->dwellTime;
+            pstatus->totalCounts = pPvt->totalCounts;
+            pstatus->acquiring   = pPvt->acquiring;
+            /* Tell the record to read new data which the driver has pushed */
+            if (pPvt->newData) pmca->read = 1;
+            epicsMutexUnlock(pPvt->lock);
+            return(0);
+        }
+        /* read_array will copy the pushed data */
+        if ((command == mcaData) && pPvt->newData) return(flush_msg(pmca));
+    }
+
+    /* A group read for another record may have just read the status or data
+     * for this one.  They are only used if this pass has not sent any other
+     * commands, which could change them */
+    if (!pPvt->pending && ((command == mcaReadStatus) || (command == mcaData))) {
+        int fresh;
+        epicsMutexLock(pPvt->lock);
+        if (command == mcaReadStatus) {
+            fresh = cacheFresh(pPvt->cacheStatus, &pPvt->statusTime);
+            if (fresh) {
+                pstatus->elapsedReal = pPvt->elapsedReal;
+                pstatus->elapsedLive = pPvt->elapsedLive;
+                pstatus->dwellTime   = pPvt->dwellTime;
+                pstatus->totalCounts = pPvt->totalCounts;
+                pstatus->acquiring   = pPvt->acquiring;
+                pPvt->cacheStatus = 0;
+            }
+        } else {
+            /* read_array will copy the data */
+            fresh = cacheFresh(pPvt->newData, &pPvt->dataTime);
+        }
+        epicsMutexUnlock(pPvt->lock);
+        if (fresh) {
+            asynPrint(pasynUser, ASYN_TRACE_FLOW,
+                      "devMcaAsyn::send_msg, record=%s, command=%d from group read\n",
+                      pmca->name, command);
+            return(0);
+        }
+    }
+
+    /* Add the command to the pending batch */
+    if (pPvt->pending && (pPvt->pending->nmsg == MAX_BATCH_MESSAGES)) {
+        if (flush_msg(pmca)) return(-1);
+    }
+    if (!pPvt->pending) pPvt->pending = getBatch(pPvt);
+    pmsg = &pPvt->pending->msg[pPvt->pending->nmsg++];
     pmsg->command = command;
-    if (parg) { 
+    if (parg) {
         pmsg->ivalue= *(int *)parg;
         pmsg->dvalue= *(double*)parg;
     } else {
@@ -272,7 +622,6 @@ static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg)
         pmsg->dvalue = 0.;
     }
     pmsg->interface = int32Type;
-    pasynUser->userData = pmsg;
 
     switch (command) {
     case mcaStartAcquire:
@@ -286,6 +635,7 @@ static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg)
         /* Set the flag which tells the record that the read is not complete */
         pmca->rdng = 1;
         pmca->pact = 1;
+        MCA_TIMING_START(pmca->ptim, mcaTimeQueue);
         break;
     case mcaReadStatus:
         /* Read the current status of the device */
@@ -324,15 +674,59 @@ static long send_msg(mcaRecord *pmca, mcaCommand command, void *parg)
         break;
     default:
         asynPrint(pasynUser, ASYN_TRACE_ERROR,
-                  "devMcaAsyn::send_msg, %s invalid command=%d\n", 
+                  "devMcaAsyn::send_msg, %s invalid command=%d\n",
                   pmca->name, command);
     }
+    /* The record waits for a callback after a read, so queue the batch now.
+     * Other commands are queued when the record calls flush_msg */
+    if ((command == mcaData) || (command == mcaReadStatus)) return(flush_msg(pmca));
+    return(0);
+}
+
+static mcaAsynBatch *getBatch(mcaAsynPvt *pPvt)
+{
+    mcaAsynBatch *pbatch;
+
+    epicsMutexLock(pPvt->lock);
+    pbatch = (mcaAsynBatch *)ellGet(&pPvt->freeBatches);
+    epicsMutexUnlock(pPvt->lock);
+    if (!pbatch) {
+        pbatch = callocMustSucceed(1, sizeof(*pbatch), "devMcaAsyn getBatch()");
+        /* Each batch has its own copy of the asynUser, because we can have
+         * multiple requests queued */
+        pbatch->pasynUser = pasynManager->duplicateAsynUser(pPvt->pasynUser, asynCallback, 0);
+        pbatch->pasynUser->userData = pbatch;
+    }
+    pbatch->nmsg = 0;
+    return(pbatch);
+}
+
+static void freeBatch(mcaAsynPvt *pPvt, mcaAsynBatch *pbatch)
+{
+    epicsMutexLock(pPvt->lock);
+    ellAdd(&pPvt->freeBatches, &pbatch->node);
+    epicsMutexUnlock(pPvt->lock);
+}
+
+static long flush_msg(mcaRecord *pmca)
+{
+    mcaAsynPvt *pPvt = (mcaAsynPvt *)pmca->dpvt;
+    mcaAsynBatch *pbatch;
+    int status;
+
+    if (!pPvt || !pPvt->pending) return(0);
+    pbatch = pPvt->pending;
+    pPvt->pending = NULL;
+    asynPrint(pbatch->pasynUser, ASYN_TRACE_FLOW,
+              "devMcaAsyn::flush_msg: %s queuing %d commands\n",
+              pmca->name, pbatch->nmsg);
     /* Queue asyn request, so we get a callback when driver is ready */
-    status = pasynManager->queueRequest(pasynUser, 0, 0);
+    status = pasynManager->queueRequest(pbatch->pasynUser, 0, 0);
     if (status != asynSuccess) {
-        asynPrint(pasynUser, ASYN_TRACE_ERROR, 
-                  "devMcaAsyn::send_msg: %s error calling queueRequest, %s\n", 
-                  pmca->name, pasynUser->errorMessage);
+        asynPrint(pbatch->pasynUser, ASYN_TRACE_ERROR,
+                  "devMcaAsyn::flush_msg: %s error calling queueRequest, %s\n",
+                  pmca->name, pbatch->pasynUser->errorMessage);
+        freeBatch(pPvt, pbatch);
         return(-1);
     }
     return(0);
@@ -343,72 +737,306 @@ static void asynCallback(asynUser *pasynUser)
 {
     mcaAsynPvt *pPvt = (mcaAsynPvt *)pasynUser->userPvt;
     mcaRecord *pmca = pPvt->pmca;
-    mcaAsynMessage *pmsg = pasynUser->userData;
+    mcaAsynBatch *pbatch = pasynUser->userData;
+    mcaAsynMessage *pmsg;
     rset *prset = (rset *)pmca->rset;
-    int status;
+    int i, nothers, fresh;
 
-    asynPrint(pasynUser, ASYN_TRACE_FLOW, 
-              "devMcaAsyn::asynCallback: %s command=%d, ivalue=%d, dvalue=%f\n",
-              pmca->name, pmsg->command, pmsg->ivalue, pmsg->dvalue);
-    pasynUser->reason = pPvt->driverReasons[pmsg->command];
+    for (i=0; i<pbatch->nmsg; i++) {
+        pmsg = &pbatch->msg[i];
+        asynPrint(pasynUser, ASYN_TRACE_FLOW,
+                  "devMcaAsyn::asynCallback: %s command=%d, ivalue=%d, dvalue=%f\n",
+                  pmca->name, pmsg->command, pmsg->ivalue, pmsg->dvalue);
+        pasynUser->reason = pPvt->driverReasons[pmsg->command];
+
+        if (pmsg->command == mcaData) {
+            /* Read data, for this record and others in the group.  The
+             * timing state belongs to the record, so it is only changed with
+             * the record locked, but the driver is called unlocked */
+            dbScanLock((dbCommon *)pmca);
+            MCA_TIMING_STOP(pmca->ptim, mcaTimeQueue);
+            MCA_TIMING_START(pmca->ptim, mcaTimeDriver);
+            dbScanUnlock((dbCommon *)pmca);
+            /* If a group read for another record read the data while this
+             * request was queued they do not need to be read again */
+            epicsMutexLock(pPvt->lock);
+            fresh = cacheFresh(pPvt->newData, &pPvt->dataTime);
+            epicsMutexUnlock(pPvt->lock);
+            nothers = fresh ? 0 : readGroupData(pPvt, pasynUser);
+            dbScanLock((dbCommon *)pmca);
+            MCA_TIMING_STOP(pmca->ptim, mcaTimeDriver);
+            (*prset->process)(pmca);
+            dbScanUnlock((dbCommon *)pmca);
+            if (nothers) scanGroup(pPvt);
+
+        } else if (pmsg->command == mcaReadStatus) {
+            /* Read the current status of the device, unless a group read
+             * for another record read it while this request was queued */
+            epicsMutexLock(pPvt->lock);
+            fresh = cacheFresh(pPvt->cacheStatus, &pPvt->statusTime);
+            pPvt->cacheStatus = 0;
+            epicsMutexUnlock(pPvt->lock);
+            if (!fresh) readGroupStatus(pPvt, pasynUser);
+            dbScanLock((dbCommon *)pmca);
+            (*prset->process)(pmca);
+            dbScanUnlock((dbCommon *)pmca);
+        } else {
+            if (pmsg->interface == int32Type) {
+                pPvt->pasynInt32->write(pPvt->asynInt32Pvt, pasynUser,
+                                        pmsg->ivalue);
+            } else {
+                pPvt->pasynFloat64->write(pPvt->asynFloat64Pvt, pasynUser,
+                                          pmsg->dvalue);
+            }
+        }
+    }
+    /* Return the batch to the pool */
+    freeBatch(pPvt, pbatch);
+}
 
-    if (pmsg->command == mcaData) {
-        /* Read data */
-       pPvt->pasynInt32Array->read(pPvt->asynInt32ArrayPvt, pasynUser, 
-                                   pPvt->data, pmca->nuse, &pPvt->nread);
-       dbScanLock((dbCommon *)pmca);
-       (*prset->process)(pmca);
-       dbScanUnlock((dbCommon *)pmca);
 
+/* Returns the group for an asyn port, creating it if needed */
+static mcaAsynGroup *findGroup(const char *portName)
+{
+    mcaAsynGroup *pgroup;
 
-    } else if (pmsg->command == mcaReadStatus) {
-        /* Read the current status of the device */
-       pPvt->pasynInt32->write(pPvt->asynInt32Pvt, pasynUser, 0);
-       pasynUser->reason = pPvt->driverReasons[mcaAcquiring];
-       pPvt->pasynInt32->read(pPvt->asynInt32Pvt, pasynUser, &pPvt->acquiring);
-       pasynUser->reason = pPvt->driverReasons[mcaElapsedLiveTime];
-       pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser, 
-                                &pPvt->elapsedLive);
-       pasynUser->reason = pPvt->driverReasons[mcaElapsedRealTime];
-       pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser, 
-                                &pPvt->elapsedReal);
-       pasynUser->reason = pPvt->driverReasons[mcaElapsedCounts];
-       pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser, 
-                                &pPvt->totalCounts);
-       pasynUser->reason = pPvt->driverReasons[mcaDwellTime];
-       pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser, 
-                                &pPvt->dwellTime);
-       dbScanLock((dbCommon *)pmca);
-       (*prset->process)(pmca);
-       dbScanUnlock((dbCommon *)pmca);     
+    epicsThreadOnce(&groupOnceId, groupOnce, NULL);
+    epicsMutexLock(groupListLock);
+    for (pgroup = (mcaAsynGroup *)ellFirst(&groupList); pgroup;
+         pgroup = (mcaAsynGroup *)ellNext(&pgroup->node)) {
+        if (strcmp(pgroup->portName, portName) == 0) break;
+    }
+    if (!pgroup) {
+        pgroup = callocMustSucceed(1, sizeof(*pgroup), "devMcaAsyn findGroup()");
+        pgroup->portName = epicsStrDup(portName);
+        pgroup->dataAllReason = -1;
+        ellInit(&pgroup->members);
+        ellAdd(&groupList, &pgroup->node);
+    }
+    epicsMutexUnlock(groupListLock);
+    return(pgroup);
+}
+
+static void groupOnce(void *arg)
+{
+    groupListLock = epicsMutexMustCreate();
+    ellInit(&groupList);
+}
+
+/* Called from asynCallback the first time a member of the group reads data,
+ * to find out if the driver can read all of the spectra in one call */
+static void probeGroup(mcaAsynPvt *pPvt, asynUser *pasynUser)
+{
+    mcaAsynGroup *pgroup = pPvt->pgroup;
+    mcaAsynPvt *pmember;
+    asynUser *pasynUserAll;
+    epicsInt32 numSignals;
+    int nmax=0;
+
+    if (pgroup->probed) return;
+    pgroup->probed = 1;
+    pasynUserAll = pasynManager->duplicateAsynUser(pasynUser, NULL, NULL);
+    if ((pPvt->pasynDrvUser->create(pPvt->asynDrvUserPvt, pasynUserAll,
+                                    mcaDataAllString, NULL, NULL) == asynSuccess) &&
+        (pPvt->pasynInt32->read(pPvt->asynInt32Pvt, pasynUserAll,
+                                &numSignals) == asynSuccess) &&
+        (numSignals > 0)) {
+        for (pmember = (mcaAsynPvt *)ellFirst(&pgroup->members); pmember;
+             pmember = (mcaAsynPvt *)ellNext(&pmember->groupNode)) {
+            if (pmember->pmca->nmax > nmax) nmax = pmember->pmca->nmax;
+        }
+        pgroup->dataAllReason = pasynUserAll->reason;
+        pgroup->numSignals = numSignals;
+        pgroup->stride = nmax;
+        pgroup->buffer = callocMustSucceed(numSignals*nmax, sizeof(epicsInt32),
+                                           "devMcaAsyn probeGroup()");
+    }
+    asynPrint(pasynUser, ASYN_TRACE_FLOW,
+              "devMcaAsyn::probeGroup, port %s, %d members, %s\n",
+              pgroup->portName, ellCount(&pgroup->members),
+              (pgroup->dataAllReason < 0) ? "no " mcaDataAllString : mcaDataAllString);
+    pasynManager->freeAsynUser(pasynUserAll);
+}
+
+/* Reads the status of one record */
+static void readStatus(mcaAsynPvt *pPvt, asynUser *pasynUser)
+{
+    pasynUser->reason = pPvt->driverReasons[mcaReadStatus];
+    pPvt->pasynInt32->write(pPvt->asynInt32Pvt, pasynUser, 0);
+    epicsMutexLock(pPvt->lock);
+    pasynUser->reason = pPvt->driverReasons[mcaAcquiring];
+    pPvt->pasynInt32->read(pPvt->asynInt32Pvt, pasynUser, &pPvt->acquiring);
+    pasynUser->reason = pPvt->driverReasons[mcaElapsedLiveTime];
+    pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser,
+                             &pPvt->elapsedLive);
+    pasynUser->reason = pPvt->driverReasons[mcaElapsedRealTime];
+    pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser,
+                             &pPvt->elapsedReal);
+    pasynUser->reason = pPvt->driverReasons[mcaElapsedCounts];
+    pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser,
+                             &pPvt->totalCounts);
+    pasynUser->reason = pPvt->driverReasons[mcaDwellTime];
+    pPvt->pasynFloat64->read(pPvt->asynFloat64Pvt, pasynUser,
+                             &pPvt->dwellTime);
+    pPvt->haveStatus = 1;
+    epicsMutexUnlock(pPvt->lock);
+}
+
+/* Returns 1 if cached is set and *ptime, when a group read left the status or
+ * data for a record, is less than devMcaAsynCacheAge seconds ago.  Called with
+ * the record's lock held */
+static int cacheFresh(int cached, const epicsTimeStamp *ptime)
+{
+    epicsTimeStamp now;
+
+    if (!cached) return(0);
+    epicsTimeGetCurrent(&now);
+    return(epicsTimeDiffInSeconds(&now, ptime) < devMcaAsynCacheAge);
+}
+
+/* Reads the status of the record which queued the request, and of the other
+ * members of its group.  The status of the others is kept for them to use
+ * when they process, so when a dfanout processes all of the records on a port
+ * the status is read in one request. */
+static void readGroupStatus(mcaAsynPvt *pPvt, asynUser *pasynUser)
+{
+    readStatus(pPvt, pasynUser);
+    cacheGroupStatus(pPvt);
+}
+
+/* Reads and keeps the status of the members of the group other than pPvt.
+ * Members whose status is still fresh from an earlier group read are not read
+ * again. */
+static void cacheGroupStatus(mcaAsynPvt *pPvt)
+{
+    mcaAsynPvt *pmember;
+    epicsTimeStamp now;
+    int fresh;
+
+    epicsTimeGetCurrent(&now);
+    for (pmember = (mcaAsynPvt *)ellFirst(&pPvt->pgroup->members); pmember;
+         pmember = (mcaAsynPvt *)ellNext(&pmember->groupNode)) {
+        if (pmember == pPvt) continue;
+        epicsMutexLock(pmember->lock);
+        fresh = cacheFresh(pmember->cacheStatus, &pmember->statusTime);
+        epicsMutexUnlock(pmember->lock);
+        if (fresh) continue;
+        /* The port is already locked, so the member's own asynUser can be
+         * used directly */
+        readStatus(pmember, pmember->pasynUser);
+        epicsMutexLock(pmember->lock);
+        pmember->cacheStatus = 1;
+        pmember->statusTime = now;
+        epicsMutexUnlock(pmember->lock);
+    }
+}
+
+/* Reads the data for the record which queued the request, and for the other
+ * members of its group.  The data and status for those are left for them to
+ * pick up, as if the driver had done callbacks.  The I/O Intr members are
+ * then scanned, the others use them if they process soon enough.  The lengths
+ * are not trimmed to NUSE here, because the other records are not locked,
+ * read_array does that.
+ * Returns the number of I/O Intr members read, other than this record. */
+static int readGroupData(mcaAsynPvt *pPvt, asynUser *pasynUser)
+{
+    mcaAsynGroup *pgroup = pPvt->pgroup;
+    mcaAsynPvt *pmember;
+    epicsTimeStamp now;
+    size_t nread;
+    int nothers=0, nscan=0;
+
+    probeGroup(pPvt, pasynUser);
+    epicsTimeGetCurrent(&now);
+    for (pmember = (mcaAsynPvt *)ellFirst(&pgroup->members); pmember;
+         pmember = (mcaAsynPvt *)ellNext(&pmember->groupNode)) {
+        if (pmember == pPvt) continue;
+        nothers++;
+        if (pmember->ioIntr) nscan++;
+    }
+
+    if ((nothers > 0) && (pgroup->dataAllReason >= 0)) {
+        /* One driver call for all of the spectra */
+        pasynUser->reason = pgroup->dataAllReason;
+        pPvt->pasynInt32Array->read(pPvt->asynInt32ArrayPvt, pasynUser, pgroup->buffer,
+                                    pgroup->numSignals*pgroup->stride, &nread);
+        for (pmember = (mcaAsynPvt *)ellFirst(&pgroup->members); pmember;
+             pmember = (mcaAsynPvt *)ellNext(&pmember->groupNode)) {
+            size_t nmax = pmember->pmca->nmax;
+            if (pmember->addr >= pgroup->numSignals) continue;
+            epicsMutexLock(pmember->lock);
+            pmember->nread = (nread < nmax) ? nread : nmax;
+            memcpy(pmember->data, pgroup->buffer + pmember->addr*pgroup->stride,
+                   pmember->nread*sizeof(epicsInt32));
+            if (pmember != pPvt) {
+                pmember->newData = 1;
+                pmember->dataTime = now;
+            }
+            epicsMutexUnlock(pmember->lock);
+        }
     } else {
-        if (pmsg->interface == int32Type) {
-            pPvt->pasynInt32->write(pPvt->asynInt32Pvt, pasynUser,
-                                    pmsg->ivalue);
-        } else {
-            pPvt->pasynFloat64->write(pPvt->asynFloat64Pvt, pasynUser,
-                                      pmsg->dvalue);
+        pasynUser->reason = pPvt->driverReasons[mcaData];
+        epicsMutexLock(pPvt->lock);
+        pPvt->pasynInt32Array->read(pPvt->asynInt32ArrayPvt, pasynUser,
+                                    pPvt->data, pPvt->pmca->nuse, &pPvt->nread);
+        epicsMutexUnlock(pPvt->lock);
+        for (pmember = (mcaAsynPvt *)ellFirst(&pgroup->members); pmember;
+             pmember = (mcaAsynPvt *)ellNext(&pmember->groupNode)) {
+            if (pmember == pPvt) continue;
+            /* The port is already locked, so the member's own asynUser
+             * can be used directly */
+            pmember->pasynUser->reason = pmember->driverReasons[mcaData];
+            epicsMutexLock(pmember->lock);
+            pmember->pasynInt32Array->read(pmember->asynInt32ArrayPvt, pmember->pasynUser,
+                                           pmember->data, pmember->pmca->nmax, &pmember->nread);
+            pmember->newData = 1;
+            pmember->dataTime = now;
+            epicsMutexUnlock(pmember->lock);
         }
     }
-    pasynManager->memFree(pmsg, sizeof(*pmsg));
-    status = pasynManager->freeAsynUser(pasynUser);
-    if (status != asynSuccess) {
-        asynPrint(pasynUser, ASYN_TRACE_ERROR, 
-                  "devMcaAsyn::asynCallback: %s error in freeAsynUser, %s\n",
-                  pmca->name, pasynUser->errorMessage);
+    if (nothers == 0) return(0);
+    cacheGroupStatus(pPvt);
+    return(nscan);
+}
+
+/* Processes the I/O Intr members of the group after readGroupData */
+static void scanGroup(mcaAsynPvt *pPvt)
+{
+    mcaAsynPvt *pmember;
+
+    for (pmember = (mcaAsynPvt *)ellFirst(&pPvt->pgroup->members); pmember;
+         pmember = (mcaAsynPvt *)ellNext(&pmember->groupNode)) {
+        if ((pmember == pPvt) || !pmember->ioIntr) continue;
+        epicsMutexLock(pmember->lock);
+        requestScan(pmember);
+        epicsMutexUnlock(pmember->lock);
     }
 }
-
+
 
 static long read_array(mcaRecord *pmca)
 {
     mcaAsynPvt *pPvt = (mcaAsynPvt *)pmca->dpvt;
     asynUser *pasynUser = pPvt->pasynUser;
 
-    /* Copy data from private buffer to record */
-    memcpy(pmca->bptr, pPvt->data, pPvt->nread*sizeof(epicsInt32));  
+    /* The record calls this from process() with the record locked, so clients
+     * never see a partially written spectrum.  The driver only ever writes
+     * into pPvt->data, under pPvt->lock */
+    epicsMutexLock(pPvt->lock);
+    /* Data pushed by the driver can be longer than NUSE */
+    if (pPvt->nread > (size_t)pmca->nuse) pPvt->nread = pmca->nuse;
+    if (pPvt->swapBuffers) {
+        int *front = pmca->bptr;
+        pmca->bptr = pPvt->data;
+        pPvt->data = front;
+    } else {
+        /* Copy data from private buffer to record */
+        memcpy(pmca->bptr, pPvt->data, pPvt->nread*sizeof(epicsInt32));  
+    }
     pmca->udf=0;
     pmca->nord = pPvt->nread;
+    pPvt->newData = 0;
+    epicsMutexUnlock(pPvt->lock);
     asynPrint(pasynUser, ASYN_TRACE_FLOW, 
               "devMcaAsyn::read_value, record=%s, nord=%d\n",
               pmca->name, pmca->nord);
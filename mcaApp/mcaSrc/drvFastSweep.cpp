@@ -6,16 +6,63 @@
 
     These routines implement the asynMca interface, and use the asynFastSweep
     interface.
+
+    In stream mode (FAST_SWEEP_STREAM_MODE=1) acquisition does not stop after
+    numPoints points.  The points are kept in a circular buffer of numPoints,
+    and are read back oldest first.  FAST_SWEEP_TRIGGER stops acquisition
+    FAST_SWEEP_POST_TRIGGER points later, so the buffer then holds
+    numPoints-FAST_SWEEP_POST_TRIGGER points from before the trigger.  If
+    FAST_SWEEP_STREAM_FILE is set when acquisition starts every point is also
+    appended to that file, as maxSignals epicsInt32 values in native byte order,
+    so the length of a run is not limited by maxPoints.  consumerThread only
+    queues chunks of points, a writer thread does the file I/O.  If the writer
+    falls behind by FAST_SWEEP_STREAM_CHUNKS chunks the file is closed, and the
+    rest of the points of the acquisition are counted as lost.  A read of fewer
+    than numPoints points in stream mode gets the newest ones.
+
+    If the statistics argument of initFastSweep is non-zero the minimum,
+    maximum and standard deviation of the samples averaged into each point are
+    kept as well, at addresses maxSignals+s, 2*maxSignals+s and 3*maxSignals+s
+    for signal s.  They are computed in the averaging pass, the standard
+    deviation with Welford's method in double precision so that it is accurate
+    for any number of samples.  They can be read as int32 or float64 arrays.
+
+    If the float64Input argument is non-zero the input is an asynFloat64Array
+    source, such as an electrometer, instead of asynInt32Array.  The sample
+    sets, averages and stored points are then kept as epicsFloat64, so the
+    values keep their precision.  The processing is the same template code for
+    both input types, and the points are only converted if they are read
+    through the other array interface.  The stream file then holds epicsFloat64
+    values.
+
+    MCA_DATA_APPEND reads return only the points acquired since the previous
+    read by the same asynUser, so a client polling a long acquisition copies
+    just the new points.  The cursor counts points since the last erase, like
+    FAST_SWEEP_TOTAL_POINTS; in stream mode points that were overwritten before
+    they were read are skipped.  With the parameter callbacks consumerThread
+    also does array callbacks on MCA_DATA_APPEND with each signal's new points,
+    asynInt32Array or asynFloat64Array for the input type.
+
+    MCA_TIMESTAMPS holds the time of each point, in seconds of acquisition
+    since the last erase, taken from the timestamp of the last sample set in
+    the point.  That is the input driver's timestamp from its callback, or the
+    time dataCallback ran if the driver does not set one, so it does not
+    include the delay through the ring.  It is read, and read incrementally
+    with MCA_TIMESTAMPS_APPEND, like the signals.
 */
 
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 
 #include <epicsTime.h>
 #include <epicsTypes.h>
 #include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsAtomic.h>
 #include <epicsString.h>
 #include <errlog.h>
 #include <iocsh.h>
@@ -30,12 +77,49 @@
 
 static const char *driverName = "drvFastSweep";
 
+/* consumerThread drains the ring at least this often, in seconds */
+#define RING_POLL_PERIOD 0.01
+/* and does parameter callbacks for new points at most this often */
+#define CALLBACK_PERIOD 0.1
+
 static void dataCallbackC(void *drvPvt, asynUser *pasynUser, 
                          epicsInt32 *newData, size_t nelem)
 {
     drvFastSweep *pPvt = (drvFastSweep *)drvPvt;
     
-    pPvt->dataCallback(newData, nelem);
+    pPvt->dataCallback(newData, nelem, &pasynUser->timestamp);
+}
+
+static void dataCallbackFloat64C(void *drvPvt, asynUser *pasynUser,
+                                 epicsFloat64 *newData, size_t nelem)
+{
+    drvFastSweep *pPvt = (drvFastSweep *)drvPvt;
+
+    pPvt->dataCallback(newData, nelem, &pasynUser->timestamp);
+}
+
+/* Conversions between the input and output types */
+static inline void assignValue(epicsInt32 *dest, epicsInt32 value) { *dest = value; }
+static inline void assignValue(epicsInt32 *dest, epicsFloat64 value) { *dest = (epicsInt32)floor(value + 0.5); }
+static inline void assignValue(epicsFloat64 *dest, epicsInt32 value) { *dest = value; }
+static inline void assignValue(epicsFloat64 *dest, epicsFloat64 value) { *dest = value; }
+
+/* The average of the samples in a point, rounded for an integer input */
+static inline void assignMean(epicsInt32 *dest, double mean) { *dest = (epicsInt32)(0.5 + mean); }
+static inline void assignMean(epicsFloat64 *dest, double mean) { *dest = mean; }
+
+static void consumerThreadC(void *drvPvt)
+{
+    drvFastSweep *pPvt = (drvFastSweep *)drvPvt;
+
+    pPvt->consumerThread();
+}
+
+static void streamWriterThreadC(void *drvPvt)
+{
+    drvFastSweep *pPvt = (drvFastSweep *)drvPvt;
+
+    pPvt->streamWriterThread();
 }
 
 static void intervalCallbackC(void *drvPvt, asynUser *pasynUser, double seconds)
@@ -48,17 +132,18 @@ static void intervalCallbackC(void *drvPvt, asynUser *pasynUser, double seconds)
 
 drvFastSweep::drvFastSweep(const char *portName, const char *inputName, 
                            int maxSignals, int maxPoints, 
-                           const char *dataString, const char *intervalString)
+                           const char *dataString, const char *intervalString,
+                           int statistics, int float64Input)
    : asynPortDriver(portName, 
-                    maxSignals,
+                    statistics ? maxSignals*fastSweepNumStatistics : maxSignals,
                     NUM_FAST_SWEEP_PARAMS,
-                    asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynDrvUserMask, /* Interface mask */
-                    asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask,                   /* Interrupt mask */
+                    asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynOctetMask | asynDrvUserMask, /* Interface mask */
+                    asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask, /* Interrupt mask */
                     ASYN_MULTIDEVICE, /* asynFlags.  This driver does not block and it is multi-device */
                     1, /* Autoconnect */
                     0, /* Default priority */
                     0), /* Default stack size*/
-     int32ArrayRegistrarPvt_(NULL)
+     int32ArrayRegistrarPvt_(NULL), float64ArrayRegistrarPvt_(NULL)
 {
     const char *functionName = "drvFastSweep";
     
@@ -70,6 +155,7 @@ drvFastSweep::drvFastSweep(const char *portName, const char *inputName,
     void *drvUserPvt;
     const char *ptypeName;
     size_t psize;
+    int i;
 
     // Uncomment this line to enable asynTraceFlow during the constructor
     //pasynTrace->setTraceMask(pasynUserSelf, 0x11);
@@ -95,8 +181,17 @@ drvFastSweep::drvFastSweep(const char *portName, const char *inputName,
     createParam(mcaElapsedLiveTimeString,           asynParamFloat64, &mcaElapsedLiveTime_);        /* float64, read */
     createParam(mcaElapsedRealTimeString,           asynParamFloat64, &mcaElapsedRealTime_);        /* float64, read */
     createParam(mcaElapsedCountsString,             asynParamFloat64, &mcaElapsedCounts_);          /* float64, read */
+    createParam(mcaDataAllString,                     asynParamInt32, &mcaDataAll_);                /* int32Array/int32, read */
+    createParam(mcaDataAppendString,                  asynParamInt32, &mcaDataAppend_);             /* int32Array/int32, read */
+    createParam(mcaTimestampsString,           asynParamFloat64Array, &mcaTimestamps_);             /* float64Array, read */
+    createParam(mcaTimestampsAppendString,            asynParamInt32, &mcaTimestampsAppend_);       /* float64Array/int32, read */
     createParam(fastSweepMaxChannelsString,           asynParamInt32, &fastSweepMaxChannels_);      /* int32, read */
     createParam(fastSweepCurrentChannelString,        asynParamInt32, &fastSweepCurrentChannel_);   /* int32, read */
+    createParam(fastSweepStreamModeString,            asynParamInt32, &fastSweepStreamMode_);       /* int32, write */
+    createParam(fastSweepPostTriggerString,           asynParamInt32, &fastSweepPostTrigger_);      /* int32, write */
+    createParam(fastSweepTriggerString,               asynParamInt32, &fastSweepTrigger_);          /* int32, write */
+    createParam(fastSweepStreamFileString,            asynParamOctet, &fastSweepStreamFile_);       /* octet, write */
+    createParam(fastSweepTotalPointsString,         asynParamFloat64, &fastSweepTotalPoints_);      /* float64, read */
 
     maxSignals_ = maxSignals;
     maxPoints_ = maxPoints;
@@ -110,8 +205,29 @@ drvFastSweep::drvFastSweep(const char *portName, const char *inputName,
     numAverage_ = 1;
     accumulated_ = 0;
     erased_ = true;
+    streamMode_ = 0;
+    writeIndex_ = 0;
+    postTrigger_ = 0;
+    postRemaining_ = 0;
+    triggered_ = 0;
+    totalPoints_ = 0.;
+    streaming_ = false;
+    streamOverflow_ = false;
+    streamLostPoints_ = 0.;
+    callbacksPending_ = false;
+    eraseCount_ = 0;
+    appendCallbackCursor_.next = 0;
+    appendCallbackCursor_.eraseCount = 0;
+    ringHead_ = 0;
+    ringTail_ = 0;
+    ringOverflows_ = 0;
     setIntegerParam(fastSweepMaxChannels_, maxPoints_);
     setIntegerParam(fastSweepCurrentChannel_, 0);
+    setIntegerParam(fastSweepStreamMode_, 0);
+    setIntegerParam(fastSweepPostTrigger_, 0);
+    setStringParam(fastSweepStreamFile_, "");
+    setDoubleParam(fastSweepTotalPoints_, 0.);
+    for (i=0; i<maxSignals_; i++) setIntegerParam(i, mcaDataAll_, maxSignals_);
     inputName_ = epicsStrDup(inputName);
     if ((dataString != NULL) && (strlen(dataString) != 0)) {
         dataString_ = epicsStrDup(dataString);
@@ -124,11 +240,73 @@ drvFastSweep::drvFastSweep(const char *portName, const char *inputName,
         intervalString_ = epicsStrDup("SCAN_PERIOD");
     }
     epicsTimeGetCurrent(&startTime_);
+    lastCallbackTime_ = startTime_;
 
-    pData_ = (int *)callocMustSucceed(maxPoints_ * maxSignals_,
-                                      sizeof(int), "initFastSweep");
+    float64Input_ = float64Input ? 1 : 0;
+    pData_ = NULL;
+    pDataFloat64_ = NULL;
+    if (float64Input_) {
+        pDataFloat64_ = (epicsFloat64 *)callocMustSucceed(maxPoints_ * maxSignals_,
+                                                          sizeof(epicsFloat64), "initFastSweep");
+        ringSlotSize_ = maxSignals_ * sizeof(epicsFloat64);
+    } else {
+        pData_ = (int *)callocMustSucceed(maxPoints_ * maxSignals_,
+                                          sizeof(int), "initFastSweep");
+        ringSlotSize_ = maxSignals_ * sizeof(epicsInt32);
+    }
     pAverageStore_ = (double *)callocMustSucceed(maxSignals_,
                                                  sizeof(double), "initFastSweep");
+    statistics_ = statistics ? 1 : 0;
+    pStatMean_ = NULL;
+    pStatM2_ = NULL;
+    pStatMin_ = NULL;
+    pStatMax_ = NULL;
+    pStats_ = NULL;
+    if (statistics_) {
+        pStatMean_ = (double *)callocMustSucceed(maxSignals_, sizeof(double), "initFastSweep");
+        pStatM2_ = (double *)callocMustSucceed(maxSignals_, sizeof(double), "initFastSweep");
+        pStatMin_ = (double *)callocMustSucceed(maxSignals_, sizeof(double), "initFastSweep");
+        pStatMax_ = (double *)callocMustSucceed(maxSignals_, sizeof(double), "initFastSweep");
+        pStats_ = (double *)callocMustSucceed((fastSweepNumStatistics-1) * maxSignals_ * maxPoints_,
+                                              sizeof(double), "initFastSweep");
+    }
+    pRing_ = (char *)callocMustSucceed(FAST_SWEEP_RING_SIZE, ringSlotSize_, "initFastSweep");
+    pRingTime_ = (epicsTimeStamp *)callocMustSucceed(FAST_SWEEP_RING_SIZE, sizeof(epicsTimeStamp), "initFastSweep");
+    /* Big enough for the points of one signal or the timestamps */
+    pAppendChunk_ = (char *)callocMustSucceed(maxPoints_, sizeof(double), "initFastSweep");
+    pTimestamps_ = (double *)callocMustSucceed(maxPoints_, sizeof(double), "initFastSweep");
+    timestampOffset_ = 0.;
+    lastTimestamp_ = 0.;
+    ringEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    /* A chunk also holds the file name for fastSweepStreamOpen */
+    pStreamChunks_ = (char *)callocMustSucceed(FAST_SWEEP_STREAM_CHUNKS * FAST_SWEEP_STREAM_CHUNK_POINTS,
+                                               ringSlotSize_, "initFastSweep");
+    streamFill_ = 0;
+    streamHead_ = 0;
+    streamTail_ = 0;
+    streamEvent_ = epicsEventMustCreate(epicsEventEmpty);
+    /* Create the thread that writes the stream file */
+    if (epicsThreadCreate("drvFastSweepStream",
+                          epicsThreadPriorityLow,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)streamWriterThreadC,
+                          this) == NULL) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: epicsThreadCreate failure for stream writer\n",
+                  driverName, functionName);
+        return;
+    }
+    /* Create the thread that does the averaging, storage and callbacks */
+    if (epicsThreadCreate("drvFastSweep",
+                          epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)consumerThreadC,
+                          this) == NULL) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: epicsThreadCreate failure\n",
+                  driverName, functionName);
+        return;
+    }
     // Connect to our input driver
     pasynUserInt32Array_ = pasynManager->createAsynUser(0,0);
     status = pasynManager->connectDevice(pasynUserInt32Array_, inputName, 0);
@@ -151,18 +329,25 @@ drvFastSweep::drvFastSweep(const char *portName, const char *inputName,
     pdrvUser = (asynDrvUser *)pasynInterface->pinterface;
     drvUserPvt = pasynInterface->drvPvt;
 
-    /* Get the asynInt32Array interface */
+    /* Get the asynInt32Array or asynFloat64Array interface */
     pasynInterface = pasynManager->findInterface(pasynUserInt32Array_, 
-                                                 asynInt32ArrayType, 1);
+                                                 float64Input_ ? asynFloat64ArrayType :
+                                                                 asynInt32ArrayType, 1);
     if (!pasynInterface) {
         asynPrint(pasynUserInt32Array_, ASYN_TRACE_ERROR,
-                  "%s:%s:, find asynInt32Array interface failed"
+                  "%s:%s:, find %s interface failed"
                   " for input %s\n",
-                  driverName, functionName, inputName);
+                  driverName, functionName,
+                  float64Input_ ? asynFloat64ArrayType : asynInt32ArrayType, inputName);
         goto error;
     }
-    pint32Array_ = (asynInt32Array *)pasynInterface->pinterface;
-    int32ArrayPvt_ = pasynInterface->drvPvt;
+    if (float64Input_) {
+        pfloat64Array_ = (asynFloat64Array *)pasynInterface->pinterface;
+        float64ArrayPvt_ = pasynInterface->drvPvt;
+    } else {
+        pint32Array_ = (asynInt32Array *)pasynInterface->pinterface;
+        int32ArrayPvt_ = pasynInterface->drvPvt;
+    }
 
     /* Configure the asynUser for data command */
     status = pdrvUser->create(drvUserPvt, pasynUserInt32Array_, dataString_, &ptypeName, &psize);
@@ -173,8 +358,13 @@ drvFastSweep::drvFastSweep(const char *portName, const char *inputName,
         goto error;
     }
 
-    pint32Array_->registerInterruptUser(int32ArrayPvt_, pasynUserInt32Array_, 
-                                        dataCallbackC, this, &int32ArrayRegistrarPvt_);
+    if (float64Input_) {
+        pfloat64Array_->registerInterruptUser(float64ArrayPvt_, pasynUserInt32Array_,
+                                              dataCallbackFloat64C, this, &float64ArrayRegistrarPvt_);
+    } else {
+        pint32Array_->registerInterruptUser(int32ArrayPvt_, pasynUserInt32Array_, 
+                                            dataCallbackC, this, &int32ArrayRegistrarPvt_);
+    }
 
     /* Get the asynFloat64 interface */
     pasynUserFloat64_ = pasynManager->duplicateAsynUser(pasynUserInt32Array_,0,0);
@@ -218,50 +408,209 @@ void drvFastSweep::intervalCallback(double seconds)
     unlock();
 }
 
-void drvFastSweep::dataCallback(epicsInt32 *newData, size_t nelem)
+/* This runs in the input driver's callback thread, at the input's sample
+ * rate.  It does not take the lock: it copies the sample set into the ring, and
+ * consumerThread does the rest.  It is the only writer of ringHead_, and
+ * consumerThread, with the lock held, is the only writer of ringTail_.  If the
+ * ring is full the sample set is dropped and counted. */
+void drvFastSweep::dataCallback(epicsInt32 *newData, size_t nelem, const epicsTimeStamp *pTime)
 {
-    int i;
+    pushSample(newData, nelem, pTime);
+}
+
+void drvFastSweep::dataCallback(epicsFloat64 *newData, size_t nelem, const epicsTimeStamp *pTime)
+{
+    pushSample(newData, nelem, pTime);
+}
+
+template <typename T>
+void drvFastSweep::pushSample(const T *newData, size_t nelem, const epicsTimeStamp *pTime)
+{
+    size_t head, tail, n;
+    T *pSlot;
 
     if (!acquiring_) return;
-    
-    lock();
 
+    head = ringHead_;
+    tail = epicsAtomicGetSizeT(&ringTail_);
+    if (head - tail >= FAST_SWEEP_RING_SIZE) {
+        epicsAtomicIncrSizeT(&ringOverflows_);
+        return;
+    }
+    pSlot = (T *)&pRing_[(head & (FAST_SWEEP_RING_SIZE-1)) * ringSlotSize_];
+    n = (nelem < (size_t)maxSignals_) ? nelem : maxSignals_;
+    memcpy(pSlot, newData, n*sizeof(T));
+    if (n < (size_t)maxSignals_) memset(&pSlot[n], 0, (maxSignals_-n)*sizeof(T));
+    if (pTime->secPastEpoch || pTime->nsec)
+        pRingTime_[head & (FAST_SWEEP_RING_SIZE-1)] = *pTime;
+    else
+        epicsTimeGetCurrent(&pRingTime_[head & (FAST_SWEEP_RING_SIZE-1)]);
+    /* The slot must be written before it is published */
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicSetSizeT(&ringHead_, head+1);
+    /* Wake the consumer early if the ring is filling up */
+    if (head - tail == FAST_SWEEP_RING_SIZE/2) epicsEventSignal(ringEvent_);
+}
+
+void drvFastSweep::consumerThread()
+{
+    epicsTimeStamp now;
+
+    while (1) {
+        epicsEventWaitWithTimeout(ringEvent_, RING_POLL_PERIOD);
+        lock();
+        drainRing();
+        /* Rate limit the callbacks for new points, but do them at once when
+         * acquisition stops so that clients see the final state */
+        if (callbacksPending_) {
+            epicsTimeGetCurrent(&now);
+            if (!acquiring_ ||
+                (epicsTimeDiffInSeconds(&now, &lastCallbackTime_) >= CALLBACK_PERIOD)) {
+                if (float64Input_)
+                    doAppendCallbacks(pDataFloat64_);
+                else
+                    doAppendCallbacks(pData_);
+                callParamCallbacks();
+                lastCallbackTime_ = now;
+                callbacksPending_ = false;
+            }
+        }
+        unlock();
+    }
+}
+
+/* Processes the sample sets in the ring.  Called with the lock held. */
+void drvFastSweep::drainRing()
+{
+    size_t head = epicsAtomicGetSizeT(&ringHead_);
+    size_t tail = ringTail_;
+    char *pSlot;
+    epicsTimeStamp *pTime;
+
+    /* Read the slots only after reading ringHead_ */
+    epicsAtomicReadMemoryBarrier();
+    while (tail != head) {
+        pSlot = &pRing_[(tail & (FAST_SWEEP_RING_SIZE-1)) * ringSlotSize_];
+        pTime = &pRingTime_[tail & (FAST_SWEEP_RING_SIZE-1)];
+        if (float64Input_)
+            processSample((epicsFloat64 *)pSlot, pTime);
+        else
+            processSample((epicsInt32 *)pSlot, pTime);
+        tail++;
+        /* Finish with the slot before giving it back to dataCallback */
+        epicsAtomicWriteMemoryBarrier();
+        epicsAtomicSetSizeT(&ringTail_, tail);
+    }
+}
+
+/* Averages one sample set.  Called with the lock held. */
+template <typename T>
+void drvFastSweep::processSample(T *newData, const epicsTimeStamp *pTime)
+{
+    int i, n;
+    double delta;
+
+    if (statistics_) {
+        /* Welford's update of the mean and sum of squared differences */
+        n = accumulated_ + 1;
+        for (i=0; i<maxSignals_; i++) {
+            delta = newData[i] - pStatMean_[i];
+            pStatMean_[i] += delta/n;
+            pStatM2_[i] += delta*(newData[i] - pStatMean_[i]);
+            if ((n == 1) || (newData[i] < pStatMin_[i])) pStatMin_[i] = newData[i];
+            if ((n == 1) || (newData[i] > pStatMax_[i])) pStatMax_[i] = newData[i];
+        }
+    }
     /* No need to average if collecting every point */
     if (numAverage_ == 1) {
-        nextPoint(newData);
-        goto done;
+        nextPoint(newData, dataBuffer(newData), pTime);
+        resetStatistics();
+        return;
     }
     for (i=0; i<maxSignals_; i++) 
         pAverageStore_[i] += newData[i];
-    if (++(accumulated_) < numAverage_) goto done;
+    if (++(accumulated_) < numAverage_) return;
     /* We have now collected the desired number of points to average */
     for (i=0; i<maxSignals_; i++) 
-        newData[i] = (epicsInt32)(0.5 + pAverageStore_[i]/accumulated_);
-    nextPoint(newData);
+        assignMean(&newData[i], pAverageStore_[i]/accumulated_);
+    nextPoint(newData, dataBuffer(newData), pTime);
     for (i=0; i<maxSignals_; i++) 
         pAverageStore_[i] = 0;
     accumulated_ = 0;
-done:
-    unlock();
+    resetStatistics();
+}
+
+/* Discards the samples of a partial point */
+void drvFastSweep::resetAverage()
+{
+    memset(pAverageStore_, 0, maxSignals_*sizeof(double));
+    accumulated_ = 0;
+    resetStatistics();
+}
+
+void drvFastSweep::resetStatistics()
+{
+    if (!statistics_) return;
+    memset(pStatMean_, 0, maxSignals_*sizeof(double));
+    memset(pStatM2_, 0, maxSignals_*sizeof(double));
 }
 
 
-void drvFastSweep::nextPoint(epicsInt32 *newData)
+/* Stores one point in pBuffer, pData_ or pDataFloat64_ for the input type */
+template <typename T>
+void drvFastSweep::nextPoint(T *newData, T *pBuffer, const epicsTimeStamp *pTime)
 {
     int i;
     int offset;
+    int point = -1;
+    int nstat;
+    double *pStat;
     epicsTimeStamp now;
 
     if (!acquiring_) return;
 
-    offset = numAcquired_;
-    for (i = 0; i < maxSignals_; i++) {
-        pData_[offset] = newData[i];
-        offset += maxPoints_;
+    lastTimestamp_ = timestampOffset_ + epicsTimeDiffInSeconds(pTime, &startTime_);
+    if (streamMode_) {
+        if (numPoints_ > 0) {
+            offset = point = writeIndex_;
+            for (i = 0; i < maxSignals_; i++) {
+                pBuffer[offset] = newData[i];
+                offset += maxPoints_;
+            }
+            pTimestamps_[writeIndex_] = lastTimestamp_;
+            if (++writeIndex_ >= numPoints_) writeIndex_ = 0;
+            if (numAcquired_ < numPoints_) numAcquired_++;
+        }
+        if (streaming_)
+            streamPoint(newData);
+        else if (streamOverflow_)
+            streamLostPoints_++;
+        totalPoints_++;
+        if (triggered_ && (--postRemaining_ <= 0)) {
+            stopAcquire();
+        }
+    } else {
+        offset = point = numAcquired_;
+        for (i = 0; i < maxSignals_; i++) {
+            pBuffer[offset] = newData[i];
+            offset += maxPoints_;
+        }
+        pTimestamps_[numAcquired_] = lastTimestamp_;
+        numAcquired_++;
+        totalPoints_++;
+        if (numAcquired_ >= numPoints_) {
+           stopAcquire();
+        }
     }
-    numAcquired_++;
-    if (numAcquired_ >= numPoints_) {
-       stopAcquire();
+    if (statistics_ && (point >= 0)) {
+        /* The samples in the average, or just this one if numAverage is 1 */
+        nstat = (accumulated_ > 0) ? accumulated_ : 1;
+        for (i = 0; i < maxSignals_; i++) {
+            pStat = &pStats_[maxPoints_*i + point];
+            pStat[0] = pStatMin_[i];
+            pStat[maxPoints_*maxSignals_] = pStatMax_[i];
+            pStat[2*maxPoints_*maxSignals_] = (nstat > 1) ? sqrt(pStatM2_[i]/(nstat-1)) : 0.;
+        }
     }
     epicsTimeGetCurrent(&now);
     elapsedTime_ = epicsTimeDiffInSeconds(&now, &startTime_);
@@ -269,15 +618,18 @@ void drvFastSweep::nextPoint(epicsInt32 *newData)
         stopAcquire();
     }
     setIntegerParam(fastSweepCurrentChannel_, numAcquired_);
+    setDoubleParam(fastSweepTotalPoints_, totalPoints_);
     setDoubleParam(mcaElapsedRealTime_, elapsedTime_);
-    callParamCallbacks();
+    /* consumerThread does the callbacks */
+    callbacksPending_ = true;
 }
 
 void drvFastSweep::computeNumAverage()
 {
     numAverage_ = (int) (dwellTime_/callbackInterval_ + 0.5);
     if (numAverage_ < 1) numAverage_ = 1;
-    accumulated_ = 0;
+    /* Start a new point with the new numAverage */
+    resetAverage();
     dwellTime_ = callbackInterval_ * numAverage_;
     setDoubleParam(mcaDwellTime_, dwellTime_);
     callParamCallbacks();
@@ -287,6 +639,201 @@ void drvFastSweep::stopAcquire()
 {
     acquiring_ = 0;
     setIntegerParam(mcaAcquiring_, acquiring_);
+    endStream(fastSweepStreamClose);
+}
+
+/* The stream file is only touched by streamWriterThread.  consumerThread and
+ * the port thread, with the lock held, copy the points into chunks and queue
+ * them, and streamWriterThread opens, writes and closes the file.  One chunk is
+ * always kept free while streaming so that the stream can be ended.  If the
+ * writer falls behind the stream is ended, and the rest of the points of the
+ * acquisition are counted as lost. */
+
+/* Queues an open of FAST_SWEEP_STREAM_FILE, if it is set.  Called with the lock held. */
+void drvFastSweep::openStreamFile()
+{
+    char *pChunk;
+
+    streamOverflow_ = false;
+    streamLostPoints_ = 0.;
+    if (streaming_) return;
+    if (streamHead_ - epicsAtomicGetSizeT(&streamTail_) >= FAST_SWEEP_STREAM_CHUNKS-1) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:openStreamFile: stream file writer is busy, not streaming\n", driverName);
+        return;
+    }
+    pChunk = &pStreamChunks_[(streamHead_ % FAST_SWEEP_STREAM_CHUNKS) * FAST_SWEEP_STREAM_CHUNK_POINTS * ringSlotSize_];
+    getStringParam(fastSweepStreamFile_, 256, pChunk);
+    if (strlen(pChunk) == 0) return;
+    streamFill_ = strlen(pChunk) + 1;
+    queueStreamChunk(fastSweepStreamOpen);
+    streaming_ = true;
+}
+
+/* Copies one point to the chunk at streamHead_.  Called with the lock held. */
+void drvFastSweep::streamPoint(const void *newData)
+{
+    if (streamFill_ == FAST_SWEEP_STREAM_CHUNK_POINTS) queueStreamChunk(fastSweepStreamData);
+    if ((streamFill_ == 0) &&
+        (streamHead_ - epicsAtomicGetSizeT(&streamTail_) >= FAST_SWEEP_STREAM_CHUNKS-1)) {
+        endStream(fastSweepStreamOverflow);
+        streamLostPoints_++;
+        return;
+    }
+    memcpy(&pStreamChunks_[((streamHead_ % FAST_SWEEP_STREAM_CHUNKS) * FAST_SWEEP_STREAM_CHUNK_POINTS
+                            + streamFill_) * ringSlotSize_],
+           newData, ringSlotSize_);
+    streamFill_++;
+}
+
+/* Hands the chunk at streamHead_ to streamWriterThread.  For fastSweepStreamOpen
+ * streamFill_ is the length of the file name, otherwise the number of points. */
+void drvFastSweep::queueStreamChunk(fastSweepStreamOp op)
+{
+    size_t index = streamHead_ % FAST_SWEEP_STREAM_CHUNKS;
+
+    streamOps_[index] = op;
+    streamBytes_[index] = (op == fastSweepStreamOpen) ? streamFill_ : streamFill_ * ringSlotSize_;
+    streamFill_ = 0;
+    /* The chunk must be written before it is published */
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicSetSizeT(&streamHead_, streamHead_+1);
+    epicsEventSignal(streamEvent_);
+}
+
+/* Queues the points in the current chunk and a close of the stream file.
+ * Called with the lock held. */
+void drvFastSweep::endStream(fastSweepStreamOp op)
+{
+    if (!streaming_) return;
+    streaming_ = false;
+    if (op == fastSweepStreamOverflow) streamOverflow_ = true;
+    queueStreamChunk(op);
+}
+
+void drvFastSweep::streamWriterThread()
+{
+    FILE *file = NULL;
+    size_t tail, index, nbytes;
+    char *pChunk;
+
+    while (1) {
+        epicsEventWait(streamEvent_);
+        tail = streamTail_;
+        while (tail != epicsAtomicGetSizeT(&streamHead_)) {
+            /* Read the chunk only after reading streamHead_ */
+            epicsAtomicReadMemoryBarrier();
+            index = tail % FAST_SWEEP_STREAM_CHUNKS;
+            pChunk = &pStreamChunks_[index * FAST_SWEEP_STREAM_CHUNK_POINTS * ringSlotSize_];
+            nbytes = streamBytes_[index];
+            if (streamOps_[index] == fastSweepStreamOpen) {
+                if (file) fclose(file);
+                file = fopen(pChunk, "ab");
+                if (file) {
+                    /* Larger writes, the chunks are written as they arrive */
+                    setvbuf(file, NULL, _IOFBF, 1024*1024);
+                } else {
+                    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                              "%s:streamWriterThread: cannot open %s\n", driverName, pChunk);
+                }
+            } else if (file && (nbytes > 0) && (fwrite(pChunk, 1, nbytes, file) != nbytes)) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s:streamWriterThread: error writing stream file, closing it\n", driverName);
+                fclose(file);
+                file = NULL;
+            }
+            if (streamOps_[index] == fastSweepStreamOverflow)
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s:streamWriterThread: stream file writer fell behind, closing file\n", driverName);
+            if (file && (streamOps_[index] >= fastSweepStreamClose)) {
+                fclose(file);
+                file = NULL;
+            }
+            tail++;
+            /* Finish with the chunk before giving it back */
+            epicsAtomicWriteMemoryBarrier();
+            epicsAtomicSetSizeT(&streamTail_, tail);
+        }
+    }
+}
+
+/* The number of points before the newest npoints, so that a read of fewer
+ * points than the buffer holds gets the newest ones */
+size_t drvFastSweep::newestPoints(size_t npoints)
+{
+    if (!streamMode_ || ((size_t)numAcquired_ <= npoints)) return 0;
+    return numAcquired_ - npoints;
+}
+
+/* Copies npoints points of one signal's buffer, oldest first, starting
+ * start points after the oldest, converting them if the types differ */
+template <typename T, typename U>
+void drvFastSweep::copyPoints(const T *pSignal, U *dest, size_t start, size_t npoints)
+{
+    size_t i, first, index = start;
+
+    if (streamMode_ && (numAcquired_ == numPoints_)) {
+        /* The buffer has wrapped, the oldest point is at writeIndex_ */
+        index += writeIndex_;
+        if (index >= (size_t)numPoints_) index -= numPoints_;
+    }
+    first = numPoints_ - index;
+    if (first > npoints) first = npoints;
+    for (i=0; i<first; i++) assignValue(&dest[i], pSignal[index+i]);
+    for (i=first; i<npoints; i++) assignValue(&dest[i], pSignal[i-first]);
+}
+
+/* Copies the points for an address: signal addr%maxSignals, statistic
+ * addr/maxSignals */
+template <typename U>
+void drvFastSweep::copySignal(int addr, U *dest, size_t start, size_t npoints)
+{
+    int signal = addr % maxSignals_;
+    int statistic = addr / maxSignals_;
+
+    if (statistic != fastSweepMean)
+        copyPoints(&pStats_[maxPoints_*(maxSignals_*(statistic-1) + signal)], dest, start, npoints);
+    else if (float64Input_)
+        copyPoints(&pDataFloat64_[maxPoints_*signal], dest, start, npoints);
+    else
+        copyPoints(&pData_[maxPoints_*signal], dest, start, npoints);
+}
+
+/* Brings an append cursor up to date.  Returns the number of points after it,
+ * and in start their position in the buffer, counted from the oldest point. */
+size_t drvFastSweep::appendPoints(mcaAppendCursor *pCursor, size_t *start)
+{
+    size_t total = (size_t)totalPoints_;
+    size_t oldest = total - numAcquired_;
+
+    if ((pCursor->eraseCount != eraseCount_) || (pCursor->next > total)) {
+        pCursor->next = 0;
+        pCursor->eraseCount = eraseCount_;
+    }
+    /* In stream mode the points before oldest have been overwritten */
+    if (pCursor->next < oldest) pCursor->next = oldest;
+    *start = pCursor->next - oldest;
+    return total - pCursor->next;
+}
+
+/* Does the MCA_DATA_APPEND callbacks with each signal's points since the
+ * previous ones.  Called with the lock held. */
+template <typename T>
+void drvFastSweep::doAppendCallbacks(T *pBuffer)
+{
+    T *pChunk = (T *)pAppendChunk_;
+    size_t start, n;
+    int signal;
+
+    n = appendPoints(&appendCallbackCursor_, &start);
+    if (n == 0) return;
+    for (signal=0; signal<maxSignals_; signal++) {
+        copyPoints(&pBuffer[maxPoints_*signal], pChunk, start, n);
+        appendCallback(pChunk, n, signal);
+    }
+    copyPoints(pTimestamps_, (double *)pAppendChunk_, start, n);
+    doCallbacksFloat64Array((double *)pAppendChunk_, n, mcaTimestampsAppend_, 0);
+    appendCallbackCursor_.next += n;
 }
 
 asynStatus drvFastSweep::writeInt32(asynUser *pasynUser, epicsInt32 value)
@@ -299,31 +846,91 @@ asynStatus drvFastSweep::writeInt32(asynUser *pasynUser, epicsInt32 value)
     if (command == mcaStartAcquire_) {
         if (!acquiring_) {
             acquiring_ = 1;
+            triggered_ = 0;
             setIntegerParam(mcaAcquiring_, acquiring_);
             epicsTimeGetCurrent(&startTime_);
+            /* The timestamps continue from the previous acquisition */
+            timestampOffset_ = lastTimestamp_;
+            if (streamMode_) openStreamFile();
         }
     }  
+    else if (command == fastSweepStreamMode_) {
+        if (acquiring_) {
+            status = asynError;
+        } else {
+            streamMode_ = value ? 1 : 0;
+            writeIndex_ = 0;
+            numAcquired_ = 0;
+        }
+    }
+    else if (command == fastSweepPostTrigger_) {
+        postTrigger_ = value;
+    }
+    else if (command == fastSweepTrigger_) {
+        if (streamMode_ && acquiring_ && !triggered_) {
+            triggered_ = 1;
+            postRemaining_ = postTrigger_;
+            if (postRemaining_ <= 0) stopAcquire();
+        }
+    }
     else if (command == mcaStopAcquire_) {
         stopAcquire();
     }
     else if (command == mcaErase_) {
-        memset(pData_, 0, maxPoints_ * maxSignals_ * sizeof(int));
+        /* Discard the sample sets and the partial point from before the erase */
+        epicsAtomicSetSizeT(&ringTail_, epicsAtomicGetSizeT(&ringHead_));
+        resetAverage();
+        if (float64Input_)
+            memset(pDataFloat64_, 0, maxPoints_ * maxSignals_ * sizeof(epicsFloat64));
+        else
+            memset(pData_, 0, maxPoints_ * maxSignals_ * sizeof(int));
+        if (statistics_)
+            memset(pStats_, 0, (fastSweepNumStatistics-1) * maxPoints_ * maxSignals_ * sizeof(double));
         numAcquired_ = 0;
+        writeIndex_ = 0;
+        totalPoints_ = 0.;
+        /* Append cursors start again from the first point */
+        eraseCount_++;
+        memset(pTimestamps_, 0, maxPoints_ * sizeof(double));
+        timestampOffset_ = 0.;
+        lastTimestamp_ = 0.;
+        setDoubleParam(fastSweepTotalPoints_, totalPoints_);
         /* Reset the elapsed time */
         elapsedTime_ = 0;
         setDoubleParam(mcaElapsedRealTime_, elapsedTime_);
         epicsTimeGetCurrent(&startTime_);
     }
     else if (command == mcaNumChannels_) {
-        if ((value < 1) || (value > maxPoints_))
+        if ((value < 1) || (value > maxPoints_)) {
             status = asynError;
-        else
+        } else {
             numPoints_ = value;
+            /* The circular buffer starts again with the new size */
+            if (streamMode_) {
+                writeIndex_ = 0;
+                numAcquired_ = 0;
+            }
+        }
     }
     callParamCallbacks();
     return(status);
 }
 
+asynStatus drvFastSweep::readInt32(asynUser *pasynUser, epicsInt32 *value)
+{
+    mcaAppendCursor *pCursor;
+    size_t start;
+
+    if ((pasynUser->reason == mcaDataAppend_) || (pasynUser->reason == mcaTimestampsAppend_)) {
+        pCursor = appendCursor(pasynUser);
+        if (!pCursor) return(asynError);
+        appendPoints(pCursor, &start);
+        *value = (epicsInt32)pCursor->next;
+        return(asynSuccess);
+    }
+    return asynPortDriver::readInt32(pasynUser, value);
+}
+
 asynStatus drvFastSweep::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
 {
     int command = pasynUser->reason;
@@ -346,16 +953,97 @@ asynStatus drvFastSweep::readInt32Array(asynUser *pasynUser,
                                         epicsInt32 *data, size_t maxChans, 
                                         size_t *nactual)
 {
-    int signal;
+    return readArray(pasynUser, data, maxChans, nactual);
+}
+
+asynStatus drvFastSweep::readFloat64Array(asynUser *pasynUser,
+                                          epicsFloat64 *data, size_t maxChans,
+                                          size_t *nactual)
+{
+    return readArray(pasynUser, data, maxChans, nactual);
+}
+
+template <typename U>
+asynStatus drvFastSweep::readArray(asynUser *pasynUser,
+                                   U *data, size_t maxChans,
+                                   size_t *nactual)
+{
+    int addr, signal;
+    size_t stride, nchans, start;
+    mcaAppendCursor *pCursor;
 
-    getAddress(pasynUser, &signal);
-    memcpy(data, &pData_[maxPoints_*signal], 
-           numPoints_*sizeof(int));
-    *nactual = numAcquired_;
+    if (pasynUser->reason == mcaDataAll_) {
+        // All signals in one call, signal i starts at data[i*stride]
+        stride = maxChans/maxSignals_;
+        nchans = ((size_t)numPoints_ < stride) ? numPoints_ : stride;
+        start = newestPoints(nchans);
+        for (signal=0; signal<maxSignals_; signal++) {
+            copySignal(signal, &data[stride*signal], start, nchans);
+        }
+        *nactual = ((size_t)numAcquired_ < nchans) ? numAcquired_ : nchans;
+        return(asynSuccess);
+    }
+    getAddress(pasynUser, &addr);
+    if ((pasynUser->reason == mcaDataAppend_) || (pasynUser->reason == mcaTimestampsAppend_)) {
+        // Only the points since this asynUser's previous read
+        pCursor = appendCursor(pasynUser);
+        if (!pCursor) return(asynError);
+        nchans = appendPoints(pCursor, &start);
+        if (nchans > maxChans) nchans = maxChans;
+        if (pasynUser->reason == mcaTimestampsAppend_)
+            copyPoints(pTimestamps_, data, start, nchans);
+        else
+            copySignal(addr, data, start, nchans);
+        pCursor->next += nchans;
+        *nactual = nchans;
+        return(asynSuccess);
+    }
+    nchans = ((size_t)numPoints_ < maxChans) ? numPoints_ : maxChans;
+    /* In stream mode a short read gets the newest points */
+    start = newestPoints(nchans);
+    if (pasynUser->reason == mcaTimestamps_)
+        copyPoints(pTimestamps_, data, start, nchans);
+    else
+        copySignal(addr, data, start, nchans);
+    *nactual = ((size_t)numAcquired_ < nchans) ? numAcquired_ : nchans;
     return(asynSuccess);
 }
 
-
+
+/* Each asynUser connected to MCA_DATA_APPEND or MCA_TIMESTAMPS_APPEND gets its own cursor.
+ * The cursors are kept in appendCursors_, not in pasynUser->drvUser, because
+ * duplicateAsynUser copies drvUser.  A cursor is only made here and removed by
+ * drvUserDestroy, so the APPEND reads of an asynUser that was not connected
+ * with drvUserCreate, such as a duplicate, return asynError. */
+asynStatus drvFastSweep::drvUserCreate(asynUser *pasynUser, const char *drvInfo,
+                                       const char **pptypeName, size_t *psize)
+{
+    asynStatus status;
+
+    status = asynPortDriver::drvUserCreate(pasynUser, drvInfo, pptypeName, psize);
+    if ((status == asynSuccess) &&
+        ((pasynUser->reason == mcaDataAppend_) || (pasynUser->reason == mcaTimestampsAppend_))) {
+        appendCursors_[pasynUser] = mcaAppendCursor();
+    }
+    return(status);
+}
+
+asynStatus drvFastSweep::drvUserDestroy(asynUser *pasynUser)
+{
+    appendCursors_.erase(pasynUser);
+    return asynPortDriver::drvUserDestroy(pasynUser);
+}
+
+/* Returns the append cursor of an asynUser, NULL if drvUserCreate did not make one */
+mcaAppendCursor *drvFastSweep::appendCursor(asynUser *pasynUser)
+{
+    std::map<asynUser *, mcaAppendCursor>::iterator it = appendCursors_.find(pasynUser);
+
+    if (it == appendCursors_.end()) return NULL;
+    return &it->second;
+}
+
+
 /* Report  parameters */
 void drvFastSweep::report(FILE *fp, int details)
 {
@@ -365,6 +1053,14 @@ void drvFastSweep::report(FILE *fp, int details)
         fprintf(fp, "    maxPoints=%d, maxSignals=%d, numAverage=%d, numPoints=%d, "
                     "numAcquired=%d, elapsedTime=%f, acquring_=%d\n", 
                 maxPoints_, maxSignals_, numAverage_, numPoints_, numAcquired_, elapsedTime_, acquiring_);
+        fprintf(fp, "    streamMode=%d, totalPoints=%.0f, triggered=%d, postTrigger=%d\n",
+                streamMode_, totalPoints_, triggered_, postTrigger_);
+        fprintf(fp, "    streaming=%d, queued chunks=%d, lost points=%.0f\n",
+                streaming_, (int)(epicsAtomicGetSizeT(&streamHead_) - epicsAtomicGetSizeT(&streamTail_)),
+                streamLostPoints_);
+        fprintf(fp, "    ring size=%d, queued=%d, overflows=%d\n",
+                FAST_SWEEP_RING_SIZE, (int)(epicsAtomicGetSizeT(&ringHead_) - ringTail_),
+                (int)epicsAtomicGetSizeT(&ringOverflows_));
     }
     asynPortDriver::report(fp, details);
 }
@@ -372,9 +1068,11 @@ void drvFastSweep::report(FILE *fp, int details)
 extern "C" {
 int initFastSweep(const char *portName, const char *inputName, 
                   int maxSignals, int maxPoints, 
-                  const char *dataString, const char *intervalString)
+                  const char *dataString, const char *intervalString,
+                  int statistics, int float64Input)
 {
-    new drvFastSweep(portName, inputName, maxSignals, maxPoints, dataString, intervalString);
+    new drvFastSweep(portName, inputName, maxSignals, maxPoints, dataString, intervalString,
+                     statistics, float64Input);
     return asynSuccess;
 }
 
@@ -385,17 +1083,21 @@ static const iocshArg initSweepArg2 = { "maxSignals",iocshArgInt};
 static const iocshArg initSweepArg3 = { "maxPoints",iocshArgInt};
 static const iocshArg initSweepArg4 = { "dataString",iocshArgString};
 static const iocshArg initSweepArg5 = { "intervalString",iocshArgString};
-static const iocshArg * const initSweepArgs[6] = {&initSweepArg0,
+static const iocshArg initSweepArg6 = { "statistics",iocshArgInt};
+static const iocshArg initSweepArg7 = { "float64Input",iocshArgInt};
+static const iocshArg * const initSweepArgs[8] = {&initSweepArg0,
                                                   &initSweepArg1,
                                                   &initSweepArg2,
                                                   &initSweepArg3,
                                                   &initSweepArg4,
-                                                  &initSweepArg5};
-static const iocshFuncDef initSweepFuncDef = {"initFastSweep",6,initSweepArgs};
+                                                  &initSweepArg5,
+                                                  &initSweepArg6,
+                                                  &initSweepArg7};
+static const iocshFuncDef initSweepFuncDef = {"initFastSweep",8,initSweepArgs};
 static void initSweepCallFunc(const iocshArgBuf *args)
 {
     initFastSweep(args[0].sval, args[1].sval, args[2].ival, args[3].ival,
-                  args[4].sval, args[5].sval);
+                  args[4].sval, args[5].sval, args[6].ival, args[7].ival);
 }
 
 void fastSweepRegister(void)
@@ -4,7 +4,8 @@
  *
  * Purpose: 
  * This module provides the driver support for the MCA asyn device support layer
- * for fast sweep, i.e. drivers that do callbacks on asynInt32Array.
+ * for fast sweep, i.e. drivers that do callbacks on asynInt32Array or
+ * asynFloat64Array.
  *
  */
 
@@ -15,13 +16,49 @@
 /* Includes */
 /************/
 
+#include <map>
+
 /* EPICS includes */
 #include <asynPortDriver.h>
 #include <epicsEvent.h>
 #include <epicsTypes.h>
 
+#include <drvMca.h>
+
 #define fastSweepMaxChannelsString     "FAST_SWEEP_MAX_CHANNELS"
 #define fastSweepCurrentChannelString  "FAST_SWEEP_CURRENT_CHANNEL"
+#define fastSweepStreamModeString      "FAST_SWEEP_STREAM_MODE"
+#define fastSweepPostTriggerString     "FAST_SWEEP_POST_TRIGGER"
+#define fastSweepTriggerString         "FAST_SWEEP_TRIGGER"
+#define fastSweepStreamFileString      "FAST_SWEEP_STREAM_FILE"
+#define fastSweepTotalPointsString     "FAST_SWEEP_TOTAL_POINTS"
+
+/* With statistics enabled each signal s has 3 more addresses, whose arrays are
+ * the minimum, maximum and standard deviation of the samples averaged into
+ * each point. */
+enum fastSweepStatistic {
+    fastSweepMean,
+    fastSweepMin,
+    fastSweepMax,
+    fastSweepStdDev,
+    fastSweepNumStatistics
+};
+
+/* Number of sample sets in the ring between dataCallback and consumerThread.
+ * It must be a power of 2. */
+#define FAST_SWEEP_RING_SIZE 4096
+
+/* The ring of chunks of points waiting to be written to the stream file */
+#define FAST_SWEEP_STREAM_CHUNKS       16
+#define FAST_SWEEP_STREAM_CHUNK_POINTS 1024
+
+/* What the stream file writer does with a chunk */
+typedef enum {
+    fastSweepStreamOpen,      /* Open the file named in the chunk */
+    fastSweepStreamData,      /* Write the points in the chunk */
+    fastSweepStreamClose,     /* Write the points, then close the file */
+    fastSweepStreamOverflow   /* The same, after points were lost */
+} fastSweepStreamOp;
 
 
 class drvFastSweep : public asynPortDriver
@@ -29,19 +66,53 @@ class drvFastSweep : public asynPortDriver
   
   public:
   drvFastSweep(const char *portName, const char *inputName, 
-               int maxSignals, int maxPoints, const char *dataString, const char *intervalString);
+               int maxSignals, int maxPoints, const char *dataString, const char *intervalString,
+               int statistics=0, int float64Input=0);
 
   // These are the methods we override from asynPortDriver
   asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+  asynStatus readInt32(asynUser *pasynUser, epicsInt32 *value);
   asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
   asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *data, 
                             size_t maxChans, size_t *nactual);
+  asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *data,
+                              size_t maxChans, size_t *nactual);
+  asynStatus drvUserCreate(asynUser *pasynUser, const char *drvInfo,
+                           const char **pptypeName, size_t *psize);
+  asynStatus drvUserDestroy(asynUser *pasynUser);
   virtual void report(FILE *fp, int details);
 
   // These are the methods that are new to this class
   void intervalCallback(double seconds);
-  void dataCallback(epicsInt32 *newData, size_t nelem);
-  void nextPoint(int *newData);
+  void dataCallback(epicsInt32 *newData, size_t nelem, const epicsTimeStamp *pTime);
+  void dataCallback(epicsFloat64 *newData, size_t nelem, const epicsTimeStamp *pTime);
+  void consumerThread();
+  void streamWriterThread();
+  void drainRing();
+  template <typename T> void pushSample(const T *newData, size_t nelem, const epicsTimeStamp *pTime);
+  template <typename T> void processSample(T *newData, const epicsTimeStamp *pTime);
+  template <typename T> void nextPoint(T *newData, T *pBuffer, const epicsTimeStamp *pTime);
+  template <typename T, typename U> void copyPoints(const T *pSignal, U *dest,
+                                                    size_t start, size_t npoints);
+  template <typename U> asynStatus readArray(asynUser *pasynUser, U *data,
+                                             size_t maxChans, size_t *nactual);
+  template <typename U> void copySignal(int addr, U *dest, size_t start, size_t npoints);
+  template <typename T> void doAppendCallbacks(T *pBuffer);
+  mcaAppendCursor *appendCursor(asynUser *pasynUser);
+  size_t appendPoints(mcaAppendCursor *pCursor, size_t *start);
+  epicsInt32 *dataBuffer(const epicsInt32 *) { return pData_; }
+  epicsFloat64 *dataBuffer(const epicsFloat64 *) { return pDataFloat64_; }
+  void appendCallback(epicsInt32 *pChunk, size_t n, int signal)
+    { doCallbacksInt32Array(pChunk, n, mcaDataAppend_, signal); }
+  void appendCallback(epicsFloat64 *pChunk, size_t n, int signal)
+    { doCallbacksFloat64Array(pChunk, n, mcaDataAppend_, signal); }
+  void resetAverage();
+  void resetStatistics();
+  size_t newestPoints(size_t npoints);
+  void openStreamFile();
+  void streamPoint(const void *newData);
+  void queueStreamChunk(fastSweepStreamOp op);
+  void endStream(fastSweepStreamOp op);
   void computeNumAverage();
   void stopAcquire();
   
@@ -68,9 +139,18 @@ class drvFastSweep : public asynPortDriver
   int mcaElapsedLiveTime_;
   int mcaElapsedRealTime_;
   int mcaElapsedCounts_;
+  int mcaDataAll_;
+  int mcaDataAppend_;
+  int mcaTimestamps_;
+  int mcaTimestampsAppend_;
   int fastSweepMaxChannels_;
   int fastSweepCurrentChannel_;
-  #define LAST_FAST_SWEEP_PARAM fastSweepCurrentChannel_
+  int fastSweepStreamMode_;
+  int fastSweepPostTrigger_;
+  int fastSweepTrigger_;
+  int fastSweepStreamFile_;
+  int fastSweepTotalPoints_;
+  #define LAST_FAST_SWEEP_PARAM fastSweepTotalPoints_
 
   private:
   char *inputName_;
@@ -86,15 +166,58 @@ class drvFastSweep : public asynPortDriver
   double dwellTime_;
   epicsTimeStamp startTime_;
   double callbackInterval_;
-  int *pData_;
+  int float64Input_;
+  int *pData_;              /* Points from an asynInt32Array input */
+  epicsFloat64 *pDataFloat64_;  /* Points from an asynFloat64Array input */
   int numAverage_;
   int accumulated_;
   double *pAverageStore_;
+  int statistics_;
+  double *pStatMean_;       /* Welford accumulators for the current point */
+  double *pStatM2_;
+  double *pStatMin_;
+  double *pStatMax_;
+  double *pStats_;          /* [statistic-1][signal][point] */
   bool erased_;
+  int streamMode_;
+  int writeIndex_;          /* Next point in pData_ in stream mode */
+  int postTrigger_;
+  int postRemaining_;
+  int triggered_;
+  double totalPoints_;
+  bool streaming_;          /* Points are being queued for the stream file */
+  bool streamOverflow_;     /* The writer fell behind and the stream was ended */
+  double streamLostPoints_; /* Points not written to the stream file since it overflowed */
+  bool callbacksPending_;
+  int eraseCount_;
+  mcaAppendCursor appendCallbackCursor_;  /* Points already sent in append callbacks */
+  std::map<asynUser *, mcaAppendCursor> appendCursors_;  /* Each APPEND reader's cursor */
+  char *pAppendChunk_;      /* One signal's new points for the append callbacks */
+  double *pTimestamps_;     /* Time of each point, same index as the signals */
+  double timestampOffset_;  /* Acquisition time before the current start */
+  double lastTimestamp_;
+  epicsTimeStamp lastCallbackTime_;
+  char *pRing_;
+  epicsTimeStamp *pRingTime_;  /* Time of each sample set in the ring */
+  size_t ringSlotSize_;     /* Bytes in one sample set */
+  size_t ringHead_;         /* Only written by dataCallback */
+  size_t ringTail_;         /* Only written with the lock held */
+  size_t ringOverflows_;
+  epicsEventId ringEvent_;
+  char *pStreamChunks_;     /* FAST_SWEEP_STREAM_CHUNKS chunks of FAST_SWEEP_STREAM_CHUNK_POINTS points */
+  fastSweepStreamOp streamOps_[FAST_SWEEP_STREAM_CHUNKS];
+  size_t streamBytes_[FAST_SWEEP_STREAM_CHUNKS];
+  size_t streamFill_;       /* Points in the chunk at streamHead_ */
+  size_t streamHead_;       /* Only written with the lock held */
+  size_t streamTail_;       /* Only written by streamWriterThread */
+  epicsEventId streamEvent_;
   asynUser *pasynUserInt32Array_;
   asynInt32Array *pint32Array_;
   void *int32ArrayRegistrarPvt_;
   void *int32ArrayPvt_;
+  asynFloat64Array *pfloat64Array_;
+  void *float64ArrayRegistrarPvt_;
+  void *float64ArrayPvt_;
   asynUser *pasynUserFloat64_;
   asynUser *pasynUserFloat64SyncIO_;
   void *float64RegistrarPvt_;
@@ -3,6 +3,8 @@
 #ifndef drvMcaH
 #define drvMcaH
 
+#include <stddef.h>
+
 /* Note, these enums must agree with the MCA record.  We define them here
  * for drivers that should not know about the MCA record. */
 enum MCAAcquireMode {
@@ -37,5 +39,28 @@ enum MCAChannelAdvanceSource {
 #define mcaElapsedLiveTimeString        "MCA_ELAPSED_LIVE"  /* float64, read */
 #define mcaElapsedRealTimeString        "MCA_ELAPSED_REAL"  /* float64, read */
 #define mcaElapsedCountsString          "MCA_ELAPSED_COUNTS" /* float64, read */
+/* Optional.  Read as int32Array it returns the spectra for all signals on the
+ * port in one call: signal s starts at element s*(nElements/numSignals), and
+ * nIn is the number of channels in each.  Read as int32 it returns numSignals. */
+#define mcaDataAllString                "MCA_DATA_ALL"      /* int32Array/int32, read */
+/* Optional.  Each asynUser connected with this drvInfo has its own cursor.
+ * Read as int32Array it returns only the channels of the signal acquired since
+ * that asynUser's previous read, and advances the cursor past them.  Read as
+ * int32 it returns the cursor, i.e. the channel the next chunk starts at; it
+ * goes back to 0 when the data are erased.  The driver also does array
+ * callbacks on this reason with each new chunk. */
+#define mcaDataAppendString             "MCA_DATA_APPEND"   /* int32Array/int32, read */
+
+/* Optional.  The time of each channel as float64Array, in seconds of
+ * acquisition since the data were erased, at the end of the channel.  It is
+ * the same for all signals.  The APPEND form works like mcaDataAppendString. */
+#define mcaTimestampsString             "MCA_TIMESTAMPS"    /* float64Array, read */
+#define mcaTimestampsAppendString       "MCA_TIMESTAMPS_APPEND" /* float64Array/int32, read */
+
+/* The per-asynUser cursor for mcaDataAppendString, kept by the driver for each asynUser */
+typedef struct {
+    size_t next;        /* Next channel to return */
+    int eraseCount;     /* Driver's erase count when next was set */
+} mcaAppendCursor;
 
 #endif /* drvMcaH */
@@ -0,0 +1,564 @@
+/*  drvMcaSum.cpp
+
+    These routines implement the asynMca interface for the sum of several
+    detector elements.  Each read of the sum, or of its status, reads the
+    spectrum for the data string, MCA_DATA by default, and the status of each
+    element port, with that port locked, so the element drivers do not need to
+    do callbacks.  The sum is computed once per read, as the sum of the
+    spectra, like the mcaSum_do summing record does.  It is kept in 64 bits and
+    clamped to the range of epicsInt32 when it is read.  The cumulative sum for
+    the ROIs is built in the same pass, and the ROIs, status and MCA_DATA
+    callbacks are done once per read.
+
+    The sum is acquiring while any element is acquiring.  Start, stop and erase
+    on the sum port are passed on to all of the elements, so either the sum or
+    the elements can be started.  The elapsed live and real times are the sums
+    of the times of the elements, so their ratio is the live time fraction of
+    the sum.  The live and real time presets are compared with these sums, so
+    with N elements a preset of N*t stops the elements after about t seconds.
+    When a preset is reached the elements are stopped.
+*/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsString.h>
+#include <errlog.h>
+#include <iocsh.h>
+#include <cantProceed.h>
+
+#include <asynInt32.h>
+#include <asynFloat64.h>
+#include <asynInt32Array.h>
+
+#include <drvMca.h>
+#include <mcaRoi.h>
+
+#include <drvMcaSum.h>
+#include <epicsExport.h>
+
+static const char *driverName = "drvMcaSum";
+
+#define MAX_INPUT_NAME 80
+
+/* The commands used on the inputs.  inputData uses the data string */
+typedef enum {
+    inputData,
+    inputStartAcquire,
+    inputStopAcquire,
+    inputErase,
+    inputReadStatus,
+    inputAcquiring,
+    inputElapsedLive,
+    inputElapsedReal,
+    NUM_INPUT_COMMANDS
+} mcaSumInputCommand;
+
+static const char *inputCommandStrings[NUM_INPUT_COMMANDS] = {
+    NULL,
+    mcaStartAcquireString,
+    mcaStopAcquireString,
+    mcaEraseString,
+    mcaReadStatusString,
+    mcaAcquiringString,
+    mcaElapsedLiveTimeString,
+    mcaElapsedRealTimeString
+};
+
+struct mcaSumInput {
+    char portName[MAX_INPUT_NAME];
+    int addr;
+    int connected;
+    asynUser *pasynUser;
+    asynInt32 *pint32;
+    void *int32Pvt;
+    asynFloat64 *pfloat64;
+    void *float64Pvt;
+    asynInt32Array *pint32Array;
+    void *int32ArrayPvt;
+    int reasons[NUM_INPUT_COMMANDS];
+    epicsInt32 *pData;      /* Spectrum at the latest read */
+    int nelem;              /* Number of channels in pData */
+    epicsInt32 acquiring;
+    double liveTime;
+    double realTime;
+};
+
+/* Splits "PORT" or "PORT:addr" into the port name and address */
+static void parseInput(const char *item, char *portName, int *addr)
+{
+    const char *pcolon = strrchr(item, ':');
+    char *pend;
+    long value;
+
+    strncpy(portName, item, MAX_INPUT_NAME-1);
+    portName[MAX_INPUT_NAME-1] = 0;
+    *addr = 0;
+    if (!pcolon || (pcolon[1] == 0)) return;
+    value = strtol(pcolon+1, &pend, 10);
+    if (*pend != 0) return;
+    if (pcolon - item < MAX_INPUT_NAME) portName[pcolon - item] = 0;
+    *addr = (int)value;
+}
+
+
+drvMcaSum::drvMcaSum(const char *portName, const char *inputList,
+                     int maxChannels, int maxROIs, const char *dataString)
+   : asynPortDriver(portName,
+                    (maxROIs > 1) ? maxROIs : 1,
+                    NUM_MCA_SUM_PARAMS,
+                    asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynDrvUserMask, /* Interface mask */
+                    asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask,                   /* Interrupt mask */
+                    ASYN_MULTIDEVICE, /* asynFlags.  This driver does not block and it is multi-device */
+                    1, /* Autoconnect */
+                    0, /* Default priority */
+                    0) /* Default stack size*/
+{
+    const char *functionName = "drvMcaSum";
+
+    asynStatus status;
+    asynInterface *pasynInterface;
+    asynDrvUser *pdrvUser;
+    void *drvUserPvt;
+    const char *drvInfo;
+    mcaSumInput *pInput;
+    char *list, *item, *last;
+    int i, j;
+
+    createParam(mcaStartAcquireString,                asynParamInt32, &mcaStartAcquire_);           /* int32, write */
+    createParam(mcaStopAcquireString,                 asynParamInt32, &mcaStopAcquire_);            /* int32, write */
+    createParam(mcaEraseString,                       asynParamInt32, &mcaErase_);                  /* int32, write */
+    createParam(mcaDataString,                        asynParamInt32, &mcaData_);                   /* int32Array, read/write */
+    createParam(mcaReadStatusString,                  asynParamInt32, &mcaReadStatus_);             /* int32, write */
+    createParam(mcaChannelAdvanceSourceString,        asynParamInt32, &mcaChannelAdvanceSource_);   /* int32, write */
+    createParam(mcaNumChannelsString,                 asynParamInt32, &mcaNumChannels_);            /* int32, write */
+    createParam(mcaDwellTimeString,                 asynParamFloat64, &mcaDwellTime_);              /* float64, write */
+    createParam(mcaPresetLiveTimeString,            asynParamFloat64, &mcaPresetLiveTime_);         /* float64, write */
+    createParam(mcaPresetRealTimeString,            asynParamFloat64, &mcaPresetRealTime_);         /* float64, write */
+    createParam(mcaPresetCountsString,              asynParamFloat64, &mcaPresetCounts_);           /* float64, write */
+    createParam(mcaPresetLowChannelString,            asynParamInt32, &mcaPresetLowChannel_);       /* int32, write */
+    createParam(mcaPresetHighChannelString,           asynParamInt32, &mcaPresetHighChannel_);      /* int32, write */
+    createParam(mcaPresetSweepsString,                asynParamInt32, &mcaPresetSweeps_);           /* int32, write */
+    createParam(mcaAcquireModeString,                 asynParamInt32, &mcaAcquireMode_);            /* int32, write */
+    createParam(mcaSequenceString,                    asynParamInt32, &mcaSequence_);               /* int32, write */
+    createParam(mcaPrescaleString,                    asynParamInt32, &mcaPrescale_);               /* int32, write */
+    createParam(mcaAcquiringString,                   asynParamInt32, &mcaAcquiring_);              /* int32, read */
+    createParam(mcaElapsedLiveTimeString,           asynParamFloat64, &mcaElapsedLiveTime_);        /* float64, read */
+    createParam(mcaElapsedRealTimeString,           asynParamFloat64, &mcaElapsedRealTime_);        /* float64, read */
+    createParam(mcaElapsedCountsString,             asynParamFloat64, &mcaElapsedCounts_);          /* float64, read */
+    createParam(mcaSumNumInputsString,                asynParamInt32, &mcaSumNumInputs_);           /* int32, read */
+    createParam(mcaSumRoiLowString,                   asynParamInt32, &mcaSumRoiLow_);              /* int32, write */
+    createParam(mcaSumRoiHighString,                  asynParamInt32, &mcaSumRoiHigh_);             /* int32, write */
+    createParam(mcaSumRoiBgString,                    asynParamInt32, &mcaSumRoiBg_);               /* int32, write */
+    createParam(mcaSumRoiCountsString,              asynParamFloat64, &mcaSumRoiCounts_);           /* float64, read */
+    createParam(mcaSumRoiNetString,                 asynParamFloat64, &mcaSumRoiNet_);              /* float64, read */
+
+    maxChannels_ = (maxChannels > 0) ? maxChannels : 1;
+    maxROIs_ = (maxROIs > 1) ? maxROIs : 1;
+    numChannels_ = maxChannels_;
+    numInputs_ = 0;
+    numConnected_ = 0;
+    acquiring_ = 0;
+    presetLive_ = 0.;
+    presetReal_ = 0.;
+    presetCounts_ = 0.;
+    presetLow_ = 0;
+    presetHigh_ = 0;
+    liveTime_ = 0.;
+    realTime_ = 0.;
+    inputList_ = epicsStrDup(inputList ? inputList : "");
+    if ((dataString != NULL) && (strlen(dataString) != 0)) {
+        dataString_ = epicsStrDup(dataString);
+    } else {
+        dataString_ = epicsStrDup(mcaDataString);
+    }
+    for (i=0; i<maxROIs_; i++) {
+        setIntegerParam(i, mcaSumRoiLow_, -1);
+        setIntegerParam(i, mcaSumRoiHigh_, -1);
+        setIntegerParam(i, mcaSumRoiBg_, -1);
+        setDoubleParam(i, mcaSumRoiCounts_, 0.);
+        setDoubleParam(i, mcaSumRoiNet_, 0.);
+    }
+    setIntegerParam(mcaAcquiring_, 0);
+    setDoubleParam(mcaElapsedLiveTime_, 0.);
+    setDoubleParam(mcaElapsedRealTime_, 0.);
+    setDoubleParam(mcaElapsedCounts_, 0.);
+
+    pSum_ = (epicsInt64 *)callocMustSucceed(maxChannels_, sizeof(epicsInt64), "drvMcaSum");
+    pSumOut_ = (epicsInt32 *)callocMustSucceed(maxChannels_, sizeof(epicsInt32), "drvMcaSum");
+    pCsum_ = (double *)callocMustSucceed(maxChannels_+1, sizeof(double), "drvMcaSum");
+
+    /* The inputs are separated by spaces or commas */
+    list = epicsStrDup(inputList_);
+    for (item = epicsStrtok_r(list, " ,", &last); item; item = epicsStrtok_r(NULL, " ,", &last))
+        numInputs_++;
+    free(list);
+    pInputs_ = (mcaSumInput *)callocMustSucceed(numInputs_ ? numInputs_ : 1,
+                                                sizeof(mcaSumInput), "drvMcaSum");
+    setIntegerParam(mcaSumNumInputs_, numInputs_);
+
+    list = epicsStrDup(inputList_);
+    i = 0;
+    for (item = epicsStrtok_r(list, " ,", &last); item; item = epicsStrtok_r(NULL, " ,", &last)) {
+        pInput = &pInputs_[i++];
+        parseInput(item, pInput->portName, &pInput->addr);
+        pInput->pData = (epicsInt32 *)callocMustSucceed(maxChannels_, sizeof(epicsInt32), "drvMcaSum");
+
+        // Connect to the input driver
+        pInput->pasynUser = pasynManager->createAsynUser(0,0);
+        status = pasynManager->connectDevice(pInput->pasynUser, pInput->portName, pInput->addr);
+        if (status != asynSuccess) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s:, connectDevice failed for input %s\n",
+                      driverName, functionName, item);
+            continue;
+        }
+        /* Get the asynDrvUser interface */
+        pasynInterface = pasynManager->findInterface(pInput->pasynUser,
+                                                     asynDrvUserType, 1);
+        if (!pasynInterface) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s:, find asynDrvUser"
+                      " interface failed for input %s\n",
+                      driverName, functionName, item);
+            continue;
+        }
+        pdrvUser = (asynDrvUser *)pasynInterface->pinterface;
+        drvUserPvt = pasynInterface->drvPvt;
+        /* Look up the reason for each command */
+        for (j=0; j<NUM_INPUT_COMMANDS; j++) {
+            drvInfo = (j == inputData) ? dataString_ : inputCommandStrings[j];
+            status = pdrvUser->create(drvUserPvt, pInput->pasynUser, drvInfo, NULL, NULL);
+            if (status) {
+                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s:%s:, error in drvUser for %s, input %s\n",
+                          driverName, functionName, drvInfo, item);
+                break;
+            }
+            pInput->reasons[j] = pInput->pasynUser->reason;
+        }
+        if (j < NUM_INPUT_COMMANDS) continue;
+
+        /* Get the asynInt32, asynFloat64 and asynInt32Array interfaces */
+        pasynInterface = pasynManager->findInterface(pInput->pasynUser,
+                                                     asynInt32Type, 1);
+        if (!pasynInterface) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s:, find asynInt32 interface failed"
+                      " for input %s\n",
+                      driverName, functionName, item);
+            continue;
+        }
+        pInput->pint32 = (asynInt32 *)pasynInterface->pinterface;
+        pInput->int32Pvt = pasynInterface->drvPvt;
+        pasynInterface = pasynManager->findInterface(pInput->pasynUser,
+                                                     asynFloat64Type, 1);
+        if (!pasynInterface) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s:, find asynFloat64 interface failed"
+                      " for input %s\n",
+                      driverName, functionName, item);
+            continue;
+        }
+        pInput->pfloat64 = (asynFloat64 *)pasynInterface->pinterface;
+        pInput->float64Pvt = pasynInterface->drvPvt;
+        pasynInterface = pasynManager->findInterface(pInput->pasynUser,
+                                                     asynInt32ArrayType, 1);
+        if (!pasynInterface) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                      "%s:%s:, find asynInt32Array interface failed"
+                      " for input %s\n",
+                      driverName, functionName, item);
+            continue;
+        }
+        pInput->pint32Array = (asynInt32Array *)pasynInterface->pinterface;
+        pInput->int32ArrayPvt = pasynInterface->drvPvt;
+        pInput->connected = 1;
+        numConnected_++;
+    }
+    free(list);
+    callParamCallbacks();
+}
+
+/* Reads the spectrum and status of each input.  Called with the lock held.
+ * Each input port is locked while it is read, so an input which can block is
+ * waited for.  The sum port is never locked from an input, so this cannot
+ * deadlock, and sum ports can be cascaded. */
+void drvMcaSum::readInputs()
+{
+    mcaSumInput *pInput;
+    asynUser *pasynUser;
+    size_t nread;
+    int j, n;
+
+    for (j=0; j<numInputs_; j++) {
+        pInput = &pInputs_[j];
+        if (!pInput->connected) continue;
+        pasynUser = pInput->pasynUser;
+        if (pasynManager->lockPort(pasynUser) != asynSuccess) continue;
+        pasynUser->reason = pInput->reasons[inputReadStatus];
+        pInput->pint32->write(pInput->int32Pvt, pasynUser, 0);
+        pasynUser->reason = pInput->reasons[inputAcquiring];
+        pInput->pint32->read(pInput->int32Pvt, pasynUser, &pInput->acquiring);
+        pasynUser->reason = pInput->reasons[inputElapsedLive];
+        pInput->pfloat64->read(pInput->float64Pvt, pasynUser, &pInput->liveTime);
+        pasynUser->reason = pInput->reasons[inputElapsedReal];
+        pInput->pfloat64->read(pInput->float64Pvt, pasynUser, &pInput->realTime);
+        pasynUser->reason = pInput->reasons[inputData];
+        if (pInput->pint32Array->read(pInput->int32ArrayPvt, pasynUser, pInput->pData,
+                                      maxChannels_, &nread) != asynSuccess) nread = 0;
+        pasynManager->unlockPort(pasynUser);
+        n = ((size_t)maxChannels_ < nread) ? maxChannels_ : (int)nread;
+        if (n < pInput->nelem) memset(&pInput->pData[n], 0, (pInput->nelem-n)*sizeof(epicsInt32));
+        pInput->nelem = n;
+    }
+}
+
+/* Writes a command to each input.  Called with the lock held. */
+void drvMcaSum::writeInputs(int command)
+{
+    mcaSumInput *pInput;
+    int j;
+
+    for (j=0; j<numInputs_; j++) {
+        pInput = &pInputs_[j];
+        if (!pInput->connected) continue;
+        if (pasynManager->lockPort(pInput->pasynUser) != asynSuccess) continue;
+        pInput->pasynUser->reason = pInput->reasons[command];
+        pInput->pint32->write(pInput->int32Pvt, pInput->pasynUser, 1);
+        pasynManager->unlockPort(pInput->pasynUser);
+    }
+}
+
+/* Reads the inputs and sums their spectra and times.  Called with the lock
+ * held. */
+void drvMcaSum::sumInputs()
+{
+    epicsInt64 *pSum = pSum_;
+    double *pCsum = pCsum_;
+    const epicsInt32 *pData;
+    int i, j, n;
+
+    readInputs();
+    acquiring_ = 0;
+    liveTime_ = 0.;
+    realTime_ = 0.;
+    memset(pSum, 0, numChannels_*sizeof(epicsInt64));
+    for (j=0; j<numInputs_; j++) {
+        if (!pInputs_[j].connected) continue;
+        if (pInputs_[j].acquiring) acquiring_ = 1;
+        liveTime_ += pInputs_[j].liveTime;
+        realTime_ += pInputs_[j].realTime;
+        pData = pInputs_[j].pData;
+        n = (pInputs_[j].nelem < numChannels_) ? pInputs_[j].nelem : numChannels_;
+        for (i=0; i<n; i++) pSum[i] += pData[i];
+    }
+    for (i=0; i<numChannels_; i++) {
+        pCsum[i+1] = pCsum[i] + (double)pSum[i];
+        if (pSum[i] > 0x7fffffff)        pSumOut_[i] = 0x7fffffff;
+        else if (pSum[i] < -0x7fffffff)  pSumOut_[i] = -0x7fffffff;
+        else                             pSumOut_[i] = (epicsInt32)pSum[i];
+    }
+    setIntegerParam(mcaAcquiring_, acquiring_);
+    computeROIs();
+    updateStatus();
+    doCallbacksInt32Array(pSumOut_, numChannels_, mcaData_, 0);
+}
+
+/* Updates the ROI parameters from the cumulative sum.  Called with the lock held. */
+void drvMcaSum::computeROIs()
+{
+    mcaRoiResult result;
+    int i, lo, hi, nbg;
+
+    for (i=0; i<maxROIs_; i++) {
+        getIntegerParam(i, mcaSumRoiLow_, &lo);
+        getIntegerParam(i, mcaSumRoiHigh_, &hi);
+        getIntegerParam(i, mcaSumRoiBg_, &nbg);
+        if (mcaRoiCompute(pCsum_, numChannels_-1, lo, hi, nbg, &result)) {
+            result.sum = 0.;
+            result.net = 0.;
+        }
+        setDoubleParam(i, mcaSumRoiCounts_, result.sum);
+        setDoubleParam(i, mcaSumRoiNet_, result.net);
+        callParamCallbacks(i);
+    }
+}
+
+/* Updates the elapsed times and counts and checks the presets.  Called with
+ * the lock held. */
+void drvMcaSum::updateStatus()
+{
+    int lo = presetLow_, hi = presetHigh_;
+    double counts;
+
+    if ((hi <= lo) || (hi >= numChannels_)) hi = numChannels_-1;
+    if ((lo < 0) || (lo > hi)) lo = 0;
+    counts = MCA_ROI_RANGE_SUM(pCsum_, lo, hi);
+    if (acquiring_) {
+        if (((presetLive_ > 0) && (liveTime_ >= presetLive_)) ||
+            ((presetReal_ > 0) && (realTime_ >= presetReal_)) ||
+            ((presetCounts_ > 0) && (counts >= presetCounts_))) stopAcquire();
+    }
+    setDoubleParam(mcaElapsedRealTime_, realTime_);
+    setDoubleParam(mcaElapsedLiveTime_, liveTime_);
+    setDoubleParam(mcaElapsedCounts_, MCA_ROI_RANGE_SUM(pCsum_, 0, numChannels_-1));
+    callParamCallbacks();
+}
+
+/* Stops the inputs.  Called with the lock held. */
+void drvMcaSum::stopAcquire()
+{
+    writeInputs(inputStopAcquire);
+    acquiring_ = 0;
+    setIntegerParam(mcaAcquiring_, acquiring_);
+}
+
+asynStatus drvMcaSum::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int command = pasynUser->reason;
+    int addr, i;
+    asynStatus status=asynSuccess;
+
+    getAddress(pasynUser, &addr);
+    /* Set the parameter in the parameter library. */
+    status = setIntegerParam(addr, command, value);
+    if (command == mcaStartAcquire_) {
+        /* The next read of the inputs shows whether they started */
+        writeInputs(inputStartAcquire);
+        acquiring_ = 1;
+        setIntegerParam(mcaAcquiring_, acquiring_);
+    }
+    else if (command == mcaStopAcquire_) {
+        stopAcquire();
+    }
+    else if (command == mcaErase_) {
+        writeInputs(inputErase);
+        memset(pSum_, 0, maxChannels_ * sizeof(epicsInt64));
+        memset(pSumOut_, 0, maxChannels_ * sizeof(epicsInt32));
+        memset(pCsum_, 0, (maxChannels_+1) * sizeof(double));
+        liveTime_ = 0.;
+        realTime_ = 0.;
+        computeROIs();
+        updateStatus();
+    }
+    else if (command == mcaReadStatus_) {
+        sumInputs();
+    }
+    else if (command == mcaNumChannels_) {
+        if ((value < 1) || (value > maxChannels_)) {
+            status = asynError;
+        } else {
+            numChannels_ = value;
+            for (i=0; i<numChannels_; i++) pCsum_[i+1] = pCsum_[i] + (double)pSum_[i];
+            computeROIs();
+        }
+    }
+    else if (command == mcaPresetLowChannel_) {
+        presetLow_ = value;
+    }
+    else if (command == mcaPresetHighChannel_) {
+        presetHigh_ = value;
+    }
+    else if ((command == mcaSumRoiLow_) || (command == mcaSumRoiHigh_) ||
+             (command == mcaSumRoiBg_)) {
+        computeROIs();
+    }
+    callParamCallbacks(addr);
+    return(status);
+}
+
+asynStatus drvMcaSum::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int command = pasynUser->reason;
+    asynStatus status=asynSuccess;
+
+    /* Set the parameter in the parameter library. */
+    status = setDoubleParam(command, value);
+    if (command == mcaPresetLiveTime_) {
+        presetLive_ = value;
+    }
+    else if (command == mcaPresetRealTime_) {
+        presetReal_ = value;
+    }
+    else if (command == mcaPresetCounts_) {
+        presetCounts_ = value;
+    }
+    callParamCallbacks();
+    return(status);
+}
+
+asynStatus drvMcaSum::readInt32Array(asynUser *pasynUser,
+                                     epicsInt32 *data, size_t maxChans,
+                                     size_t *nactual)
+{
+    size_t nchans = ((size_t)numChannels_ < maxChans) ? numChannels_ : maxChans;
+
+    if (pasynUser->reason != mcaData_) return(asynError);
+    sumInputs();
+    memcpy(data, pSumOut_, nchans*sizeof(epicsInt32));
+    *nactual = nchans;
+    return(asynSuccess);
+}
+
+
+/* Report  parameters */
+void drvMcaSum::report(FILE *fp, int details)
+{
+    int i;
+
+    fprintf(fp, "mcaSum %s: inputs=%s\n", portName, inputList_);
+    if (details >= 1) {
+        fprintf(fp, "    maxChannels=%d, numChannels=%d, maxROIs=%d, numInputs=%d, "
+                    "numConnected=%d, liveTime=%f, realTime=%f, acquiring=%d\n",
+                maxChannels_, numChannels_, maxROIs_, numInputs_, numConnected_,
+                liveTime_, realTime_, acquiring_);
+        for (i=0; i<numInputs_; i++) {
+            fprintf(fp, "    input %d: port=%s, addr=%d, %s, nelem=%d, acquiring=%d, "
+                        "liveTime=%f, realTime=%f\n", i,
+                    pInputs_[i].portName, pInputs_[i].addr,
+                    pInputs_[i].connected ? "connected" : "not connected",
+                    pInputs_[i].nelem, pInputs_[i].acquiring,
+                    pInputs_[i].liveTime, pInputs_[i].realTime);
+        }
+    }
+    asynPortDriver::report(fp, details);
+}
+
+extern "C" {
+int initMcaSum(const char *portName, const char *inputList,
+               int maxChannels, int maxROIs, const char *dataString)
+{
+    new drvMcaSum(portName, inputList, maxChannels, maxROIs, dataString);
+    return asynSuccess;
+}
+
+
+static const iocshArg initMcaSumArg0 = { "portName",iocshArgString};
+static const iocshArg initMcaSumArg1 = { "inputList",iocshArgString};
+static const iocshArg initMcaSumArg2 = { "maxChannels",iocshArgInt};
+static const iocshArg initMcaSumArg3 = { "maxROIs",iocshArgInt};
+static const iocshArg initMcaSumArg4 = { "dataString",iocshArgString};
+static const iocshArg * const initMcaSumArgs[5] = {&initMcaSumArg0,
+                                                   &initMcaSumArg1,
+                                                   &initMcaSumArg2,
+                                                   &initMcaSumArg3,
+                                                   &initMcaSumArg4};
+static const iocshFuncDef initMcaSumFuncDef = {"initMcaSum",5,initMcaSumArgs};
+static void initMcaSumCallFunc(const iocshArgBuf *args)
+{
+    initMcaSum(args[0].sval, args[1].sval, args[2].ival, args[3].ival,
+               args[4].sval);
+}
+
+void mcaSumDriverRegister(void)
+{
+    iocshRegister(&initMcaSumFuncDef,initMcaSumCallFunc);
+}
+
+epicsExportRegistrar(mcaSumDriverRegister);
+
+}
@@ -0,0 +1,109 @@
+/* File:    drvMcaSum.h
+ *
+ * Purpose:
+ * This module provides the driver support for the MCA asyn device support layer
+ * for the sum of the spectra of several detector elements.  It reads the
+ * spectra and status of the element ports itself, keeps the summed spectrum
+ * and the counts in a set of ROIs, and is read by devMcaAsyn like any other
+ * MCA port, so no mca records or summing records are needed for the elements.
+ *
+ */
+
+#ifndef DRVMCASUM_H
+#define DRVMCASUM_H
+
+/************/
+/* Includes */
+/************/
+
+/* EPICS includes */
+#include <asynPortDriver.h>
+#include <epicsTypes.h>
+
+#define mcaSumNumInputsString   "MCA_SUM_NUM_INPUTS"    /* int32, read */
+#define mcaSumRoiLowString      "MCA_SUM_ROI_LOW"       /* int32, write, addr=ROI */
+#define mcaSumRoiHighString     "MCA_SUM_ROI_HIGH"      /* int32, write, addr=ROI */
+#define mcaSumRoiBgString       "MCA_SUM_ROI_BG"        /* int32, write, addr=ROI */
+#define mcaSumRoiCountsString   "MCA_SUM_ROI_COUNTS"    /* float64, read, addr=ROI */
+#define mcaSumRoiNetString      "MCA_SUM_ROI_NET"       /* float64, read, addr=ROI */
+
+struct mcaSumInput;
+
+class drvMcaSum : public asynPortDriver
+{
+
+  public:
+  drvMcaSum(const char *portName, const char *inputList,
+            int maxChannels, int maxROIs, const char *dataString);
+
+  // These are the methods we override from asynPortDriver
+  asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+  asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+  asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *data,
+                            size_t maxChans, size_t *nactual);
+  virtual void report(FILE *fp, int details);
+
+  // These are the methods that are new to this class
+  void readInputs();
+  void writeInputs(int command);
+  void sumInputs();
+  void computeROIs();
+  void updateStatus();
+  void stopAcquire();
+
+  protected:
+  #define FIRST_MCA_SUM_PARAM mcaStartAcquire_
+  int mcaStartAcquire_;
+  int mcaStopAcquire_;
+  int mcaErase_;
+  int mcaData_;
+  int mcaReadStatus_;
+  int mcaChannelAdvanceSource_;
+  int mcaNumChannels_;
+  int mcaDwellTime_;
+  int mcaPresetLiveTime_;
+  int mcaPresetRealTime_;
+  int mcaPresetCounts_;
+  int mcaPresetLowChannel_;
+  int mcaPresetHighChannel_;
+  int mcaPresetSweeps_;
+  int mcaAcquireMode_;
+  int mcaSequence_;
+  int mcaPrescale_;
+  int mcaAcquiring_;
+  int mcaElapsedLiveTime_;
+  int mcaElapsedRealTime_;
+  int mcaElapsedCounts_;
+  int mcaSumNumInputs_;
+  int mcaSumRoiLow_;
+  int mcaSumRoiHigh_;
+  int mcaSumRoiBg_;
+  int mcaSumRoiCounts_;
+  int mcaSumRoiNet_;
+  #define LAST_MCA_SUM_PARAM mcaSumRoiNet_
+
+  private:
+  char *inputList_;
+  char *dataString_;
+  int maxChannels_;
+  int maxROIs_;
+  int numChannels_;
+  int numInputs_;
+  int numConnected_;
+  int acquiring_;         /* Set if any input is acquiring */
+  double presetLive_;
+  double presetReal_;
+  double presetCounts_;
+  int presetLow_;
+  int presetHigh_;
+  double liveTime_;       /* Sum of the elapsed live times of the inputs */
+  double realTime_;       /* Sum of the elapsed real times of the inputs */
+  epicsInt64 *pSum_;      /* The sum, which can exceed the range of epicsInt32 */
+  epicsInt32 *pSumOut_;   /* The sum clamped to epicsInt32, which is read */
+  double *pCsum_;
+  mcaSumInput *pInputs_;
+};
+
+#define NUM_MCA_SUM_PARAMS (int)(&LAST_MCA_SUM_PARAM - &FIRST_MCA_SUM_PARAM + 1)
+
+#endif
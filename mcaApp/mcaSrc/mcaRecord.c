@@ -112,6 +112,8 @@
 #include    "mcaRecord.h"
 #undef GEN_SIZE_OFFSET
 #include    "mca.h"
+#include    "mcaRoi.h"
+#include    "mcaTiming.h"
 #include    "epicsExport.h"
 
 volatile int mcaRecordDebug = 0;
@@ -165,6 +167,9 @@ struct mcaDSET { /* mca DSET */
     DEVSUPFUN       get_ioint_info;
     DEVSUPFUN       send_msg; /*returns: (-1,0)=>(failure,success)*/
     DEVSUPFUN       read_array; /*returns: (-1,0)=>(failure,success)*/
+    DEVSUPFUN       flush_msg; /* optional, number>=7.  Sends any messages
+                                  which device support has held back from
+                                  send_msg.  returns: (-1,0)=>(failure,success)*/
 };
 
 /*sizes of field types (see dbFldTypes.h) */
@@ -173,6 +178,10 @@ static int sizeofTypes[] = {0,1,1,2,2,4,4,4,8};
 static void mcaAlarm();
 static void monitor();
 static long readValue();
+static long flushMessages(mcaRecord *pmca);
+static int valChanged(mcaRecord *pmca);
+static void histCapture(mcaRecord *pmca);
+static void histSelect(mcaRecord *pmca);
 
 #define MAX(a,b) ((a)>(b)?(a):(b))
 #define MIN(a,b) ((a)<(b)?(a):(b))
@@ -193,8 +202,15 @@ struct roiSum {
     epicsFloat64 net;
     epicsFloat64 preset;
 };
+#define FIELDS_PER_ROI_SUM 3
 static long sum_ROIs(mcaRecord *pmca, short *preset_reached);
+static void renderBg(mcaRecord *pmca);
+/* The number of ROIs which have their own RnXXX fields.  The ROI table
+ * (RLO, RHI, RBG, RIP, RPRE, RCNT, RNET) has NROI>=NUM_ROI entries, and these
+ * fields are a view of its first NUM_ROI entries. */
 #define NUM_ROI 32
+static void roiFieldsToTable(mcaRecord *pmca, int i);
+static void roiTableToFields(mcaRecord *pmca);
 
 /*******************************************************************************
 Support for keeping track of which record fields have been changed, so we can
@@ -238,6 +254,9 @@ field to all listeners.  monitor() does this.
 #define M_DTIM      0x00004000
 #define M_IDTIM     0x00008000
 #define M_NORD      0x00010000
+#define M_RSUM      0x20000000
+#define M_HNUM      0x40000000
+#define M_HIST      0x80000000
 
 /* These bits are in the mmap and newv fields */
 #define M_ERAS      0x00004000
@@ -254,6 +273,7 @@ field to all listeners.  monitor() does this.
 #define M_SEQ       0x02000000
 #define M_PSCL      0x04000000
 #define M_ERST      0x08000000
+#define M_RTBL      0x10000000
 
 
 /* These bits are in the rmap and newr fields.  RMAP records ROI fields whose
@@ -354,69 +374,57 @@ field to all listeners.  monitor() does this.
    (mcaStopAcquire)
 */
 
-/* The following macro is long, but it saves 6 pages of repetitive code */
-#define PROCESS_ROI(DATA_TYPE) \
+/* The ROI sums themselves are computed by mcaRoiCompute() from the cumulative
+ * sum array, independent of the data type.  This macro only renders a line
+ * from yLo at channel lo to yHi at channel hi into the BG array, which has the
+ * data type of the VAL array. */
+#define FILL_BG(DATA_TYPE) \
 {\
-    DATA_TYPE *pdat = (DATA_TYPE *)pmca->bptr;\
-    for (i=0; i<max; i++) ymax = MAX(ymax, pdat[i]);\
-}\
-    for (i=0; i<NUM_ROI; i++, proi++, psum++) {\
-        DATA_TYPE *p, *pdat = (DATA_TYPE *)pmca->bptr;\
-        DATA_TYPE *pb, *pbg = (DATA_TYPE *)pmca->pbg;\
-        DATA_TYPE *plo, *phi;\
-        sum = net = 0.0;\
-        lo = proi->lo; \
-        hi = proi->hi;\
-        if (hi > max) hi = max; \
-        if (lo >= 0 && hi >= lo) {\
-            bg_lo = bg_hi = 0.0;\
-            if (proi->nbg >= 0) {\
-                n = proi->nbg;\
-                /* get lo-side background average */\
-                plo = &pdat[MAX(lo-n, 0)];\
-                phi = &pdat[MIN(lo+n, max)];\
-                for (p=plo; p<=phi; p++) bg_lo += *p;\
-                bg_lo /= 2*n + 1;\
-                /* get hi-side background average */\
-                plo = &pdat[MAX(hi-n, 0)];\
-                phi = &pdat[MIN(hi+n, max)];\
-                for (p=plo; p<=phi; p++) bg_hi += *p;\
-                bg_hi /= 2*n + 1;\
-            }\
-            /* sum ROI */\
-            n = hi - lo;\
-            plo = &pdat[lo];\
-            for (j=0, p=plo, pb=&pbg[lo]; j<=n; j++, p++, pb++) {\
-                sum += *p;\
-                if (proi->nbg >= 0)\
-                    *pb = bg_lo + (n ? j*(bg_hi-bg_lo)/n : 0); /* linear */\
-                net += *p - *pb;\
-            }\
-            MARK(M_BG);\
-        }\
-        if ((sum != psum->sum) || (net != psum->net)) ROI_MARK(M_R0<<i);\
-        psum->sum = sum;\
-        psum->net = net;\
-        if (proi->isPreset) *preset_reached |= psum->net >= psum->preset;\
-        NEWR_UNMARK(M_R0<<i);\
-    }\
-    proi = (struct roi *)&pmca->r0lo;\
-    for (i=0; i<NUM_ROI; i++, proi++) {\
-        DATA_TYPE *pbg = (DATA_TYPE *)pmca->pbg;\
-        lo = proi->lo; \
-        hi = proi->hi;\
-        if (hi > max) hi = max; \
-        if (lo >= 0 && hi >= lo) {\
-            pbg[lo] = pbg[hi] = ymax;\
-        }\
-    }\
+    DATA_TYPE *pbg = (DATA_TYPE *)pmca->pbg + lo;\
+    for (j=0; j<=n; j++) \
+        pbg[j] = yLo + (n ? j*(yHi-yLo)/n : 0); /* linear */\
+}
+
+static void fillBg(mcaRecord *pmca, int lo, int hi, double yLo, double yHi)
+{
+    int j, n = hi - lo;
+
+    switch (pmca->ftvl) {
+    case DBF_CHAR:
+        FILL_BG(epicsInt8);
+        break;
+    case DBF_UCHAR:
+        FILL_BG(epicsUInt8);
+        break;
+    case DBF_SHORT:
+        FILL_BG(epicsInt16);
+        break;
+    case DBF_USHORT:
+        FILL_BG(epicsUInt16);
+        break;
+    case DBF_LONG:
+        FILL_BG(epicsInt32);
+        break;
+    case DBF_ULONG:
+        FILL_BG(epicsUInt32);
+        break;
+    case DBF_FLOAT:
+        FILL_BG(epicsFloat32);
+        break;
+    case DBF_DOUBLE:
+        FILL_BG(epicsFloat64);
+        break;
+    default:
+        break;
+    }
+}
 
 
-
 static long init_record(mcaRecord *pmca, int pass)
 {
     struct mcaDSET *pdset;
     long status;
+    int i;
 
     /* Allocate memory for spectrum and status buffer */
     if (pass==0) {
@@ -429,8 +437,38 @@ static long init_record(mcaRecord *pmca, int pass)
             if (pmca->ftvl > DBF_DOUBLE) pmca->ftvl=2;
             pmca->bptr = (char *)calloc(pmca->nmax,sizeofTypes[pmca->ftvl]);
             pmca->pbg = (char *)calloc(pmca->nmax,sizeofTypes[pmca->ftvl]);
+            pmca->ppst = (char *)calloc(pmca->nmax,dbValueSize(pmca->ftvl));
+        }
+        pmca->pcsum = (double *)calloc(pmca->nmax+1, sizeof(double));
+        /* Allocate the ROI table, and load the first NUM_ROI entries from the
+         * RnXXX fields */
+        if (pmca->nroi < NUM_ROI) pmca->nroi = NUM_ROI;
+        pmca->rlo  = (epicsInt32 *)calloc(pmca->nroi, sizeof(epicsInt32));
+        pmca->rhi  = (epicsInt32 *)calloc(pmca->nroi, sizeof(epicsInt32));
+        pmca->rbg  = (epicsInt16 *)calloc(pmca->nroi, sizeof(epicsInt16));
+        pmca->rip  = (epicsInt16 *)calloc(pmca->nroi, sizeof(epicsInt16));
+        pmca->rpre = (double *)calloc(pmca->nroi, sizeof(double));
+        pmca->rcnt = (double *)calloc(pmca->nroi, sizeof(double));
+        pmca->rnet = (double *)calloc(pmca->nroi, sizeof(double));
+        for (i=0; i<pmca->nroi; i++) pmca->rlo[i] = pmca->rhi[i] = -1;
+        for (i=0; i<NUM_ROI; i++) roiFieldsToTable(pmca, i);
+        /* Allocate the spectrum history.  The HXXX output arrays always have
+         * at least one element. */
+        if ((pmca->hdep < 0) || (pmca->ftvl == 0)) pmca->hdep = 0;
+        if (pmca->hdep > 0) {
+            pmca->phst = (char *)calloc((size_t)pmca->hdep*pmca->nmax, dbValueSize(pmca->ftvl));
+            pmca->phnr = (epicsInt32 *)calloc(pmca->hdep, sizeof(epicsInt32));
+            pmca->phrt = (double *)calloc(pmca->hdep, sizeof(double));
+            pmca->pher = (double *)calloc(pmca->hdep, sizeof(double));
+            pmca->phel = (double *)calloc(pmca->hdep, sizeof(double));
         }
+        pmca->hval = (double *)calloc((size_t)MAX(pmca->hdep, 1)*pmca->nmax, sizeof(double));
+        pmca->hrtm = (double *)calloc(MAX(pmca->hdep, 1), sizeof(double));
+        pmca->hert = (double *)calloc(MAX(pmca->hdep, 1), sizeof(double));
+        pmca->helt = (double *)calloc(MAX(pmca->hdep, 1), sizeof(double));
+        pmca->hnum = 0;
         pmca->pstatus = (char *)calloc(1, sizeof(mcaStatus));
+        pmca->ptim = (char *)calloc(1, sizeof(mcaTiming));
         pmca->nord = 0;
         return(0);
     }
@@ -485,6 +523,7 @@ static long init_record(mcaRecord *pmca, int pass)
                 (pmca,  mcaPresetSweeps, (void *)(&pmca->pswp));
     status = (*pdset->send_msg) 
                 (pmca, mcaAcquireMode, (void *)(&pmca->mode));
+    status = flushMessages(pmca);
     return(0);
 }
 
@@ -747,12 +786,15 @@ read_data:
      * get data */
     if (pmca->rdng) {
        if (mcaRecordDebug > 5) errlogPrintf("process: get data\n");
+       MCA_TIMING_START(pmca->ptim, mcaTimeReadArray);
        status = readValue(pmca); /* read the new value */
+       MCA_TIMING_STOP(pmca->ptim, mcaTimeReadArray);
        if (status) {
           if (mcaRecordDebug > 1) errlogPrintf("process: error reading data\n");
           pmca->nack = 1; MARK(M_NACK);
        } else {
           MARK(M_VAL);
+          histCapture(pmca);
        }
        pmca->rdng = 0; MARK(M_RDNG);
     } else if (pmca->read) {
@@ -762,6 +804,7 @@ read_data:
        recGblGetTimeStamp(pmca);
        pmca->rtim = pmca->time.secPastEpoch + pmca->time.nsec*1.e-9;
        MARK(M_RTIM);
+       MCA_TIMING_START(pmca->ptim, mcaTimeTotal);
        status = (*pdset->send_msg)(pmca, mcaData, NULL);
        pmca->read = 0; MARK(M_READ);
        if (status) {
@@ -780,24 +823,38 @@ read_data:
         } else {
             /* Data available immediately, get it */
             if (mcaRecordDebug > 5) errlogPrintf("process: get data\n");
+            MCA_TIMING_START(pmca->ptim, mcaTimeReadArray);
             status = readValue(pmca); /* read the new value */
+            MCA_TIMING_STOP(pmca->ptim, mcaTimeReadArray);
             if (status) {
                 pmca->nack = 1; MARK(M_NACK);
             } else {
                 MARK(M_VAL);
+                histCapture(pmca);
             }
         }
     }
 
+    /* If the ROI table was written bring the RnXXX fields up to date */
+    if (NEWV_MARKED(M_RTBL)) {
+        roiTableToFields(pmca);
+        MARK(M_RTBL);
+        NEWV_UNMARK(M_RTBL);
+        NEWR_MARK(M_ROI_ALL);
+    }
+
     /* If any ROI is marked, sumROIs */
     if (NEWR_MARKED(M_ROI_ALL)) {
+        MCA_TIMING_START(pmca->ptim, mcaTimeSumROIs);
         (void)sum_ROIs(pmca, &preset_reached);
+        MCA_TIMING_STOP(pmca->ptim, mcaTimeSumROIs);
     }
 
     if (preset_reached) {
         if (mcaRecordDebug > 5) errlogPrintf("process: stop acquisition.\n");
         status = (*pdset->send_msg) (pmca, mcaStopAcquire, NULL);
     }
+    if (flushMessages(pmca)) {pmca->nack = 1; MARK(M_NACK);}
 
     /* Now we update the acqg field, since data have been read and ROIs computed. */
     if (pmca->acqg != pstatus->acquiring) {
@@ -815,7 +872,11 @@ read_data:
         MARK(M_STIM);
     }
     mcaAlarm(pmca);
+    MCA_TIMING_START(pmca->ptim, mcaTimeMonitor);
     monitor(pmca);
+    MCA_TIMING_STOP(pmca->ptim, mcaTimeMonitor);
+    /* Only started when this record initiated a read */
+    MCA_TIMING_STOP(pmca->ptim, mcaTimeTotal);
 
     /*
      * Process forward-linked record.  Tell EPICS dbPutNotify mechanism
@@ -849,33 +910,126 @@ static long cvt_dbaddr(struct dbAddr *paddr)
     mcaRecord *pmca=(mcaRecord *)paddr->precord;
     int fieldIndex = dbGetFieldIndex(paddr);
 
-    if (fieldIndex == mcaRecordVAL) {
-        paddr->pfield = (void *)(pmca->bptr);
-    } else if (fieldIndex == mcaRecordBG) {
-        paddr->pfield = (void *)(pmca->pbg);
+    if ((fieldIndex == mcaRecordVAL) || (fieldIndex == mcaRecordBG)) {
+        /* paddr->pfield is set in get_array_info, because device support is
+         * allowed to replace bptr with a buffer of its own each time it reads
+         * (see read_array in devMcaAsyn.c) */
+        paddr->no_elements = pmca->nmax;
+        paddr->field_type = pmca->ftvl;
+        if (pmca->ftvl==0)  paddr->field_size = MAX_STRING_SIZE;
+        else paddr->field_size = dbValueSize(pmca->ftvl);
+        paddr->dbr_field_type = pmca->ftvl;
+        return(0);
     }
-    paddr->no_elements = pmca->nmax;
-    paddr->field_type = pmca->ftvl;
-    if (pmca->ftvl==0)  paddr->field_size = MAX_STRING_SIZE;
-    else paddr->field_size = sizeofTypes[pmca->ftvl];
-    paddr->dbr_field_type = pmca->ftvl;
+
+    /* ROI table and history */
+    paddr->no_elements = pmca->nroi;
+    switch (fieldIndex) {
+    case mcaRecordRLO:
+        paddr->pfield = (void *)(pmca->rlo);
+        paddr->field_type = DBF_LONG;
+        break;
+    case mcaRecordRHI:
+        paddr->pfield = (void *)(pmca->rhi);
+        paddr->field_type = DBF_LONG;
+        break;
+    case mcaRecordRBG:
+        paddr->pfield = (void *)(pmca->rbg);
+        paddr->field_type = DBF_SHORT;
+        break;
+    case mcaRecordRIP:
+        paddr->pfield = (void *)(pmca->rip);
+        paddr->field_type = DBF_SHORT;
+        break;
+    case mcaRecordRPRE:
+        paddr->pfield = (void *)(pmca->rpre);
+        paddr->field_type = DBF_DOUBLE;
+        break;
+    case mcaRecordRCNT:
+        paddr->pfield = (void *)(pmca->rcnt);
+        paddr->field_type = DBF_DOUBLE;
+        paddr->special = SPC_NOMOD;
+        break;
+    case mcaRecordRNET:
+        paddr->pfield = (void *)(pmca->rnet);
+        paddr->field_type = DBF_DOUBLE;
+        paddr->special = SPC_NOMOD;
+        break;
+    case mcaRecordHVAL:
+        paddr->pfield = (void *)(pmca->hval);
+        paddr->no_elements = MAX(pmca->hdep, 1)*pmca->nmax;
+        paddr->field_type = DBF_DOUBLE;
+        paddr->special = SPC_NOMOD;
+        break;
+    case mcaRecordHRTM:
+        paddr->pfield = (void *)(pmca->hrtm);
+        paddr->no_elements = MAX(pmca->hdep, 1);
+        paddr->field_type = DBF_DOUBLE;
+        paddr->special = SPC_NOMOD;
+        break;
+    case mcaRecordHERT:
+        paddr->pfield = (void *)(pmca->hert);
+        paddr->no_elements = MAX(pmca->hdep, 1);
+        paddr->field_type = DBF_DOUBLE;
+        paddr->special = SPC_NOMOD;
+        break;
+    case mcaRecordHELT:
+        paddr->pfield = (void *)(pmca->helt);
+        paddr->no_elements = MAX(pmca->hdep, 1);
+        paddr->field_type = DBF_DOUBLE;
+        paddr->special = SPC_NOMOD;
+        break;
+    default:
+        return(S_db_badField);
+    }
+    paddr->field_size = dbValueSize(paddr->field_type);
+    paddr->dbr_field_type = paddr->field_type;
     return(0);
 }
 
 static long get_array_info(struct dbAddr *paddr, long *no_elements, long *offset)
 {
     mcaRecord *pmca=(mcaRecord *)paddr->precord;
+    int fieldIndex = dbGetFieldIndex(paddr);
 
+    *offset = 0;
+    if (fieldIndex == mcaRecordHVAL) {
+        *no_elements = MAX(pmca->hnos*pmca->hnrd, 1);
+        return(0);
+    }
+    if ((fieldIndex == mcaRecordHRTM) || (fieldIndex == mcaRecordHERT) ||
+        (fieldIndex == mcaRecordHELT)) {
+        *no_elements = MAX(pmca->hnos, 1);
+        return(0);
+    }
+    if ((fieldIndex != mcaRecordVAL) && (fieldIndex != mcaRecordBG)) {
+        /* Every entry in the ROI table is always valid */
+        *no_elements = pmca->nroi;
+        return(0);
+    }
+    if (fieldIndex == mcaRecordVAL) {
+        paddr->pfield = pmca->bptr;
+    } else {
+        /* This is called for dbGet and for each BG monitor when it is posted,
+         * so BG is only rendered when somebody reads it */
+        if (pmca->bgst) renderBg(pmca);
+        paddr->pfield = pmca->pbg;
+    }
     *no_elements =  pmca->nord;
     if (*no_elements == 0) *no_elements = 1;
-    *offset = 0;
     return(0);
 }
 
 static long put_array_info(struct dbAddr *paddr, long nNew)
 {
     mcaRecord *pmca=(mcaRecord *)paddr->precord;
+    int fieldIndex = dbGetFieldIndex(paddr);
 
+    if ((fieldIndex != mcaRecordVAL) && (fieldIndex != mcaRecordBG)) {
+        /* The ROI table was written.  Entries past nNew are unchanged. */
+        NEWV_MARK(M_RTBL);
+        return(0);
+    }
     pmca->nord = nNew;
     if (pmca->nord > pmca->nmax) pmca->nord = pmca->nmax;
     return(0);
@@ -1010,8 +1164,13 @@ static void monitor(mcaRecord *pmca)
 
     monitor_mask = recGblResetAlarms(pmca);
     monitor_mask |= (DBE_VALUE|DBE_LOG);
-    if (MARKED(M_VAL)) db_post_events(pmca,pmca->bptr,monitor_mask);
-    if (MARKED(M_BG))   db_post_events(pmca,pmca->pbg,monitor_mask);
+    if (MARKED(M_VAL) && !valChanged(pmca)) {
+        /* The BG array only changes with the spectrum or the ROI table */
+        UNMARK(M_VAL);
+        if (!MARKED(M_RTBL)) UNMARK(M_BG);
+    }
+    if (MARKED(M_VAL)) db_post_events(pmca,&pmca->val,monitor_mask);
+    if (MARKED(M_BG))   db_post_events(pmca,&pmca->bg,monitor_mask);
     if (MARKED(M_NACK)) db_post_events(pmca,&pmca->nack,monitor_mask);
     if (MARKED(M_READ)) db_post_events(pmca,&pmca->read,monitor_mask);
     if (MARKED(M_RDNG)) db_post_events(pmca,&pmca->rdng,monitor_mask);
@@ -1026,6 +1185,26 @@ static void monitor(mcaRecord *pmca)
     if (MARKED(M_DTIM)) db_post_events(pmca,&pmca->dtim,monitor_mask);
     if (MARKED(M_IDTIM)) db_post_events(pmca,&pmca->idtim,monitor_mask);
     if (MARKED(M_NORD)) db_post_events(pmca,&pmca->nord,monitor_mask);
+    if (MARKED(M_RTBL)) {
+        db_post_events(pmca,pmca->rlo,monitor_mask);
+        db_post_events(pmca,pmca->rhi,monitor_mask);
+        db_post_events(pmca,pmca->rbg,monitor_mask);
+        db_post_events(pmca,pmca->rip,monitor_mask);
+        db_post_events(pmca,pmca->rpre,monitor_mask);
+    }
+    if (MARKED(M_RSUM)) {
+        db_post_events(pmca,pmca->rcnt,monitor_mask);
+        db_post_events(pmca,pmca->rnet,monitor_mask);
+    }
+    if (MARKED(M_HNUM)) db_post_events(pmca,&pmca->hnum,monitor_mask);
+    if (MARKED(M_HIST)) {
+        db_post_events(pmca,&pmca->hnos,monitor_mask);
+        db_post_events(pmca,&pmca->hnrd,monitor_mask);
+        db_post_events(pmca,pmca->hval,monitor_mask);
+        db_post_events(pmca,pmca->hrtm,monitor_mask);
+        db_post_events(pmca,pmca->hert,monitor_mask);
+        db_post_events(pmca,pmca->helt,monitor_mask);
+    }
     
     for (i=0; i<NUM_ROI; i++) {
        if (ROI_MARKED(M_R0 << i)) {
@@ -1042,6 +1221,176 @@ static void monitor(mcaRecord *pmca)
 
 }
 
+/* Compares each channel with the last posted spectrum, for VDEL>0 */
+#define CHANGED_DEADBAND(DATA_TYPE) \
+{\
+    const DATA_TYPE *pval = (const DATA_TYPE *)pmca->bptr;\
+    const DATA_TYPE *ppst = (const DATA_TYPE *)pmca->ppst;\
+    for (i=0; i<pmca->nord; i++) {\
+        double diff = (double)pval[i] - (double)ppst[i];\
+        if ((diff > pmca->vdel) || (-diff > pmca->vdel)) break;\
+    }\
+    changed = (i < pmca->nord);\
+}
+
+/* Returns 1 if the spectrum should be posted, and if so saves a copy of it.
+ * With VDEL=0 any change is posted, with VDEL>0 only a change of more than
+ * VDEL counts in some channel, and with VDEL<0 the spectrum is always posted. */
+static int valChanged(mcaRecord *pmca)
+{
+    int i, changed;
+    size_t nbytes;
+
+    if ((pmca->vdel < 0) || !pmca->ppst) return(1);
+    nbytes = pmca->nord*dbValueSize(pmca->ftvl);
+    if (pmca->nord != pmca->pnrd) {
+        changed = 1;
+    } else if (pmca->vdel == 0) {
+        changed = (memcmp(pmca->bptr, pmca->ppst, nbytes) != 0);
+    } else {
+        switch (pmca->ftvl) {
+        case DBF_CHAR:
+            CHANGED_DEADBAND(epicsInt8);
+            break;
+        case DBF_UCHAR:
+            CHANGED_DEADBAND(epicsUInt8);
+            break;
+        case DBF_SHORT:
+            CHANGED_DEADBAND(epicsInt16);
+            break;
+        case DBF_USHORT:
+            CHANGED_DEADBAND(epicsUInt16);
+            break;
+        case DBF_LONG:
+            CHANGED_DEADBAND(epicsInt32);
+            break;
+        case DBF_ULONG:
+            CHANGED_DEADBAND(epicsUInt32);
+            break;
+        case DBF_FLOAT:
+            CHANGED_DEADBAND(epicsFloat32);
+            break;
+        case DBF_DOUBLE:
+            CHANGED_DEADBAND(epicsFloat64);
+            break;
+        default:
+            changed = 1;
+            break;
+        }
+    }
+    if (changed) {
+        memcpy(pmca->ppst, pmca->bptr, nbytes);
+        pmca->pnrd = pmca->nord;
+    }
+    return(changed);
+}
+
+/* Returns the slot in the history buffer for a sequence number, which
+ * counts from 0 for the first spectrum captured, or from -1 for the latest.
+ * Returns -1 if the spectrum is not in the buffer. */
+static int histSlot(mcaRecord *pmca, epicsInt32 seq)
+{
+    if (seq < 0) seq += pmca->hnum;
+    if ((seq < 0) || (seq >= pmca->hnum) || (seq < pmca->hnum - pmca->hdep)) return(-1);
+    return(seq % pmca->hdep);
+}
+
+#define HIST_ADD(DATA_TYPE) \
+{\
+    const DATA_TYPE *pin = (const DATA_TYPE *)pmca->phst + (size_t)slot*pmca->nmax;\
+    for (j=0; j<n; j++) pout[j] += sign*pin[j];\
+}
+
+/* Adds sign times the spectrum in a history slot to pout */
+static void histAdd(mcaRecord *pmca, int slot, double sign, double *pout, int nchans)
+{
+    int j, n = MIN(nchans, pmca->phnr[slot]);
+
+    switch (pmca->ftvl) {
+    case DBF_CHAR:
+        HIST_ADD(epicsInt8);
+        break;
+    case DBF_UCHAR:
+        HIST_ADD(epicsUInt8);
+        break;
+    case DBF_SHORT:
+        HIST_ADD(epicsInt16);
+        break;
+    case DBF_USHORT:
+        HIST_ADD(epicsUInt16);
+        break;
+    case DBF_LONG:
+        HIST_ADD(epicsInt32);
+        break;
+    case DBF_ULONG:
+        HIST_ADD(epicsUInt32);
+        break;
+    case DBF_FLOAT:
+        HIST_ADD(epicsFloat32);
+        break;
+    case DBF_DOUBLE:
+        HIST_ADD(epicsFloat64);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Copies the spectrum just read into the history buffer */
+static void histCapture(mcaRecord *pmca)
+{
+    size_t size = dbValueSize(pmca->ftvl);
+    int slot;
+
+    if (pmca->hdep <= 0) return;
+    slot = pmca->hnum % pmca->hdep;
+    memcpy((char *)pmca->phst + slot*pmca->nmax*size, pmca->bptr, pmca->nord*size);
+    pmca->phnr[slot] = pmca->nord;
+    pmca->phrt[slot] = pmca->rtim;
+    pmca->pher[slot] = pmca->ertm;
+    pmca->phel[slot] = pmca->eltm;
+    pmca->hnum++;
+    MARK(M_HNUM);
+    /* Selections relative to the latest spectrum move with it */
+    if ((pmca->hsel < 0) || (pmca->hdif && (pmca->href < 0))) histSelect(pmca);
+}
+
+/* Fills HVAL, HRTM, HERT and HELT from the history buffer.  This is HCNT
+ * spectra starting at HSEL, or if HDIF=Yes the single spectrum HSEL minus
+ * the spectrum HREF. */
+static void histSelect(mcaRecord *pmca)
+{
+    int i, slot, ref=-1, seq, nspec, nchans=0;
+
+    MARK(M_HIST);
+    pmca->hnos = pmca->hnrd = 0;
+    if (pmca->hdep <= 0) return;
+    nspec = MAX(MIN(pmca->hcnt, pmca->hdep), 1);
+    if (pmca->hdif) {
+        nspec = 1;
+        ref = histSlot(pmca, pmca->href);
+        if (ref < 0) return;
+    }
+    seq = (pmca->hsel < 0) ? pmca->hsel + pmca->hnum : pmca->hsel;
+    for (i=0; i<nspec; i++) {
+        if ((slot = histSlot(pmca, seq+i)) < 0) break;
+        /* All spectra in a slice have the length of the first */
+        if (i == 0) nchans = pmca->phnr[slot];
+        memset(pmca->hval + i*nchans, 0, nchans*sizeof(double));
+        histAdd(pmca, slot, 1., pmca->hval + i*nchans, nchans);
+        pmca->hrtm[i] = pmca->phrt[slot];
+        pmca->hert[i] = pmca->pher[slot];
+        pmca->helt[i] = pmca->phel[slot];
+        if (ref >= 0) {
+            histAdd(pmca, ref, -1., pmca->hval + i*nchans, nchans);
+            pmca->hert[i] -= pmca->pher[ref];
+            pmca->helt[i] -= pmca->phel[ref];
+        }
+    }
+    pmca->hnos = i;
+    pmca->hnrd = nchans;
+}
+
 static long special(struct dbAddr *paddr, int after)
 {
     mcaRecord *pmca=(mcaRecord *)paddr->precord;
@@ -1065,13 +1414,26 @@ static long special(struct dbAddr *paddr, int after)
     case mcaRecordPCTH: NEWV_MARK(M_PCTH); break;
     case mcaRecordPSWP: NEWV_MARK(M_PSWP); break;
     case mcaRecordMODE: NEWV_MARK(M_MODE); break;
+    case mcaRecordHSEL:
+    case mcaRecordHCNT:
+    case mcaRecordHDIF:
+    case mcaRecordHREF: histSelect(pmca); break;
     default:
         if ((fieldIndex >= mcaRecordR0LO) && 
-            (fieldIndex <= mcaRecordR0IP + NUM_ROI*FIELDS_PER_ROI)) {
+            (fieldIndex < mcaRecordR0LO + NUM_ROI*FIELDS_PER_ROI)) {
             /* Which ROI is affected? */
             i = (fieldIndex - mcaRecordR0LO)/FIELDS_PER_ROI;
             /* Mark the ROI for recalculation. */
             NEWR_MARK(M_R0 << i);
+            roiFieldsToTable(pmca, i);
+            MARK(M_RTBL);
+        } else if ((fieldIndex >= mcaRecordR0) &&
+            (fieldIndex < mcaRecordR0 + NUM_ROI*FIELDS_PER_ROI_SUM) &&
+            ((fieldIndex - mcaRecordR0) % FIELDS_PER_ROI_SUM == 2)) {
+            /* RnP */
+            i = (fieldIndex - mcaRecordR0)/FIELDS_PER_ROI_SUM;
+            roiFieldsToTable(pmca, i);
+            MARK(M_RTBL);
         }
         break;
     }
@@ -1094,6 +1456,16 @@ static long special(struct dbAddr *paddr, int after)
     return(0);
 }
 
+/* Device support may hold back the messages from send_msg so that it can
+ * send all of those from one process() pass together */
+static long flushMessages(mcaRecord *pmca)
+{
+    struct mcaDSET *pdset = (struct mcaDSET *)(pmca->dset);
+
+    if ((pdset->number < 7) || (pdset->flush_msg == NULL)) return(0);
+    return((*pdset->flush_msg)(pmca));
+}
+
 static long readValue(mcaRecord *pmca)
 {
     long status;
@@ -1134,47 +1506,108 @@ static long readValue(mcaRecord *pmca)
 
 static long sum_ROIs(mcaRecord *pmca, short *preset_reached)
 {
-    int i, j, n, max, lo, hi;
-    double sum, bg_lo, bg_hi, net, ymax=0.0;
-    struct roi *proi = (struct roi *)&pmca->r0lo;
+    int i, max;
+    mcaRoiResult result;
     struct roiSum *psum = (struct roiSum *)&pmca->r0;
 
     if (mcaRecordDebug > 5) errlogPrintf("sum_ROIs: entry\n");
-    (void)memset(pmca->pbg, 0, pmca->nmax*sizeofTypes[pmca->ftvl]);
     *preset_reached = 0;
     max = pmca->nord-1;
 
-    switch (pmca->ftvl) {
-    case DBF_CHAR:
-    case DBF_UCHAR:
-    default:
-        break;
+    /* One pass over the data, after which each ROI costs the same
+     * regardless of its width or the width of its background windows */
+    pmca->bgmx = mcaRoiCumulativeSum(pmca->ftvl, pmca->bptr, pmca->nord, pmca->pcsum);
+    /* The BG array is rendered from the cumulative sum by renderBg() when it
+     * is next read */
+    pmca->bgst = 1;
+
+    for (i=0; i<pmca->nroi; i++) {
+        if (mcaRoiCompute(pmca->pcsum, max, pmca->rlo[i], pmca->rhi[i],
+                          pmca->rbg[i], &result) == 0) MARK(M_BG);
+        if ((result.sum != pmca->rcnt[i]) || (result.net != pmca->rnet[i])) MARK(M_RSUM);
+        pmca->rcnt[i] = result.sum;
+        pmca->rnet[i] = result.net;
+        if (pmca->rip[i]) *preset_reached |= result.net >= pmca->rpre[i];
+    }
+    /* Update the RnXXX fields */
+    for (i=0; i<NUM_ROI; i++, psum++) {
+        if ((pmca->rcnt[i] != psum->sum) || (pmca->rnet[i] != psum->net)) ROI_MARK(M_R0<<i);
+        psum->sum = pmca->rcnt[i];
+        psum->net = pmca->rnet[i];
+    }
+    NEWR_UNMARK_ALL;
+    return(0);
+}
 
-    case DBF_SHORT:
-        {PROCESS_ROI(epicsInt16);
-         break;
+/* Renders the background line of each ROI, and markers at its ends, into the
+ * BG array.  Uses the cumulative sum from the last call to sum_ROIs. */
+static void renderBg(mcaRecord *pmca)
+{
+    int i, lo, hi, max = pmca->nord-1;
+    mcaRoiResult result;
+
+    (void)memset(pmca->pbg, 0, pmca->nmax*dbValueSize(pmca->ftvl));
+    for (i=0; i<pmca->nroi; i++) {
+        if ((pmca->rbg[i] >= 0) &&
+            (mcaRoiCompute(pmca->pcsum, max, pmca->rlo[i], pmca->rhi[i],
+                           pmca->rbg[i], &result) == 0))
+            fillBg(pmca, pmca->rlo[i], MIN(pmca->rhi[i], max),
+                   result.bgLo, result.bgHi);
+    }
+    /* Mark the ends of each ROI */
+    for (i=0; i<pmca->nroi; i++) {
+        lo = pmca->rlo[i];
+        hi = MIN(pmca->rhi[i], max);
+        if (lo >= 0 && hi >= lo) {
+            fillBg(pmca, lo, lo, pmca->bgmx, pmca->bgmx);
+            fillBg(pmca, hi, hi, pmca->bgmx, pmca->bgmx);
         }
-    case DBF_USHORT:
-        {PROCESS_ROI(epicsUInt16);
-         break;
+    }
+    pmca->bgst = 0;
+}
+
+/* Copies the RnXXX input fields for ROI i to the ROI table */
+static void roiFieldsToTable(mcaRecord *pmca, int i)
+{
+    struct roi *proi = (struct roi *)&pmca->r0lo + i;
+    struct roiSum *psum = (struct roiSum *)&pmca->r0 + i;
+
+    pmca->rlo[i]  = proi->lo;
+    pmca->rhi[i]  = proi->hi;
+    pmca->rbg[i]  = proi->nbg;
+    pmca->rip[i]  = proi->isPreset;
+    pmca->rpre[i] = psum->preset;
+}
+
+/* Copies the first NUM_ROI entries of the ROI table to the RnXXX input fields,
+ * posting monitors on the fields which change */
+static void roiTableToFields(mcaRecord *pmca)
+{
+    struct roi *proi = (struct roi *)&pmca->r0lo;
+    struct roiSum *psum = (struct roiSum *)&pmca->r0;
+    unsigned short monitor_mask = DBE_VALUE|DBE_LOG;
+    int i;
+
+    for (i=0; i<NUM_ROI; i++, proi++, psum++) {
+        if (proi->lo != pmca->rlo[i]) {
+            proi->lo = pmca->rlo[i];
+            db_post_events(pmca,&proi->lo,monitor_mask);
         }
-    case DBF_LONG:
-        {PROCESS_ROI(epicsInt32);
-         break;
+        if (proi->hi != pmca->rhi[i]) {
+            proi->hi = pmca->rhi[i];
+            db_post_events(pmca,&proi->hi,monitor_mask);
         }
-    case DBF_ULONG:
-        {PROCESS_ROI(epicsUInt32);
-         break;
+        if (proi->nbg != pmca->rbg[i]) {
+            proi->nbg = pmca->rbg[i];
+            db_post_events(pmca,&proi->nbg,monitor_mask);
         }
-
-    case DBF_FLOAT:
-        {PROCESS_ROI(epicsFloat32);
-         break;
+        if (proi->isPreset != (pmca->rip[i] != 0)) {
+            proi->isPreset = (pmca->rip[i] != 0);
+            db_post_events(pmca,&proi->isPreset,monitor_mask);
         }
-    case DBF_DOUBLE:
-        {PROCESS_ROI(epicsFloat64);
-         break;
+        if (psum->preset != pmca->rpre[i]) {
+            psum->preset = pmca->rpre[i];
+            db_post_events(pmca,&psum->preset,monitor_mask);
         }
     }
-    return(0);
 }
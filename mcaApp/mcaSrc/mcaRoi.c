@@ -0,0 +1,97 @@
+/* mcaRoi.c -- Region-of-interest engine for the mca record
+
+    The record used to walk every channel of every ROI, and both background
+    windows of every ROI, on each read.  With many overlapping ROIs on large
+    spectra that was the dominant cost of record processing.  Here the spectrum is
+    walked once to build a cumulative sum array, and each ROI is then computed in
+    constant time.
+*/
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <epicsTypes.h>
+#include <dbFldTypes.h>
+
+#include "mcaRoi.h"
+
+#define MAX(a,b) ((a)>(b)?(a):(b))
+#define MIN(a,b) ((a)<(b)?(a):(b))
+
+/* The cumulative sum is a serial dependency, so it is done in blocks of 4.
+ * The partial sums within a block do not depend on the running total, which
+ * lets the compiler keep the type conversions and the maximum search
+ * vectorized; only one add per block is on the critical path.
+ * Partial sums are formed in double so integer data are exact up to 2^53. */
+#define CUMULATIVE_SUM(DATA_TYPE) \
+{\
+    const DATA_TYPE *pdat = (const DATA_TYPE *)data;\
+    double total = 0., ymax = 0.;\
+    int i = 0;\
+    csum[0] = 0.;\
+    if (nchans > 0) ymax = pdat[0];\
+    for (; i+4 <= nchans; i+=4) {\
+        double d0 = pdat[i], d1 = pdat[i+1], d2 = pdat[i+2], d3 = pdat[i+3];\
+        double s1 = d0 + d1, s2 = s1 + d2, s3 = s2 + d3;\
+        ymax = MAX(ymax, MAX(MAX(d0, d1), MAX(d2, d3)));\
+        csum[i+1] = total + d0;\
+        csum[i+2] = total + s1;\
+        csum[i+3] = total + s2;\
+        csum[i+4] = total + s3;\
+        total += s3;\
+    }\
+    for (; i < nchans; i++) {\
+        ymax = MAX(ymax, (double)pdat[i]);\
+        total += pdat[i];\
+        csum[i+1] = total;\
+    }\
+    return(ymax);\
+}
+
+double mcaRoiCumulativeSum(int ftvl, const void *data, int nchans, double *csum)
+{
+    switch (ftvl) {
+    case DBF_CHAR:
+        CUMULATIVE_SUM(epicsInt8);
+    case DBF_UCHAR:
+        CUMULATIVE_SUM(epicsUInt8);
+    case DBF_SHORT:
+        CUMULATIVE_SUM(epicsInt16);
+    case DBF_USHORT:
+        CUMULATIVE_SUM(epicsUInt16);
+    case DBF_LONG:
+        CUMULATIVE_SUM(epicsInt32);
+    case DBF_ULONG:
+        CUMULATIVE_SUM(epicsUInt32);
+    case DBF_FLOAT:
+        CUMULATIVE_SUM(epicsFloat32);
+    case DBF_DOUBLE:
+        CUMULATIVE_SUM(epicsFloat64);
+    default:
+        csum[0] = 0.;
+        return(0.);
+    }
+}
+
+int mcaRoiCompute(const double *csum, int max, int lo, int hi, int nbg,
+                  mcaRoiResult *presult)
+{
+    int n;
+
+    presult->sum = presult->net = 0.;
+    presult->bgLo = presult->bgHi = 0.;
+    if (hi > max) hi = max;
+    if ((lo < 0) || (hi < lo)) return(-1);
+
+    presult->sum = MCA_ROI_RANGE_SUM(csum, lo, hi);
+    if (nbg >= 0) {
+        /* The windows are clipped at the ends of the spectrum, but are always
+         * normalized to 2*nbg+1 channels */
+        presult->bgLo = MCA_ROI_RANGE_SUM(csum, MAX(lo-nbg, 0), MIN(lo+nbg, max)) / (2*nbg + 1);
+        presult->bgHi = MCA_ROI_RANGE_SUM(csum, MAX(hi-nbg, 0), MIN(hi+nbg, max)) / (2*nbg + 1);
+    }
+    /* Area under the line from bgLo at lo to bgHi at hi */
+    n = hi - lo + 1;
+    presult->net = presult->sum - n * (presult->bgLo + presult->bgHi) / 2.;
+    return(0);
+}
@@ -0,0 +1,45 @@
+/* mcaRoi.h --
+ * Region-of-interest engine for the mca record.
+ * The spectrum is reduced once per read to a cumulative (prefix) sum array,
+ * csum[0]=0, csum[i+1]=csum[i]+data[i].  The sum over any channel range, and
+ * therefore each ROI sum, net and background-window average, is then a
+ * difference of two elements of that array, independent of the ROI width.
+ * These routines do not depend on the record, so they can also be used by
+ * other code and by the mcaRoiBenchmark program.
+ */
+
+#ifndef mcaRoiH
+#define mcaRoiH
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sum of channels [lo..hi], inclusive, from a cumulative sum array */
+#define MCA_ROI_RANGE_SUM(csum, lo, hi) ((csum)[(hi)+1] - (csum)[(lo)])
+
+typedef struct {
+    double sum;     /* Total counts in [lo..hi] */
+    double net;     /* sum less the linear background */
+    double bgLo;    /* Average background at lo */
+    double bgHi;    /* Average background at hi */
+} mcaRoiResult;
+
+/* Builds the cumulative sum of nchans elements of data, which is of type ftvl
+ * (a DBF_xxx code).  csum must have room for nchans+1 elements.
+ * Returns the maximum data value, or 0 if ftvl is not a numeric type. */
+double mcaRoiCumulativeSum(int ftvl, const void *data, int nchans, double *csum);
+
+/* Computes one ROI from a cumulative sum array built over max+1 channels.
+ * The background at lo and hi is the average over 2*nbg+1 channels centered on
+ * each end, and the background under the ROI is the line between them.
+ * No background is subtracted if nbg < 0.
+ * Returns 0 if the ROI is valid, -1 if it does not overlap [0..max]. */
+int mcaRoiCompute(const double *csum, int max, int lo, int hi, int nbg,
+                  mcaRoiResult *presult);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* mcaRoiH */
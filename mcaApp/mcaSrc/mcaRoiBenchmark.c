@@ -0,0 +1,169 @@
+/* mcaRoiBenchmark.c -- Compares the cumulative sum ROI engine in mcaRoi.c with
+ * the per-channel algorithm previously used by the mca record (PROCESS_ROI).
+ *
+ * Usage: mcaRoiBenchmark [numChans [numROIs [numLoops]]]
+ *
+ * With no arguments it runs 2048, 4096 and 8192 channels with 32 overlapping
+ * ROIs, which is the worst case for the old code.  Both algorithms are checked
+ * to agree before the timing is reported.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <dbFldTypes.h>
+
+#include "mcaRoi.h"
+
+#define MAX(a,b) ((a)>(b)?(a):(b))
+#define MIN(a,b) ((a)<(b)?(a):(b))
+
+#define DEFAULT_ROIS  32
+#define DEFAULT_LOOPS 1000
+
+typedef struct {
+    int lo;
+    int hi;
+    int nbg;
+} benchRoi;
+
+/* The old algorithm.  The background line is kept in double here, so the two
+ * methods should agree to rounding error.  One difference is expected: for
+ * an ROI with nbg<0 the old code subtracted whatever background line an
+ * earlier overlapping ROI had left in the BG array, while the engine
+ * subtracts nothing, so net counts are only compared when nbg>=0. */
+static double legacySum(const epicsInt32 *pdat, double *pbg, int nchans,
+                        const benchRoi *proi, int nroi, double *sums, double *nets)
+{
+    int i, j, n, lo, hi, max = nchans-1;
+    double sum, net, bg_lo, bg_hi, ymax=0.;
+
+    for (i=0; i<max; i++) ymax = MAX(ymax, pdat[i]);
+    for (i=0; i<nroi; i++) {
+        sum = net = 0.;
+        lo = proi[i].lo;
+        hi = MIN(proi[i].hi, max);
+        if (lo >= 0 && hi >= lo) {
+            bg_lo = bg_hi = 0.;
+            if (proi[i].nbg >= 0) {
+                n = proi[i].nbg;
+                for (j=MAX(lo-n, 0); j<=MIN(lo+n, max); j++) bg_lo += pdat[j];
+                bg_lo /= 2*n + 1;
+                for (j=MAX(hi-n, 0); j<=MIN(hi+n, max); j++) bg_hi += pdat[j];
+                bg_hi /= 2*n + 1;
+            }
+            n = hi - lo;
+            for (j=0; j<=n; j++) {
+                sum += pdat[lo+j];
+                if (proi[i].nbg >= 0)
+                    pbg[lo+j] = bg_lo + (n ? j*(bg_hi-bg_lo)/n : 0);
+                net += pdat[lo+j] - pbg[lo+j];
+            }
+        }
+        sums[i] = sum;
+        nets[i] = net;
+    }
+    return(ymax);
+}
+
+static void engineSum(const epicsInt32 *pdat, double *csum, int nchans,
+                      const benchRoi *proi, int nroi, double *sums, double *nets)
+{
+    int i;
+    mcaRoiResult result;
+
+    mcaRoiCumulativeSum(DBF_LONG, pdat, nchans, csum);
+    for (i=0; i<nroi; i++) {
+        mcaRoiCompute(csum, nchans-1, proi[i].lo, proi[i].hi, proi[i].nbg, &result);
+        sums[i] = result.sum;
+        nets[i] = result.net;
+    }
+}
+
+static double elapsed(epicsTimeStamp *start)
+{
+    epicsTimeStamp now;
+
+    epicsTimeGetCurrent(&now);
+    return(epicsTimeDiffInSeconds(&now, start));
+}
+
+static int runBenchmark(int nchans, int nroi, int nloops)
+{
+    int i, j, errors=0;
+    epicsInt32 *pdat = (epicsInt32 *)calloc(nchans, sizeof(epicsInt32));
+    double *pbg = (double *)calloc(nchans, sizeof(double));
+    double *csum = (double *)calloc(nchans+1, sizeof(double));
+    double *sums1 = (double *)calloc(nroi, sizeof(double));
+    double *nets1 = (double *)calloc(nroi, sizeof(double));
+    double *sums2 = (double *)calloc(nroi, sizeof(double));
+    double *nets2 = (double *)calloc(nroi, sizeof(double));
+    benchRoi *proi = (benchRoi *)calloc(nroi, sizeof(benchRoi));
+    epicsTimeStamp start;
+    double tLegacy, tEngine;
+
+    /* A few peaks on a sloping background */
+    srand(1);
+    for (i=0; i<nchans; i++) {
+        pdat[i] = 100 + (nchans - i)/16 + rand()%10;
+        for (j=1; j<=4; j++) {
+            double x = (i - j*nchans/5.) / (nchans/200.);
+            pdat[i] += (epicsInt32)(10000.*exp(-x*x/2.));
+        }
+    }
+    /* ROIs which overlap each other and mostly cover the spectrum */
+    for (i=0; i<nroi; i++) {
+        proi[i].lo = (i * nchans) / (2*nroi);
+        proi[i].hi = proi[i].lo + nchans/2;
+        proi[i].nbg = (i%4 == 3) ? -1 : i%8;
+    }
+
+    legacySum(pdat, pbg, nchans, proi, nroi, sums1, nets1);
+    engineSum(pdat, csum, nchans, proi, nroi, sums2, nets2);
+    for (i=0; i<nroi; i++) {
+        if ((sums1[i] != sums2[i]) || ((proi[i].nbg >= 0) &&
+            (fabs(nets1[i] - nets2[i]) > 1e-6 * MAX(1., fabs(nets1[i]))))) {
+            printf("ROI %d: legacy sum=%f net=%f, engine sum=%f net=%f\n",
+                   i, sums1[i], nets1[i], sums2[i], nets2[i]);
+            errors++;
+        }
+    }
+
+    epicsTimeGetCurrent(&start);
+    for (i=0; i<nloops; i++)
+        legacySum(pdat, pbg, nchans, proi, nroi, sums1, nets1);
+    tLegacy = elapsed(&start);
+    epicsTimeGetCurrent(&start);
+    for (i=0; i<nloops; i++)
+        engineSum(pdat, csum, nchans, proi, nroi, sums2, nets2);
+    tEngine = elapsed(&start);
+
+    printf("%6d channels %3d ROIs: legacy %9.3f us, engine %9.3f us, speedup %6.1f, %s\n",
+           nchans, nroi, 1e6*tLegacy/nloops, 1e6*tEngine/nloops,
+           tEngine > 0. ? tLegacy/tEngine : 0., errors ? "MISMATCH" : "OK");
+
+    free(pdat); free(pbg); free(csum);
+    free(sums1); free(nets1); free(sums2); free(nets2);
+    free(proi);
+    return(errors);
+}
+
+int main(int argc, char *argv[])
+{
+    int nroi = DEFAULT_ROIS, nloops = DEFAULT_LOOPS;
+    int errors = 0;
+
+    if (argc > 2) nroi = atoi(argv[2]);
+    if (argc > 3) nloops = atoi(argv[3]);
+    if (argc > 1) {
+        errors += runBenchmark(atoi(argv[1]), nroi, nloops);
+    } else {
+        errors += runBenchmark(2048, nroi, nloops);
+        errors += runBenchmark(4096, nroi, nloops);
+        errors += runBenchmark(8192, nroi, nloops);
+    }
+    return(errors ? 1 : 0);
+}
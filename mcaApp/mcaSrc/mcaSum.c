@@ -1,177 +1,434 @@
-#include <vxWorks.h>
-#include <types.h>
-#include <math.h>
-#include <time.h>
+/* mcaSum.c -- aSub routines to sum the spectra of a multi-element detector
+
+    mcaSum_do adds the spectra in inputs A-Q into VALN.  Each spectrum can be
+    shifted by a number of channels, which need not be an integer, multiplied
+    by a factor, and switched off.  These come from the arrays in inputs R
+    (shift), S (operation, 0=off, otherwise add) and T (factor), which are
+    normally the VALA outputs of aSub records running mcaSum_do_shift,
+    mcaSum_do_op and mcaSum_do_fact.  If one of these arrays is shorter than
+    the number of detectors the remaining detectors have shift 0, operation 1
+    and factor 1.  Input U is the number of detectors.
+
+    For dead time correction the factors come from mcaSum_do_dt instead, which
+    multiplies them by real time/live time, or by ICR/OCR, for each detector.
+    The summed spectrum is then corrected, and so are the ROIs which the mca
+    record computes from it, in the same single pass over the spectra.
+    mcaSumROI_do_fact applies the same factors when the ROIs of the individual
+    detectors are summed.
+
+    mcaSumEnergy_do instead rebins each spectrum onto the energy axis of the
+    sum using the energy calibration of each detector, see below.
+
+    All of the state is in the records, so an IOC can have any number of
+    summing records.  More than MAX_SUM_DETS detectors are summed by cascading
+    summing records: each sums a group of detectors and the sum from the
+    previous record in the cascade.  mcaSum64.substitutions does this for 64
+    detectors with four records of 16.
+*/
+
 #include <stdlib.h>
-#include <stdioLib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
 
-#include <dbEvent.h>
+#include <epicsTypes.h>
 #include <dbDefs.h>
 #include <dbCommon.h>
 #include <recSup.h>
-#include <genSubRecord.h>
+#include <aSubRecord.h>
+#include <registryFunction.h>
+#include <cantProceed.h>
+#include <epicsExport.h>
 
 #define NINT(f)     (int)((f)>0 ? (f)+0.5 : (f)-0.5)
-#define MAXDETS 16
+#define MAX(a,b)    ((a)>(b)?(a):(b))
+#define MIN(a,b)    ((a)<(b)?(a):(b))
+
+/* mcaSum_do: spectra in A-Q, parameters in R-T, number of detectors in U */
+#define MAX_SUM_DETS 17
+/* Other routines: values in A-T, number of detectors in U */
+#define MAX_PARAM_DETS 20
 
 volatile int mcaSumDebug=0;
+epicsExportAddress(int, mcaSumDebug);
+
+static long ndets(aSubRecord *pasub, long maxDets)
+{
+    long nDets = *(epicsInt32 *)pasub->u;
 
-static double shift[MAXDETS], min_shift, max_shift;
-static short op[MAXDETS];
-static double fact[MAXDETS];
+    if (nDets < 0) {
+        printf("mcaSum:%s # of detectors is %ld.  It must be non-negative.\n",
+            pasub->name, nDets);
+        nDets = 0;
+    } else if (nDets > maxDets) {
+        printf("mcaSum:%s # of detectors is %ld.  It can't be greater than %ld.\n",
+            pasub->name, nDets, maxDets);
+        nDets = maxDets;
+    }
+    return(nDets);
+}
+
+/* The two loops which do the work.  They are written so that the compiler
+ * can vectorize them: the coefficients are float, like the data, and there are
+ * no branches in the loops.  The interpolation weights are folded into the
+ * factor, so the fractional shift costs two multiply-adds per channel. */
+
+/* pdest[i] += f*psrc[i] */
+static void addScaled(float *pdest, const float *psrc, float f, int n)
+{
+    int i;
+
+    for (i=0; i<n; i++) pdest[i] += f*psrc[i];
+}
+
+/* pdest[i] += a*psrc[i] + b*psrc[i+1] */
+static void addInterpolated(float *pdest, const float *psrc, float a, float b, int n)
+{
+    int i;
+
+    for (i=0; i<n; i++) pdest[i] += a*psrc[i] + b*psrc[i+1];
+}
 
-long ndets(genSubRecord *pgsub)
+long mcaSum_init(aSubRecord *pasub)
 {
-	long nDets, *pnDets = (long *)pgsub->u;
-
-	nDets = *pnDets;
-	if (nDets < 0) {
-		printf("mcaSum:%s # of detectors is %ld.  It must be non-negative.\n",
-			pgsub->name, nDets);
-		nDets = 0;
-	} else if (nDets > MAXDETS) {
-		printf("mcaSum:%s # of detectors is %ld.  It can't be greater than %d.\n",
-			pgsub->name, nDets, MAXDETS);
-		nDets = MAXDETS;
-	}
-	return(nDets);
-}
-
-long mcaSum_init(genSubRecord *pgsub)
-{
-	float	*n;
-	int i;
-	long nDets = ndets(pgsub);	/* just to get any error message there might be */
-
-	n = (float *)pgsub->valn;
-	for (i=0; i<pgsub->novn; i++) {
-		n[i] = 0.;
-	}
-	return(0);
-}
-
-long mcaSum_do_shift(genSubRecord *pgsub)
-{
-	int i;
-	double **ppdata = (double **)&(pgsub->a);
-	long nDets = ndets(pgsub);
-
-	min_shift = 1.e6;
-	max_shift = -1.e6;
-	for (i=0; i<nDets; i++) {
-		shift[i] = (double) *(ppdata[i]);
-		if (shift[i] < min_shift) min_shift = shift[i];
-		if (shift[i] > max_shift) max_shift = shift[i];
-	}
-	return(0);
-}
-
-long mcaSum_do_op(genSubRecord *pgsub)
-{
-	int i;
-	short **ppdata = (short **)&(pgsub->a);
-	long nDets = ndets(pgsub);
-
-	for (i=0; i<nDets; i++) {
-		op[i] = (short) *(ppdata[i]);
-		if (op[i] < 0) op[i] = 0;
-		if (op[i] > 2) op[i] = 2;
-	}
-	return(0);
-}
-
-long mcaSum_do_fact(genSubRecord *pgsub)
-{
-	int i;
-	double **ppdata = (double **)&(pgsub->a);
-	long nDets = ndets(pgsub);
-
-	for (i=0; i<nDets; i++) {
-		fact[i] = (double) *(ppdata[i]);
-	}
-	return(0);
-}
-
-
-long mcaSum_do(genSubRecord *pgsub)
-{
-	float	*n, **ppdata, *pdata, *pdest, *pd;
-	int		max, i, is, ix, ix_start, ix_end, src_start;
-	double	f, q, s, floor_s;
-	long nDets = ndets(pgsub);
-
-	ppdata = (float **)&(pgsub->a);
-	n = (float *)pgsub->valn;
-	max = (int) pgsub->novn;
-	if (mcaSumDebug) printf("mcaSum_do: ppdata=%p,n=%p, max=%d\n", ppdata, n, max);
-	for (ix = 0; ix < max; ix++) n[ix] = 0;
-	for (i=0; i<nDets; i++) {
-		if (op[i]) {
-			pdata = (float *)ppdata[i];
-			if (mcaSumDebug) printf("mcaSum_do: pdata=%p,pdata[0]=%f\n", pdata, pdata[0]);
-
-			s = shift[i];
-			is = NINT(s);
-			if (fabs(s-is) < .000001) {
-				/* integer shift */
-				f = fact[i];
-				ix_start = (s > 0) ? is : 0;
-				ix_end = (is > 0) ? max : max + is;
-				pd = &pdata[ix_start - is];
-				if (mcaSumDebug) printf("ix_start=%d; ix_end=%d; s=%f\n",
-					ix_start, ix_end, s);
-				for (pdest = n + ix_start; pdest < n + ix_end; ) {
-					*pdest++ += f * (*pd++);
-					if (mcaSumDebug > 10) printf("%f, ", pdest[-1]);
-				}
-			} else {
-				/* fractional shift */
-				f = fact[i];
-				floor_s = floor(s);
-				ix_start = (s > 0) ? floor_s+1 : 0;
-				ix_end = (s > 0) ? max-1 : (max-1) + floor_s;
-				src_start = (int) (ix_start-s);
-				pd = &pdata[src_start];
-				q = s - floor_s;
-				if (mcaSumDebug) printf("ix_start=%d; ix_end=%d; src_start=%d; s=%f\n",
-					ix_start, ix_end, src_start, s);
-				for (pdest = n + ix_start; pdest < n + ix_end; pd++) {
-					*pdest++ += f * (pd[0] * q + pd[1] * (1-q));
-				}
-			}
-		}
-	}
-	/* clear borders, where not all arrays got added because of shifting */
-	for (ix = NINT(max + min_shift); ix < max; ix++) n[ix] = 0;
-	for (ix = 0; ix < max_shift; ix++) n[ix] = 0;
-
-	return(0);
-}
-
-long mcaSumROI_init(genSubRecord *pgsub)
-{
-	float	*n;
-	long nDets = ndets(pgsub);	/* just to get any error message there might be */
-
-	n = (float *)pgsub->valn;
-	*n = 0.;
-	return(0);
-}
-
-long mcaSumROI_do(genSubRecord *pgsub)
-{
-	float	*n, **ppdata, *pdata;
-	int		i;
-	long nDets = ndets(pgsub);
-
-	ppdata = (float **)&(pgsub->a);
-	n = (float *)pgsub->valn;
-	if (mcaSumDebug) printf("mcaSumROI_do: ppdata=%p,n=%p\n", ppdata, n);
-	*n = 0;
-	for (i=0; i<nDets; i++) {
-		pdata = (float *)ppdata[i];
-		if (mcaSumDebug) printf("mcaSumROI_do: pdata=%p,*pdata=%f\n", pdata, *pdata);
-		*n += *pdata;
-	}
-	return(0);
+    ndets(pasub, MAX_SUM_DETS); /* just to get any error message there might be */
+    memset(pasub->valn, 0, pasub->novn*sizeof(float));
+    return(0);
 }
+
+/* Copies the double inputs A-T to the array VALA */
+static long copyDoubles(aSubRecord *pasub)
+{
+    double **ppdata = (double **)&pasub->a;
+    double *pout = (double *)pasub->vala;
+    long i, nDets = ndets(pasub, MIN(MAX_PARAM_DETS, (long)pasub->nova));
+
+    for (i=0; i<nDets; i++) pout[i] = *ppdata[i];
+    pasub->neva = nDets;
+    return(0);
+}
+
+/* Copies the shifts in inputs A-T to the array VALA */
+long mcaSum_do_shift(aSubRecord *pasub)
+{
+    return(copyDoubles(pasub));
+}
+
+/* Copies the operations in inputs A-T to the array VALA */
+long mcaSum_do_op(aSubRecord *pasub)
+{
+    epicsInt16 **ppdata = (epicsInt16 **)&pasub->a;
+    epicsInt16 *pop = (epicsInt16 *)pasub->vala;
+    long i, nDets = ndets(pasub, MIN(MAX_PARAM_DETS, (long)pasub->nova));
+
+    for (i=0; i<nDets; i++) {
+        pop[i] = *ppdata[i];
+        if (pop[i] < 0) pop[i] = 0;
+        if (pop[i] > 2) pop[i] = 2;
+    }
+    pasub->neva = nDets;
+    return(0);
+}
+
+/* Copies the factors in inputs A-T to the array VALA */
+long mcaSum_do_fact(aSubRecord *pasub)
+{
+    return(copyDoubles(pasub));
+}
+
+/* Copies one calibration coefficient of each detector, in inputs A-T, to the
+ * array VALA, for mcaSumEnergy_do */
+long mcaSum_do_cal(aSubRecord *pasub)
+{
+    return(copyDoubles(pasub));
+}
+
+/* Dead time correction factors.  Input A is the numerator array, the real
+ * times or input count rates, and B is the denominator array, the live times
+ * or output count rates, normally gathered by aSub records running
+ * mcaSum_do_cal.  C is the array of factors from mcaSum_do_fact.  If D is
+ * non-zero VALA is C*A/B for each detector, otherwise it is just C.  A
+ * detector with no counts yet, A<=0 or B<=0, is not corrected. */
+long mcaSum_do_dt(aSubRecord *pasub)
+{
+    const double *pnum = (const double *)pasub->a;
+    const double *pden = (const double *)pasub->b;
+    const double *pfact = (const double *)pasub->c;
+    int enable = (int)*(double *)pasub->d;
+    double *pout = (double *)pasub->vala;
+    long i, nDets = ndets(pasub, (long)pasub->nova);
+
+    for (i=0; i<nDets; i++) {
+        pout[i] = (i < (long)pasub->nec) ? pfact[i] : 1.;
+        if (enable && (i < (long)pasub->nea) && (i < (long)pasub->neb) &&
+            (pnum[i] > 0.) && (pden[i] > 0.))
+            pout[i] *= pnum[i]/pden[i];
+    }
+    pasub->neva = nDets;
+    return(0);
+}
+
+long mcaSum_do(aSubRecord *pasub)
+{
+    float   **ppdata = (float **)&pasub->a, *pdata, *n;
+    epicsUInt32 *pnelm = &pasub->nea;
+    const double *pshift = (const double *)pasub->r;
+    const epicsInt16 *pop = (const epicsInt16 *)pasub->s;
+    const double *pfact = (const double *)pasub->t;
+    int     max, nsrc, i, is, ix, ix_start, ix_end;
+    double  s, f, q, floor_s, min_shift=0., max_shift=0.;
+    long nDets = ndets(pasub, MAX_SUM_DETS);
+
+    n = (float *)pasub->valn;
+    max = (int) pasub->novn;
+    if (mcaSumDebug) printf("mcaSum_do: ppdata=%p,n=%p, max=%d\n", (void *)ppdata, (void *)n, max);
+    memset(n, 0, max*sizeof(float));
+    for (i=0; i<nDets; i++) {
+        s = (i < (int)pasub->ner) ? pshift[i] : 0.;
+        if ((i == 0) || (s < min_shift)) min_shift = s;
+        if ((i == 0) || (s > max_shift)) max_shift = s;
+        if ((i < (int)pasub->nes) && !pop[i]) continue;
+        f = (i < (int)pasub->net) ? pfact[i] : 1.;
+        pdata = ppdata[i];
+        nsrc = MIN((int)pnelm[i], max);
+        is = NINT(s);
+        if (fabs(s-is) < .000001) {
+            /* integer shift: n[ix] += f*pdata[ix-is] */
+            ix_start = MAX(is, 0);
+            ix_end = MIN(max, nsrc + is);
+            if (mcaSumDebug) printf("mcaSum_do: %d ix_start=%d; ix_end=%d; s=%f\n",
+                i, ix_start, ix_end, s);
+            if (ix_end > ix_start)
+                addScaled(n + ix_start, pdata + ix_start - is, (float)f, ix_end - ix_start);
+        } else {
+            /* fractional shift: n[ix] += f*(q*pdata[src] + (1-q)*pdata[src+1]),
+             * where src = ix - floor(s) - 1 */
+            floor_s = floor(s);
+            q = s - floor_s;
+            ix_start = MAX((int)floor_s + 1, 0);
+            ix_end = MIN(max, nsrc + (int)floor_s);
+            if (mcaSumDebug) printf("mcaSum_do: %d ix_start=%d; ix_end=%d; s=%f\n",
+                i, ix_start, ix_end, s);
+            if (ix_end > ix_start)
+                addInterpolated(n + ix_start, pdata + ix_start - (int)floor_s - 1,
+                                (float)(f*q), (float)(f*(1-q)), ix_end - ix_start);
+        }
+    }
+    /* clear borders, where not all arrays got added because of shifting */
+    for (ix = MAX(NINT(max + min_shift), 0); ix < max; ix++) n[ix] = 0;
+    for (ix = 0; (ix < max_shift) && (ix < max); ix++) n[ix] = 0;
+
+    return(0);
+}
+
+/* Energy-matched summing.  mcaSumEnergy_do adds the spectra in inputs A-O
+ * after rebinning each onto the energy axis of the sum.  The calibration
+ * offset, slope and quadratic term of the detectors are in the arrays in
+ * inputs P, Q and R, which can be gathered from the mca records by aSub
+ * records running mcaSum_do_cal.  Input S is the calibration of the sum,
+ * [offset, slope, quadratic], input T is the operations array as for
+ * mcaSum_do, and input U is the number of detectors.
+ *
+ * The rebinning preserves counts: each channel's counts are spread uniformly
+ * over its energy range, and each channel of the sum gets the counts that
+ * fall within its own energy range.  For each channel boundary of the sum the
+ * table holds the source channel and fraction at the same energy, so a pass
+ * is one cumulative sum of the detector spectrum and one lookup per channel.
+ * The table for a detector is only rebuilt when its calibration, the
+ * calibration of the sum or the number of channels changes. */
+#define MAX_ENERGY_DETS 15
+
+typedef struct {
+    double calo, cals, calq;    /* Calibration the table was built for */
+    int nsrc;                   /* Number of source channels */
+    int built;
+    int valid;
+    epicsInt32 *index;          /* Source channel at each boundary of the sum */
+    float *frac;                /* and the fraction of that channel below it */
+} mcaSumRebin;
+
+typedef struct {
+    double calo, cals, calq;    /* Calibration of the sum */
+    int max;
+    double *csum;
+    mcaSumRebin rebin[MAX_ENERGY_DETS];
+} mcaSumEnergyPvt;
+
+/* Returns the channel for an energy, or -1 if there is none */
+static int channelFromEnergy(double e, double calo, double cals, double calq, double *pchan)
+{
+    double disc = cals*cals + 4.*calq*(e - calo);
+    double denom;
+
+    if (disc < 0.) return(-1);
+    denom = cals + sqrt(disc);
+    if (denom <= 0.) return(-1);
+    /* Root of calq*x^2 + cals*x + calo = e which is continuous at calq=0 */
+    *pchan = 2.*(e - calo)/denom;
+    return(0);
+}
+
+static void buildRebin(aSubRecord *pasub, mcaSumEnergyPvt *pPvt, int det,
+                       double calo, double cals, double calq, int nsrc)
+{
+    mcaSumRebin *prebin = &pPvt->rebin[det];
+    double x, e, u;
+    int k, j;
+
+    prebin->calo = calo;
+    prebin->cals = cals;
+    prebin->calq = calq;
+    prebin->nsrc = nsrc;
+    prebin->built = 1;
+    prebin->valid = 0;
+    if ((cals <= 0.) || (nsrc <= 0)) {
+        printf("mcaSum:%s detector %d has an invalid calibration, slope=%g.\n",
+            pasub->name, det+1, cals);
+        return;
+    }
+    for (k=0; k<=pPvt->max; k++) {
+        /* Channel k of the sum covers [k-0.5, k+0.5] */
+        x = k - 0.5;
+        e = pPvt->calo + pPvt->cals*x + pPvt->calq*x*x;
+        if (channelFromEnergy(e, calo, cals, calq, &u)) {
+            u = (k == 0) ? 0. : nsrc;
+        } else {
+            /* Source channel j covers [j, j+1] in u */
+            u += 0.5;
+        }
+        if (u <= 0.) {
+            j = 0; u = 0.;
+        } else if (u >= nsrc) {
+            j = nsrc-1; u = nsrc;
+        } else {
+            j = (int)u;
+        }
+        prebin->index[k] = j;
+        prebin->frac[k] = (float)(u - j);
+    }
+    prebin->valid = 1;
+    if (mcaSumDebug) printf("mcaSum:%s rebuilt table for detector %d\n", pasub->name, det+1);
+}
+
+long mcaSumEnergy_init(aSubRecord *pasub)
+{
+    mcaSumEnergyPvt *pPvt;
+    epicsUInt32 *pnoa = &pasub->noa;
+    int i, nsrc = 0;
+
+    ndets(pasub, MAX_ENERGY_DETS); /* just to get any error message there might be */
+    memset(pasub->valn, 0, pasub->novn*sizeof(float));
+    pPvt = callocMustSucceed(1, sizeof(*pPvt), "mcaSumEnergy_init");
+    pPvt->max = pasub->novn;
+    for (i=0; i<MAX_ENERGY_DETS; i++) {
+        nsrc = MAX(nsrc, (int)pnoa[i]);
+        pPvt->rebin[i].index = callocMustSucceed(pPvt->max+1, sizeof(epicsInt32), "mcaSumEnergy_init");
+        pPvt->rebin[i].frac = callocMustSucceed(pPvt->max+1, sizeof(float), "mcaSumEnergy_init");
+    }
+    pPvt->csum = callocMustSucceed(nsrc+1, sizeof(double), "mcaSumEnergy_init");
+    pasub->dpvt = pPvt;
+    return(0);
+}
+
+long mcaSumEnergy_do(aSubRecord *pasub)
+{
+    mcaSumEnergyPvt *pPvt = (mcaSumEnergyPvt *)pasub->dpvt;
+    float   **ppdata = (float **)&pasub->a, *pdata, *n;
+    epicsUInt32 *pnelm = &pasub->nea;
+    const double *pcalo = (const double *)pasub->p;
+    const double *pcals = (const double *)pasub->q;
+    const double *pcalq = (const double *)pasub->r;
+    const double *ptarget = (const double *)pasub->s;
+    const epicsInt16 *pop = (const epicsInt16 *)pasub->t;
+    mcaSumRebin *prebin;
+    double  *csum, prev, next;
+    int     i, j, k, nsrc, max, rebuildAll=0;
+    long nDets = ndets(pasub, MAX_ENERGY_DETS);
+
+    if (!pPvt) return(-1);
+    n = (float *)pasub->valn;
+    max = pPvt->max;
+    csum = pPvt->csum;
+    memset(n, 0, max*sizeof(float));
+    if ((pasub->nes >= 3) && ((ptarget[0] != pPvt->calo) ||
+        (ptarget[1] != pPvt->cals) || (ptarget[2] != pPvt->calq))) {
+        pPvt->calo = ptarget[0];
+        pPvt->cals = ptarget[1];
+        pPvt->calq = ptarget[2];
+        rebuildAll = 1;
+    }
+    for (i=0; i<nDets; i++) {
+        if ((i < (int)pasub->net) && !pop[i]) continue;
+        if ((i >= (int)pasub->nep) || (i >= (int)pasub->neq) || (i >= (int)pasub->ner)) continue;
+        pdata = ppdata[i];
+        nsrc = (int)pnelm[i];
+        prebin = &pPvt->rebin[i];
+        if (rebuildAll || !prebin->built || (prebin->nsrc != nsrc) ||
+            (prebin->calo != pcalo[i]) || (prebin->cals != pcals[i]) ||
+            (prebin->calq != pcalq[i]))
+            buildRebin(pasub, pPvt, i, pcalo[i], pcals[i], pcalq[i], nsrc);
+        if (!prebin->valid) continue;
+        csum[0] = 0.;
+        for (j=0; j<nsrc; j++) csum[j+1] = csum[j] + pdata[j];
+        /* Counts below each boundary of the sum, differenced */
+        prev = csum[prebin->index[0]] + prebin->frac[0]*pdata[prebin->index[0]];
+        for (k=0; k<max; k++) {
+            j = prebin->index[k+1];
+            next = csum[j] + prebin->frac[k+1]*pdata[j];
+            n[k] += (float)(next - prev);
+            prev = next;
+        }
+    }
+    return(0);
+}
+
+long mcaSumROI_init(aSubRecord *pasub)
+{
+    ndets(pasub, MAX_PARAM_DETS); /* just to get any error message there might be */
+    *(float *)pasub->valn = 0.;
+    return(0);
+}
+
+long mcaSumROI_do(aSubRecord *pasub)
+{
+    float   *n, **ppdata;
+    int     i;
+    long nDets = ndets(pasub, MAX_PARAM_DETS);
+
+    ppdata = (float **)&pasub->a;
+    n = (float *)pasub->valn;
+    *n = 0;
+    for (i=0; i<nDets; i++) *n += *ppdata[i];
+    return(0);
+}
+
+/* Like mcaSumROI_do, but the values in A-S are multiplied by the factors in
+ * the array in input T, normally the VALA of the mcaSum_do_dt record */
+long mcaSumROI_do_fact(aSubRecord *pasub)
+{
+    float   *n, **ppdata;
+    const double *pfact = (const double *)pasub->t;
+    double  sum = 0.;
+    int     i;
+    long nDets = ndets(pasub, MAX_PARAM_DETS-1);
+
+    ppdata = (float **)&pasub->a;
+    n = (float *)pasub->valn;
+    for (i=0; i<nDets; i++)
+        sum += ((i < (int)pasub->net) ? pfact[i] : 1.) * *ppdata[i];
+    *n = (float)sum;
+    return(0);
+}
+
+epicsRegisterFunction(mcaSum_init);
+epicsRegisterFunction(mcaSum_do);
+epicsRegisterFunction(mcaSum_do_shift);
+epicsRegisterFunction(mcaSum_do_op);
+epicsRegisterFunction(mcaSum_do_fact);
+epicsRegisterFunction(mcaSum_do_cal);
+epicsRegisterFunction(mcaSumEnergy_init);
+epicsRegisterFunction(mcaSumEnergy_do);
+epicsRegisterFunction(mcaSum_do_dt);
+epicsRegisterFunction(mcaSumROI_init);
+epicsRegisterFunction(mcaSumROI_do);
+epicsRegisterFunction(mcaSumROI_do_fact);
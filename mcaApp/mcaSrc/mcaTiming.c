@@ -0,0 +1,117 @@
+/* mcaTiming.c -- Timing of mca record processing stages
+
+    The record and device support call mcaTimingStart and mcaTimingStop around
+    each stage (see mcaTiming.h).  mcaRecordTimingReport prints the last,
+    minimum, maximum and mean time of each stage for the mca records whose
+    names match a pattern.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsString.h>
+#include <dbStaticLib.h>
+#include <dbAccess.h>
+#include <iocsh.h>
+
+#include "mcaRecord.h"
+#include "mcaTiming.h"
+#include <epicsExport.h>
+
+volatile int mcaRecordTiming = 0;
+epicsExportAddress(int, mcaRecordTiming);
+
+static const char *stageNames[MAX_MCA_TIME_STAGES] = {
+    "Total", "Queue", "Driver", "ReadArray", "SumROIs", "Monitor"
+};
+
+void mcaTimingStart(mcaTiming *ptiming, mcaTimeStage stage)
+{
+    ptiming->start[stage] = epicsMonotonicGet();
+}
+
+void mcaTimingStop(mcaTiming *ptiming, mcaTimeStage stage)
+{
+    mcaTimeStat *pstat = &ptiming->stat[stage];
+    double t;
+
+    /* Stages which were not started while timing was enabled are ignored */
+    if (ptiming->start[stage] == 0) return;
+    t = (epicsMonotonicGet() - ptiming->start[stage]) * 1.e-9;
+    ptiming->start[stage] = 0;
+    if ((pstat->count == 0) || (t < pstat->min)) pstat->min = t;
+    if ((pstat->count == 0) || (t > pstat->max)) pstat->max = t;
+    pstat->last = t;
+    pstat->sum += t;
+    pstat->count++;
+}
+
+void mcaTimingReset(mcaTiming *ptiming)
+{
+    memset(ptiming, 0, sizeof(*ptiming));
+}
+
+static void mcaRecordTimingReport(const char *pattern, int reset)
+{
+    DBENTRY dbentry;
+    mcaRecord *pmca;
+    mcaTiming *ptiming;
+    mcaTiming snapshot;
+    mcaTimeStat *pstat;
+    long status;
+    int i;
+
+    if (!pdbbase) {
+        printf("mcaRecordTimingReport: no database loaded\n");
+        return;
+    }
+    if (!mcaRecordTiming)
+        printf("mcaRecordTimingReport: timing is disabled, set mcaRecordTiming=1\n");
+    dbInitEntry(pdbbase, &dbentry);
+    status = dbFindRecordType(&dbentry, "mca");
+    if (status == 0) status = dbFirstRecord(&dbentry);
+    while (status == 0) {
+        pmca = (mcaRecord *)dbentry.precnode->precord;
+        ptiming = (mcaTiming *)pmca->ptim;
+        if (ptiming && (!pattern || !*pattern || epicsStrGlobMatch(pmca->name, pattern))) {
+            /* The record and device support update the statistics with the
+             * record locked, so copy them under the lock and print the copy */
+            dbScanLock((dbCommon *)pmca);
+            snapshot = *ptiming;
+            if (reset) mcaTimingReset(ptiming);
+            dbScanUnlock((dbCommon *)pmca);
+            printf("%s\n", pmca->name);
+            printf("    %-10s %8s %10s %10s %10s %10s\n",
+                   "Stage", "Count", "Last (ms)", "Min (ms)", "Max (ms)", "Mean (ms)");
+            for (i=0; i<MAX_MCA_TIME_STAGES; i++) {
+                pstat = &snapshot.stat[i];
+                printf("    %-10s %8u %10.3f %10.3f %10.3f %10.3f\n",
+                       stageNames[i], (unsigned)pstat->count, 1e3*pstat->last,
+                       1e3*pstat->min, 1e3*pstat->max,
+                       pstat->count ? 1e3*pstat->sum/pstat->count : 0.);
+            }
+        }
+        status = dbNextRecord(&dbentry);
+    }
+    dbFinishEntry(&dbentry);
+}
+
+static const iocshArg timingReportArg0 = { "pattern",iocshArgString};
+static const iocshArg timingReportArg1 = { "reset",iocshArgInt};
+static const iocshArg * const timingReportArgs[2] = {&timingReportArg0,
+                                                     &timingReportArg1};
+static const iocshFuncDef timingReportFuncDef = {"mcaRecordTimingReport",2,timingReportArgs};
+static void timingReportCallFunc(const iocshArgBuf *args)
+{
+    mcaRecordTimingReport(args[0].sval, args[1].ival);
+}
+
+void mcaTimingRegister(void)
+{
+    iocshRegister(&timingReportFuncDef,timingReportCallFunc);
+}
+
+epicsExportRegistrar(mcaTimingRegister);
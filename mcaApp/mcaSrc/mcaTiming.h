@@ -0,0 +1,57 @@
+/* mcaTiming.h --
+ * Optional timing of the stages between a read request from the mca record
+ * and the spectrum being posted.  Timing is enabled by setting the variable
+ * mcaRecordTiming to 1, and the results are printed with the iocsh command
+ * mcaRecordTimingReport.  When it is disabled each timing point costs one test.
+ */
+
+#ifndef mcaTimingH
+#define mcaTimingH
+
+#include <epicsTypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    mcaTimeTotal,       /* Record starts a read until the spectrum is posted */
+    mcaTimeQueue,       /* Device support queues the read until the driver is ready */
+    mcaTimeDriver,      /* Driver readInt32Array */
+    mcaTimeReadArray,   /* Device support read_array */
+    mcaTimeSumROIs,     /* Record sum_ROIs */
+    mcaTimeMonitor,     /* Record monitor */
+    lastMcaTimeStage
+} mcaTimeStage;
+
+#define MAX_MCA_TIME_STAGES lastMcaTimeStage
+
+typedef struct {
+    double last;
+    double min;
+    double max;
+    double sum;
+    epicsUInt32 count;
+} mcaTimeStat;
+
+typedef struct {
+    epicsUInt64 start[MAX_MCA_TIME_STAGES];
+    mcaTimeStat stat[MAX_MCA_TIME_STAGES];
+} mcaTiming;
+
+extern volatile int mcaRecordTiming;
+
+void mcaTimingStart(mcaTiming *ptiming, mcaTimeStage stage);
+void mcaTimingStop(mcaTiming *ptiming, mcaTimeStage stage);
+void mcaTimingReset(mcaTiming *ptiming);
+
+#define MCA_TIMING_START(ptiming, stage) \
+    do { if (mcaRecordTiming && (ptiming)) mcaTimingStart(ptiming, stage); } while (0)
+#define MCA_TIMING_STOP(ptiming, stage) \
+    do { if (mcaRecordTiming && (ptiming)) mcaTimingStop(ptiming, stage); } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* mcaTimingH */